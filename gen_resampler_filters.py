@@ -0,0 +1,77 @@
+#! /usr/bin/env python3
+# Generates main/audio_processing/resampler_filters.cc
+# The design matches PolyphaseResampler::DesignFilter(), keep them in sync
+import math
+
+# Q14, see RESAMPLER_COEFFICIENT_SHIFT
+COEFFICIENT_SHIFT = 14
+
+# Rate pairs used by the boards, input -> output
+RATES = [(24000, 16000), (48000, 16000), (16000, 24000)]
+
+# Same order as ResamplerQuality: taps per phase, rolloff, Kaiser beta
+TIERS = [
+    ("kResamplerQualityFast", 16, 0.85, 5.0),
+    ("kResamplerQualityBalanced", 32, 0.9, 7.0),
+    ("kResamplerQualityHigh", 64, 0.94, 9.0),
+]
+
+
+def bessel_i0(x):
+    total, term = 1.0, 1.0
+    for k in range(1, 32):
+        term *= (x / (2 * k)) * (x / (2 * k))
+        total += term
+    return total
+
+
+def design(input_rate, output_rate, taps, rolloff, beta):
+    divisor = math.gcd(input_rate, output_rate)
+    up, down = output_rate // divisor, input_rate // divisor
+    length = up * taps
+    cutoff = 0.5 / max(up, down) * rolloff
+    center = (length - 1) / 2.0
+    window_scale = 1.0 / bessel_i0(beta)
+    coefficients = []
+    for phase in range(up):
+        row = []
+        for tap in range(taps):
+            x = phase + tap * up - center
+            sinc = 2 * cutoff if x == 0 else math.sin(2 * math.pi * cutoff * x) / (math.pi * x)
+            ratio = x / center
+            window = bessel_i0(beta * math.sqrt(max(0.0, 1 - ratio * ratio))) * window_scale
+            row.append(sinc * window)
+        total = sum(row)
+        quantized = [max(-32768, min(32767, round(value / total * (1 << COEFFICIENT_SHIFT)))) for value in row]
+        coefficients += reversed(quantized)
+    return coefficients
+
+
+def main():
+    lines = [
+        "// Generated by gen_resampler_filters.py, do not edit",
+        "#include \"resampler_filters.h\"",
+        "",
+    ]
+    banks = []
+    for quality, taps, rolloff, beta in TIERS:
+        for input_rate, output_rate in RATES:
+            name = f"k{quality[len('kResamplerQuality'):]}{input_rate // 1000}kTo{output_rate // 1000}k"
+            coefficients = design(input_rate, output_rate, taps, rolloff, beta)
+            lines.append(f"static const int16_t {name}[{len(coefficients)}] = {{")
+            for i in range(0, len(coefficients), 16):
+                lines.append("    " + ", ".join(str(c) for c in coefficients[i:i + 16]) + ",")
+            lines.append("};")
+            lines.append("")
+            banks.append(f"    {{ {input_rate}, {output_rate}, {quality}, {taps}, {name} }},")
+    lines.append("const ResamplerFilterBank kResamplerFilterBanks[] = {")
+    lines += banks
+    lines.append("};")
+    lines.append("")
+    lines.append("const size_t kResamplerFilterBankCount = sizeof(kResamplerFilterBanks) / sizeof(kResamplerFilterBanks[0]);")
+    with open("main/audio_processing/resampler_filters.cc", "w") as f:
+        f.write("\n".join(lines) + "\n")
+
+
+if __name__ == "__main__":
+    main()
@@ -4,14 +4,17 @@
 #include "system_info.h"
 #include "ml307_ssl_transport.h"
 #include "audio_codec.h"
+#include "board_capture_pipeline.h"
 #include "mqtt_protocol.h"
 #include "websocket_protocol.h"
 #include "font_awesome_symbols.h"
 #include "iot/thing_manager.h"
 
+#include <algorithm>
 #include <cstring>
+#include <cassert>
 #include <esp_log.h>
-#include <cJSON.h>
+#include <esp_timer.h>
 #include <driver/gpio.h>
 #include <arpa/inet.h>
 
@@ -34,14 +37,36 @@ static const char* const STATE_STRINGS[] = {
     "invalid_state"
 };
 
-Application::Application() : background_task_(4096 * 8) {
+Application::Application()
+    : main_messages_(MAIN_MESSAGE_QUEUE_CAPACITY),
+      audio_decode_queue_(AUDIO_DECODE_QUEUE_CAPACITY, AUDIO_MAX_PACKET_SIZE, kPacketQueueDropNewest),
+      jitter_buffer_(AUDIO_JITTER_BUFFER_CAPACITY, AUDIO_MAX_PACKET_SIZE, OPUS_FRAME_DURATION_MS) {
     event_group_ = xEventGroupCreate();
 
+    esp_timer_create_args_t standby_timer_args = {
+        .callback = [](void* arg) {
+            Application* app = (Application*)arg;
+            app->Schedule([app]() {
+                if (app->chat_state_ == kChatStateIdle && app->protocol_->IsAudioChannelOpened()) {
+                    ESP_LOGI(TAG, "Pre-warmed audio channel unused, closing it");
+                    app->protocol_->CloseAudioChannel();
+                }
+            });
+        },
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "Standby Channel Timer",
+        .skip_unhandled_events = true,
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&standby_timer_args, &standby_timer_));
+
     ota_.SetCheckVersionUrl(CONFIG_OTA_VERSION_URL);
     ota_.SetHeader("Device-Id", SystemInfo::GetMacAddress().c_str());
 }
 
 Application::~Application() {
+    esp_timer_stop(standby_timer_);
+    esp_timer_delete(standby_timer_);
     vEventGroupDelete(event_group_);
 }
 
@@ -104,19 +129,27 @@ void Application::Alert(const std::string& title, const std::string& message) {
 
 void Application::PlayLocalFile(const char* data, size_t size) {
     ESP_LOGI(TAG, "PlayLocalFile: %zu bytes", size);
-    SetDecodeSampleRate(16000);
-    for (const char* p = data; p < data + size; ) {
-        auto p3 = (BinaryProtocol3*)p;
-        p += sizeof(BinaryProtocol3);
+    // Files can be longer than the decode queue, the main loop feeds them in
+    Schedule([this, data, size]() {
+        SetDecodeSampleRate(16000);
+        local_file_pos_ = data;
+        local_file_end_ = data + size;
+        FeedLocalFile();
+    });
+}
 
+// Runs on the main loop, queues as much of the local file as fits
+void Application::FeedLocalFile() {
+    std::lock_guard<std::mutex> lock(decode_queue_producer_mutex_);
+    while (local_file_pos_ < local_file_end_ && audio_decode_queue_.size() < audio_decode_queue_.capacity()) {
+        auto p3 = (const BinaryProtocol3*)local_file_pos_;
         auto payload_size = ntohs(p3->payload_size);
-        std::vector<uint8_t> opus;
-        opus.resize(payload_size);
-        memcpy(opus.data(), p3->payload, payload_size);
-        p += payload_size;
+        local_file_pos_ += sizeof(BinaryProtocol3) + payload_size;
 
-        std::lock_guard<std::mutex> lock(mutex_);
-        audio_decode_queue_.emplace_back(std::move(opus));
+        // Local files are not sequenced, they are played in arrival order
+        OpusPacketInfo info;
+        info.timestamp = esp_timer_get_time() / 1000;
+        audio_decode_queue_.Push(p3->payload, payload_size, info);
     }
 }
 
@@ -128,8 +161,7 @@ void Application::ToggleChatState() {
         }
 
         if (chat_state_ == kChatStateIdle) {
-            SetChatState(kChatStateConnecting);
-            if (!protocol_->OpenAudioChannel()) {
+            if (!OpenAudioChannel(esp_timer_get_time())) {
                 Alert("Error", "Failed to open audio channel");
                 SetChatState(kChatStateIdle);
                 return;
@@ -155,13 +187,10 @@ void Application::StartListening() {
         
         keep_listening_ = false;
         if (chat_state_ == kChatStateIdle) {
-            if (!protocol_->IsAudioChannelOpened()) {
-                SetChatState(kChatStateConnecting);
-                if (!protocol_->OpenAudioChannel()) {
-                    SetChatState(kChatStateIdle);
-                    Alert("Error", "Failed to open audio channel");
-                    return;
-                }
+            if (!OpenAudioChannel(esp_timer_get_time())) {
+                SetChatState(kChatStateIdle);
+                Alert("Error", "Failed to open audio channel");
+                return;
             }
             protocol_->SendStartListening(kListeningModeManualStop);
             SetChatState(kChatStateListening);
@@ -197,11 +226,17 @@ void Application::Start() {
     auto codec = board.GetAudioCodec();
     opus_decode_sample_rate_ = codec->output_sample_rate();
     opus_decoder_ = std::make_unique<OpusDecoderWrapper>(opus_decode_sample_rate_, 1);
-    opus_encoder_ = std::make_unique<OpusEncoderWrapper>(16000, 1, OPUS_FRAME_DURATION_MS);
-    if (codec->input_sample_rate() != 16000) {
-        input_resampler_.Configure(codec->input_sample_rate(), 16000);
-        reference_resampler_.Configure(codec->input_sample_rate(), 16000);
-    }
+    // The pipeline is built from config.h, it has to describe the codec the board created
+    assert(codec->input_channels() == BoardCapturePipeline::kChannels &&
+        codec->input_sample_rate() == BoardCapturePipeline::kInputSampleRate);
+    opus_encode_sample_rate_ = BoardCapturePipeline::kEncodeSampleRate;
+    opus_encoder_ = std::make_unique<OpusEncoderWrapper>(opus_encode_sample_rate_, 1, OPUS_FRAME_DURATION_MS);
+    // Blocks hold a capture frame at the codec rate or at 16kHz, whichever is larger
+    size_t frame_samples = std::max<size_t>(codec->input_frame_samples(),
+        16000 / 1000 * AUDIO_INPUT_FRAME_DURATION_MS * codec->input_channels());
+    pcm_frame_pool_ = std::make_unique<PcmFramePool>(frame_samples, AUDIO_FRAME_POOL_SIZE);
+    capture_pipeline_ = std::make_unique<BoardCapturePipeline>();
+    capture_pipeline_->Configure();
     codec->OnInputReady([this, codec]() {
         BaseType_t higher_priority_task_woken = pdFALSE;
         xEventGroupSetBitsFromISR(event_group_, AUDIO_INPUT_READY_EVENT, &higher_priority_task_woken);
@@ -232,18 +267,17 @@ void Application::Start() {
     }, "check_new_version", 4096 * 2, this, 1, nullptr);
 
 #if CONFIG_IDF_TARGET_ESP32S3
-    audio_processor_.Initialize(codec->input_channels(), codec->input_reference());
-    audio_processor_.OnOutput([this](std::vector<int16_t>&& data) {
-        background_task_.Schedule([this, data = std::move(data)]() mutable {
-            opus_encoder_->Encode(std::move(data), [this](std::vector<uint8_t>&& opus) {
-                Schedule([this, opus = std::move(opus)]() {
-                    protocol_->SendAudio(opus);
-                });
-            });
+    audio_front_end_.Initialize(codec->input_channels(), codec->input_reference());
+    audio_processor_.Initialize(&audio_front_end_, AUDIO_OUTPUT_FRAME_POOL_SIZE);
+    audio_processor_.OnOutput([this](PcmFrame&& frame) {
+        // The capture time is taken at the AFE output, it does not include the AFE delay
+        uint32_t capture_time_ms = esp_timer_get_time() / 1000;
+        background_task_.Schedule(kBackgroundLaneEncode, [this, epoch = audio_epoch_.load(), capture_time_ms, frame = std::move(frame)]() mutable {
+            EncodeAudio(epoch, capture_time_ms, std::move(frame));
         });
     });
 
-    wake_word_detect_.Initialize(codec->input_channels(), codec->input_reference());
+    wake_word_detect_.Initialize(&audio_front_end_);
     wake_word_detect_.OnVadStateChange([this](bool speaking) {
         Schedule([this, speaking]() {
             auto builtin_led = Board::GetInstance().GetBuiltinLed();
@@ -261,10 +295,7 @@ void Application::Start() {
     wake_word_detect_.OnWakeWordDetected([this](const std::string& wake_word) {
         Schedule([this, &wake_word]() {
             if (chat_state_ == kChatStateIdle) {
-                SetChatState(kChatStateConnecting);
-                wake_word_detect_.EncodeWakeWordData();
-
-                if (!protocol_->OpenAudioChannel()) {
+                if (!OpenAudioChannel(wake_word_detect_.GetLastDetectedTime())) {
                     ESP_LOGE(TAG, "Failed to open audio channel");
                     SetChatState(kChatStateIdle);
                     wake_word_detect_.StartDetection();
@@ -272,10 +303,15 @@ void Application::Start() {
                 }
                 
                 std::vector<uint8_t> opus;
-                // Encode and send the wake word data to the server
+                // Send the pre-roll packets, they were encoded while detection ran
+                int packets = 0;
                 while (wake_word_detect_.GetWakeWordOpus(opus)) {
                     protocol_->SendAudio(opus);
+                    if (packets++ == 0) {
+                        LogSessionTimings();
+                    }
                 }
+                ESP_LOGI(TAG, "Sent %d pre-roll packets", packets);
                 // Set the chat state to wake word detected
                 protocol_->SendWakeWordDetected(wake_word);
                 ESP_LOGI(TAG, "Wake word detected: %s", wake_word.c_str());
@@ -285,8 +321,10 @@ void Application::Start() {
                 AbortSpeaking(kAbortReasonWakeWordDetected);
             }
 
-            // Resume detection
-            wake_word_detect_.StartDetection();
+            // Resume detection, the listening state runs the communication head instead
+            if (chat_state_ != kChatStateListening) {
+                wake_word_detect_.StartDetection();
+            }
         });
     });
     wake_word_detect_.StartDetection();
@@ -299,86 +337,94 @@ void Application::Start() {
 #else
     protocol_ = std::make_unique<MqttProtocol>();
 #endif
+    protocol_->SetAudioEpoch(audio_epoch_);
+    protocol_->SetSampleRate(opus_encode_sample_rate_);
     protocol_->OnNetworkError([this](const std::string& message) {
+        if (prewarming_) {
+            ESP_LOGW(TAG, "Failed to pre-warm audio channel: %s", message.c_str());
+            return;
+        }
         Alert("Error", std::move(message));
     });
-    protocol_->OnIncomingAudio([this](std::vector<uint8_t>&& data) {
-        std::lock_guard<std::mutex> lock(mutex_);
+    protocol_->OnIncomingAudio([this](uint32_t sequence, const uint8_t* data, size_t size) {
         if (chat_state_ == kChatStateSpeaking) {
-            audio_decode_queue_.emplace_back(std::move(data));
+            // Hold the receiver task back while the speaker catches up, an
+            // abort clears the queue and lets it go on. Control messages
+            // arrive on the network task and are not held up.
+            if (!audio_decode_queue_.WaitForSpace(pdMS_TO_TICKS(AUDIO_DECODE_QUEUE_WAIT_MS))) {
+                ESP_LOGW(TAG, "Decode queue stalled, dropping packet %lu", sequence);
+            }
+            if (chat_state_ != kChatStateSpeaking || aborted_) {
+                return;
+            }
+            OpusPacketInfo info;
+            info.sequence = sequence;
+            info.timestamp = esp_timer_get_time() / 1000;
+            std::lock_guard<std::mutex> lock(decode_queue_producer_mutex_);
+            audio_decode_queue_.Push(data, size, info);
         }
     });
-    protocol_->OnAudioChannelOpened([this, codec, &board]() {
-        board.SetPowerSaveMode(false);
-        if (protocol_->server_sample_rate() != codec->output_sample_rate()) {
-            ESP_LOGW(TAG, "服务器的音频采样率 %d 与设备输出的采样率 %d 不一致，重采样后可能会失真",
-                protocol_->server_sample_rate(), codec->output_sample_rate());
+    protocol_->OnAudioChannelOpened([this]() {
+        // A pre-warm opens the channel on its own task, finish on the main loop
+        if (prewarming_) {
+            Schedule([this]() {
+                AudioChannelOpened();
+            });
+        } else {
+            AudioChannelOpened();
         }
-        SetDecodeSampleRate(protocol_->server_sample_rate());
-        // 物联网设备描述符
-        last_iot_states_.clear();
-        auto& thing_manager = iot::ThingManager::GetInstance();
-        protocol_->SendIotDescriptors(thing_manager.GetDescriptorsJson());
     });
     protocol_->OnAudioChannelClosed([this, &board]() {
         board.SetPowerSaveMode(true);
-        Schedule([this]() {
-            SetChatState(kChatStateIdle);
-        });
+        PostChatState(kChatStateIdle);
     });
-    protocol_->OnIncomingJson([this, display](const cJSON* root) {
-        // Parse JSON data
-        auto type = cJSON_GetObjectItem(root, "type");
-        if (strcmp(type->valuestring, "tts") == 0) {
-            auto state = cJSON_GetObjectItem(root, "state");
-            if (strcmp(state->valuestring, "start") == 0) {
-                Schedule([this]() {
-                    aborted_ = false;
-                    if (chat_state_ == kChatStateIdle || chat_state_ == kChatStateListening) {
-                        SetChatState(kChatStateSpeaking);
-                    }
-                });
-            } else if (strcmp(state->valuestring, "stop") == 0) {
-                Schedule([this]() {
-                    if (chat_state_ == kChatStateSpeaking) {
-                        background_task_.WaitForCompletion();
-                        if (keep_listening_) {
-                            protocol_->SendStartListening(kListeningModeAutoStop);
-                            SetChatState(kChatStateListening);
-                        } else {
-                            SetChatState(kChatStateIdle);
-                        }
-                    }
-                });
-            } else if (strcmp(state->valuestring, "sentence_start") == 0) {
-                auto text = cJSON_GetObjectItem(root, "text");
-                if (text != NULL) {
-                    ESP_LOGI(TAG, "<< %s", text->valuestring);
-                    display->SetChatMessage("assistant", text->valuestring);
+    protocol_->OnIncomingJson("tts", [this, display](const JsonValue& root) {
+        auto state = root["state"];
+        if (state.Equals("start")) {
+            Schedule([this]() {
+                aborted_ = false;
+                if (chat_state_ == kChatStateIdle || chat_state_ == kChatStateListening) {
+                    SetChatState(kChatStateSpeaking);
                 }
-            }
-        } else if (strcmp(type->valuestring, "stt") == 0) {
-            auto text = cJSON_GetObjectItem(root, "text");
-            if (text != NULL) {
-                ESP_LOGI(TAG, ">> %s", text->valuestring);
-                display->SetChatMessage("user", text->valuestring);
-            }
-        } else if (strcmp(type->valuestring, "llm") == 0) {
-            auto emotion = cJSON_GetObjectItem(root, "emotion");
-            if (emotion != NULL) {
-                display->SetEmotion(emotion->valuestring);
-            }
-        } else if (strcmp(type->valuestring, "iot") == 0) {
-            auto commands = cJSON_GetObjectItem(root, "commands");
-            if (commands != NULL) {
-                auto& thing_manager = iot::ThingManager::GetInstance();
-                for (int i = 0; i < cJSON_GetArraySize(commands); ++i) {
-                    auto command = cJSON_GetArrayItem(commands, i);
-                    thing_manager.Invoke(command);
+            });
+        } else if (state.Equals("stop")) {
+            Schedule([this]() {
+                if (chat_state_ == kChatStateSpeaking) {
+                    // Leave the speaking state once the buffered audio is played out
+                    tts_stop_pending_ = true;
                 }
+            });
+        } else if (state.Equals("sentence_start")) {
+            auto text = root["text"];
+            if (text.IsString()) {
+                auto message = text.ToString();
+                ESP_LOGI(TAG, "<< %s", message.c_str());
+                display->SetChatMessage("assistant", message);
             }
         }
     });
+    protocol_->OnIncomingJson("stt", [display](const JsonValue& root) {
+        auto text = root["text"];
+        if (text.IsString()) {
+            auto message = text.ToString();
+            ESP_LOGI(TAG, ">> %s", message.c_str());
+            display->SetChatMessage("user", message);
+        }
+    });
+    protocol_->OnIncomingJson("llm", [display](const JsonValue& root) {
+        auto emotion = root["emotion"];
+        if (emotion.IsString()) {
+            display->SetEmotion(emotion.ToString());
+        }
+    });
+    protocol_->OnIncomingJson("iot", [](const JsonValue& root) {
+        auto commands = root["commands"];
+        auto& thing_manager = iot::ThingManager::GetInstance();
+        for (size_t i = 0; i < commands.size(); ++i) {
+            thing_manager.Invoke(commands[i]);
+        }
+    });
+    protocol_->Start();
 
     // Blink the LED to indicate the device is running
     display->SetStatus("待命");
@@ -388,12 +434,18 @@ void Application::Start() {
     SetChatState(kChatStateIdle);
 }
 
-void Application::Schedule(std::function<void()> callback) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    main_tasks_.push_back(std::move(callback));
+void Application::PostMessage(MainMessage&& message) {
+    main_messages_.Push(std::move(message));
     xEventGroupSetBits(event_group_, SCHEDULE_EVENT);
 }
 
+void Application::PostChatState(ChatState state) {
+    MainMessage message;
+    message.type = kMainMessageChatState;
+    message.chat_state = state;
+    PostMessage(std::move(message));
+}
+
 // The Main Loop controls the chat state and websocket connection
 // If other tasks need to access the websocket or chat state,
 // they should use Schedule to call this function
@@ -410,31 +462,82 @@ void Application::MainLoop() {
             OutputAudio();
         }
         if (bits & SCHEDULE_EVENT) {
-            mutex_.lock();
-            std::list<std::function<void()>> tasks = std::move(main_tasks_);
-            mutex_.unlock();
-            for (auto& task : tasks) {
-                task();
+            MainMessage message;
+            while (main_messages_.Pop(message)) {
+                switch (message.type) {
+                    case kMainMessageCallback:
+                        message.callback();
+                        message.callback.Reset();
+                        break;
+                    case kMainMessageChatState:
+                        SetChatState((ChatState)message.chat_state);
+                        break;
+                }
             }
         }
     }
 }
 
 void Application::ResetDecoder() {
-    std::lock_guard<std::mutex> lock(mutex_);
-    opus_decoder_->ResetState();
-    audio_decode_queue_.clear();
+    if (audio_decode_queue_.dropped_count() > 0 || audio_decode_queue_.oversized_count() > 0) {
+        ESP_LOGW(TAG, "Decode queue high watermark: %zu/%zu, dropped: %lu, oversized: %lu",
+            audio_decode_queue_.high_watermark(), audio_decode_queue_.capacity(),
+            audio_decode_queue_.dropped_count(), audio_decode_queue_.oversized_count());
+    }
+    auto& stats = jitter_buffer_.stats();
+    if (stats.received > 0) {
+        ESP_LOGI(TAG, "Jitter buffer: played %lu, concealed %lu, late %lu, underruns %lu, silence dropped %lu, jitter %dms, added latency %dms",
+            stats.played, stats.concealed, stats.late, stats.underruns, stats.silence_dropped,
+            stats.jitter_ms, jitter_buffer_.latency_ms());
+    }
+    // Runs behind the decodes already scheduled, they are stale and skip themselves
+    background_task_.ScheduleControl(kBackgroundLaneDecode, [this]() {
+        opus_decoder_->ResetState();
+    });
+    local_file_pos_ = local_file_end_;
+    audio_decode_queue_.Clear();
+    jitter_buffer_.Reset();
     last_output_time_ = std::chrono::steady_clock::now();
     Board::GetInstance().GetAudioCodec()->EnableOutput(true);
 }
 
+void Application::FinishSpeaking() {
+    if (keep_listening_) {
+        protocol_->SendStartListening(kListeningModeAutoStop);
+        SetChatState(kChatStateListening);
+    } else {
+        SetChatState(kChatStateIdle);
+    }
+}
+
 void Application::OutputAudio() {
     auto now = std::chrono::steady_clock::now();
     auto codec = Board::GetInstance().GetAudioCodec();
     const int max_silence_seconds = 10;
 
-    std::unique_lock<std::mutex> lock(mutex_);
-    if (audio_decode_queue_.empty()) {
+    if (chat_state_ == kChatStateListening || aborted_) {
+        local_file_pos_ = local_file_end_;
+        audio_decode_queue_.Clear();
+        if (!jitter_buffer_.empty()) {
+            jitter_buffer_.Reset();
+        }
+    } else {
+        // Move the arrived packets into the jitter buffer
+        OpusPacketInfo info;
+        while (!jitter_buffer_.full() && audio_decode_queue_.Pop(incoming_packet_, &info)) {
+            jitter_buffer_.Put(info.sequence, info.timestamp, incoming_packet_.data(), incoming_packet_.size());
+        }
+        if (local_file_pos_ < local_file_end_) {
+            FeedLocalFile();
+        }
+    }
+
+    if (jitter_buffer_.empty() && decode_in_flight_ == 0) {
+        if (tts_stop_pending_ && audio_decode_queue_.empty()) {
+            tts_stop_pending_ = false;
+            FinishSpeaking();
+            return;
+        }
         // Disable the output if there is no audio data for a long time
         if (chat_state_ == kChatStateIdle) {
             auto duration = std::chrono::duration_cast<std::chrono::seconds>(now - last_output_time_).count();
@@ -442,87 +545,87 @@ void Application::OutputAudio() {
                 codec->EnableOutput(false);
             }
         }
-        return;
     }
 
-    if (chat_state_ == kChatStateListening) {
-        audio_decode_queue_.clear();
+    // The speaker consumes the decoded audio, keep only a few packets ahead of it
+    if (decode_in_flight_ >= AUDIO_DECODE_LEAD_PACKETS) {
         return;
     }
 
+    std::vector<uint8_t> opus;
+    uint32_t now_ms = esp_timer_get_time() / 1000;
+    if (jitter_buffer_.Get(now_ms, opus) == kJitterBufferWait) {
+        return;
+    }
     last_output_time_ = now;
-    auto opus = std::move(audio_decode_queue_.front());
-    audio_decode_queue_.pop_front();
-    lock.unlock();
 
-    background_task_.Schedule([this, codec, opus = std::move(opus)]() mutable {
-        if (aborted_) {
-            return;
-        }
+    // An empty packet makes the decoder conceal the lost frame
+    decode_in_flight_++;
+    if (!background_task_.Schedule(kBackgroundLaneDecode, [this, codec, epoch = audio_epoch_.load(), opus = std::move(opus)]() mutable {
+        DecodeAudio(codec, epoch, std::move(opus));
+        decode_in_flight_--;
+    })) {
+        decode_in_flight_--;
+    }
+}
 
-        std::vector<int16_t> pcm;
-        if (!opus_decoder_->Decode(std::move(opus), pcm)) {
-            return;
-        }
+void Application::DecodeAudio(AudioCodec* codec, uint32_t epoch, std::vector<uint8_t>&& opus) {
+    if (aborted_ || epoch != audio_epoch_) {
+        return;
+    }
 
-        // Resample if the sample rate is different
-        if (opus_decode_sample_rate_ != codec->output_sample_rate()) {
-            int target_size = output_resampler_.GetOutputSamples(pcm.size());
-            std::vector<int16_t> resampled(target_size);
-            output_resampler_.Process(pcm.data(), pcm.size(), resampled.data());
-            pcm = std::move(resampled);
+    std::vector<int16_t> pcm;
+    if (!opus_decoder_->Decode(std::move(opus), pcm)) {
+        return;
+    }
+
+    // Resample if the sample rate is different, into a buffer that is reused
+    if (output_resample_) {
+        resampled_pcm_.resize(output_resampler_.GetOutputSamples(pcm.size()));
+        resampled_pcm_.resize(output_resampler_.Process(pcm.data(), pcm.size(), resampled_pcm_.data()));
+        codec->OutputData(resampled_pcm_);
+        return;
+    }
+
+    codec->OutputData(pcm);
+}
+
+void Application::EncodeAudio(uint32_t epoch, uint32_t capture_time_ms, PcmFrame&& frame) {
+    if (epoch != audio_epoch_) {
+        return;
+    }
+    // The encoder takes ownership of a vector, this is the only copy left
+    std::vector<int16_t> pcm(frame.data(), frame.data() + frame.size());
+    frame = PcmFrame();
+    // Packets go straight to the protocol sender task, not through the main loop
+    opus_encoder_->Encode(std::move(pcm), [this, epoch, capture_time_ms](std::vector<uint8_t>&& opus) {
+        if (epoch == audio_epoch_) {
+            protocol_->QueueAudio(opus.data(), opus.size(), capture_time_ms, epoch);
+            if (first_audio_pending_) {
+                LogSessionTimings();
+            }
         }
-        
-        codec->OutputData(pcm);
     });
 }
 
 void Application::InputAudio() {
     auto codec = Board::GetInstance().GetAudioCodec();
-    std::vector<int16_t> data;
-    if (!codec->InputData(data)) {
+    auto frame = pcm_frame_pool_->Acquire();
+    if (!frame || !codec->InputData(frame)) {
         return;
     }
 
-    if (codec->input_sample_rate() != 16000) {
-        if (codec->input_channels() == 2) {
-            auto mic_channel = std::vector<int16_t>(data.size() / 2);
-            auto reference_channel = std::vector<int16_t>(data.size() / 2);
-            for (size_t i = 0, j = 0; i < mic_channel.size(); ++i, j += 2) {
-                mic_channel[i] = data[j];
-                reference_channel[i] = data[j + 1];
-            }
-            auto resampled_mic = std::vector<int16_t>(input_resampler_.GetOutputSamples(mic_channel.size()));
-            auto resampled_reference = std::vector<int16_t>(reference_resampler_.GetOutputSamples(reference_channel.size()));
-            input_resampler_.Process(mic_channel.data(), mic_channel.size(), resampled_mic.data());
-            reference_resampler_.Process(reference_channel.data(), reference_channel.size(), resampled_reference.data());
-            data.resize(resampled_mic.size() + resampled_reference.size());
-            for (size_t i = 0, j = 0; i < resampled_mic.size(); ++i, j += 2) {
-                data[j] = resampled_mic[i];
-                data[j + 1] = resampled_reference[i];
-            }
-        } else {
-            auto resampled = std::vector<int16_t>(input_resampler_.GetOutputSamples(data.size()));
-            input_resampler_.Process(data.data(), data.size(), resampled.data());
-            data = std::move(resampled);
-        }
-    }
-    
+    frame.resize(capture_pipeline_->Process(frame.data(), frame.size()));
+
 #if CONFIG_IDF_TARGET_ESP32S3
-    if (audio_processor_.IsRunning()) {
-        audio_processor_.Input(data);
-    }
-    if (wake_word_detect_.IsDetectionRunning()) {
-        wake_word_detect_.Feed(data);
+    if (audio_front_end_.IsRunning()) {
+        audio_front_end_.Feed(frame.data(), frame.size());
     }
 #else
     if (chat_state_ == kChatStateListening) {
-        background_task_.Schedule([this, data = std::move(data)]() mutable {
-            opus_encoder_->Encode(std::move(data), [this](std::vector<uint8_t>&& opus) {
-                Schedule([this, opus = std::move(opus)]() {
-                    protocol_->SendAudio(opus);
-                });
-            });
+        uint32_t capture_time_ms = esp_timer_get_time() / 1000;
+        background_task_.Schedule(kBackgroundLaneEncode, [this, epoch = audio_epoch_.load(), capture_time_ms, frame = std::move(frame)]() mutable {
+            EncodeAudio(epoch, capture_time_ms, std::move(frame));
         });
     }
 #endif
@@ -539,10 +642,16 @@ void Application::SetChatState(ChatState state) {
         return;
     }
     
+    auto start_time = esp_timer_get_time();
+    [[maybe_unused]] auto previous_state = chat_state_;
     chat_state_ = state;
+    tts_stop_pending_ = false;
     ESP_LOGI(TAG, "STATE: %s", STATE_STRINGS[chat_state_]);
-    // The state is changed, wait for all background tasks to finish
-    background_task_.WaitForCompletion();
+    // Audio work still queued for the previous state is dropped when it runs
+    audio_epoch_++;
+    if (protocol_) {
+        protocol_->SetAudioEpoch(audio_epoch_);
+    }
 
     auto display = Board::GetInstance().GetDisplay();
     auto builtin_led = Board::GetInstance().GetBuiltinLed();
@@ -552,8 +661,23 @@ void Application::SetChatState(ChatState state) {
             builtin_led->TurnOff();
             display->SetStatus("待命");
             display->SetEmotion("neutral");
+            background_task_.LogStats();
+            Board::GetInstance().LogConnectionMetrics();
+            ESP_LOGI(TAG, "Main loop: %lu messages, peak depth %zu/%zu, overflowed %lu",
+                (unsigned long)main_messages_.pushed_count(), main_messages_.high_watermark(),
+                main_messages_.capacity(), (unsigned long)main_messages_.overflowed_count());
 #ifdef CONFIG_IDF_TARGET_ESP32S3
             audio_processor_.Stop();
+            wake_word_detect_.StartDetection();
+#endif
+#if CONFIG_AUDIO_CHANNEL_PREWARM
+            // At boot and after a conversation the next request is likely soon
+            if (previous_state == kChatStateUnknown || previous_state == kChatStateListening ||
+                previous_state == kChatStateSpeaking) {
+                Schedule([this]() {
+                    PrewarmAudioChannel();
+                });
+            }
 #endif
             break;
         case kChatStateConnecting:
@@ -567,8 +691,11 @@ void Application::SetChatState(ChatState state) {
             display->SetStatus("聆听中...");
             display->SetEmotion("neutral");
             ResetDecoder();
-            opus_encoder_->ResetState();
+            background_task_.ScheduleControl(kBackgroundLaneEncode, [this]() {
+                opus_encoder_->ResetState();
+            });
 #if CONFIG_IDF_TARGET_ESP32S3
+            wake_word_detect_.StopDetection();
             audio_processor_.Start();
 #endif
             UpdateIotStates();
@@ -580,6 +707,7 @@ void Application::SetChatState(ChatState state) {
             ResetDecoder();
 #if CONFIG_IDF_TARGET_ESP32S3
             audio_processor_.Stop();
+            wake_word_detect_.StartDetection();
 #endif
             break;
         case kChatStateUpgrading:
@@ -590,6 +718,114 @@ void Application::SetChatState(ChatState state) {
             ESP_LOGE(TAG, "Invalid chat state: %d", chat_state_);
             return;
     }
+    ESP_LOGI(TAG, "State transition took %lld us", esp_timer_get_time() - start_time);
+}
+
+void Application::AudioChannelOpened() {
+    auto& board = Board::GetInstance();
+    auto codec = board.GetAudioCodec();
+    board.SetPowerSaveMode(false);
+    if (protocol_->server_sample_rate() != codec->output_sample_rate()) {
+        ESP_LOGW(TAG, "服务器的音频采样率 %d 与设备输出的采样率 %d 不一致，重采样后可能会失真",
+            protocol_->server_sample_rate(), codec->output_sample_rate());
+    }
+    SetDecodeSampleRate(protocol_->server_sample_rate());
+    // 物联网设备描述符
+    last_iot_states_.clear();
+    auto& thing_manager = iot::ThingManager::GetInstance();
+    protocol_->SendIotDescriptors(thing_manager.GetDescriptorsJson());
+}
+
+// Opens the audio channel for a new session, a pre-warmed channel is reused
+bool Application::OpenAudioChannel(int64_t session_start_time) {
+    esp_timer_stop(standby_timer_);
+    session_start_time_ = session_start_time;
+    first_audio_pending_ = true;
+
+    // Waits for a pre-warm that is still connecting, it may leave a channel to reuse
+    std::lock_guard<std::mutex> lock(channel_open_mutex_);
+#if CONFIG_AUDIO_CHANNEL_PREWARM
+    session_prewarmed_ = protocol_->IsAudioChannelOpened();
+#else
+    session_prewarmed_ = false;
+#endif
+    if (session_prewarmed_) {
+        return true;
+    }
+
+    SetChatState(kChatStateConnecting);
+    if (!protocol_->OpenAudioChannel()) {
+        first_audio_pending_ = false;
+        return false;
+    }
+    return true;
+}
+
+void Application::PrewarmAudioChannel() {
+#if CONFIG_AUDIO_CHANNEL_PREWARM
+    if (chat_state_ != kChatStateIdle) {
+        return;
+    }
+    if (prewarming_) {
+        return;
+    }
+    if (protocol_->IsAudioChannelOpened()) {
+        esp_timer_stop(standby_timer_);
+        esp_timer_start_once(standby_timer_, CONFIG_AUDIO_CHANNEL_PREWARM_IDLE_TIMEOUT * 1000000LL);
+        return;
+    }
+
+    int64_t now = esp_timer_get_time();
+    if (prewarm_window_start_ == 0 || now - prewarm_window_start_ > 3600LL * 1000000) {
+        prewarm_window_start_ = now;
+        prewarm_count_ = 0;
+    }
+    if (prewarm_count_ >= CONFIG_AUDIO_CHANNEL_PREWARM_MAX_PER_HOUR) {
+        ESP_LOGI(TAG, "Pre-warm budget used up, the channel opens on demand");
+        return;
+    }
+    prewarm_count_++;
+
+    // The connect and hello take seconds, keep them off the main loop so
+    // wake word detection and buttons keep working while idle
+    prewarming_ = true;
+    xTaskCreate([](void* arg) {
+        Application* app = (Application*)arg;
+        bool opened = false;
+        {
+            std::lock_guard<std::mutex> lock(app->channel_open_mutex_);
+            // A session may have opened the channel while the task started
+            if (app->chat_state_ == kChatStateIdle && !app->protocol_->IsAudioChannelOpened()) {
+                opened = app->protocol_->OpenAudioChannel();
+            }
+            // Before the unlock, a session that takes the mutex next reports its own errors
+            app->prewarming_ = false;
+        }
+        if (opened) {
+            auto& timings = app->protocol_->channel_timings();
+            ESP_LOGI(TAG, "Audio channel pre-warmed, connect %lld ms, hello %lld ms",
+                timings.connect_us / 1000, timings.hello_us / 1000);
+            app->Schedule([app]() {
+                if (app->chat_state_ == kChatStateIdle) {
+                    esp_timer_stop(app->standby_timer_);
+                    esp_timer_start_once(app->standby_timer_, CONFIG_AUDIO_CHANNEL_PREWARM_IDLE_TIMEOUT * 1000000LL);
+                }
+            });
+        }
+        vTaskDelete(NULL);
+    }, "prewarm_channel", 4096 * 2, this, 1, nullptr);
+#endif
+}
+
+void Application::LogSessionTimings() {
+    if (!first_audio_pending_.exchange(false)) {
+        return;
+    }
+    // The connect and hello times of a pre-warmed channel were paid before the session
+    auto& timings = protocol_->channel_timings();
+    ESP_LOGI(TAG, "Session timings: %s channel, connect %lld ms, hello %lld ms, first audio %lld ms",
+        session_prewarmed_ ? "pre-warmed" : "cold", timings.connect_us / 1000, timings.hello_us / 1000,
+        (esp_timer_get_time() - session_start_time_) / 1000);
 }
 
 void Application::SetDecodeSampleRate(int sample_rate) {
@@ -598,13 +834,25 @@ void Application::SetDecodeSampleRate(int sample_rate) {
     }
 
     opus_decode_sample_rate_ = sample_rate;
-    opus_decoder_ = std::make_unique<OpusDecoderWrapper>(opus_decode_sample_rate_, 1);
+    // The decoder belongs to the decode lane, replace it there behind the pending decodes
+    background_task_.ScheduleControl(kBackgroundLaneDecode, [this, sample_rate]() {
+        auto codec = Board::GetInstance().GetAudioCodec();
+        int decode_sample_rate = sample_rate;
+#if CONFIG_AUDIO_OPUS_NATIVE_RATE
+        // Opus decodes a stream at any of its rates, whatever rate it was encoded at
+        if (IsOpusSampleRate(codec->output_sample_rate())) {
+            decode_sample_rate = codec->output_sample_rate();
+        }
+#endif
+        opus_decoder_ = std::make_unique<OpusDecoderWrapper>(decode_sample_rate, 1);
 
-    auto codec = Board::GetInstance().GetAudioCodec();
-    if (opus_decode_sample_rate_ != codec->output_sample_rate()) {
-        ESP_LOGI(TAG, "Resampling audio from %d to %d", opus_decode_sample_rate_, codec->output_sample_rate());
-        output_resampler_.Configure(opus_decode_sample_rate_, codec->output_sample_rate());
-    }
+        output_resample_ = decode_sample_rate != codec->output_sample_rate();
+        if (output_resample_) {
+            ESP_LOGI(TAG, "Resampling audio from %d to %d", decode_sample_rate, codec->output_sample_rate());
+            output_resampler_.Configure(decode_sample_rate, codec->output_sample_rate(), 1,
+                decode_sample_rate / 1000 * OPUS_FRAME_DURATION_MS, AUDIO_RESAMPLER_QUALITY);
+        }
+    });
 }
 
 void Application::UpdateIotStates() {
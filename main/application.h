@@ -4,28 +4,39 @@
 #include <freertos/FreeRTOS.h>
 #include <freertos/event_groups.h>
 #include <freertos/task.h>
+#include <esp_timer.h>
 
 #include <string>
 #include <mutex>
-#include <list>
+#include <atomic>
 
 #include <opus_encoder.h>
 #include <opus_decoder.h>
-#include <opus_resampler.h>
 
 #include "protocol.h"
 #include "ota.h"
 #include "background_task.h"
+#include "main_message_queue.h"
+#include "opus_packet_queue.h"
+#include "jitter_buffer.h"
+#include "pcm_frame_pool.h"
+#include "polyphase_resampler.h"
 
 #if CONFIG_IDF_TARGET_ESP32S3
+#include "audio_front_end.h"
 #include "wake_word_detect.h"
 #include "audio_processor.h"
 #endif
 
+class AudioCodec;
+class BoardCapturePipeline;
+
 #define SCHEDULE_EVENT (1 << 0)
 #define AUDIO_INPUT_READY_EVENT (1 << 1)
 #define AUDIO_OUTPUT_READY_EVENT (1 << 2)
 
+#define MAIN_MESSAGE_QUEUE_CAPACITY 32
+
 enum ChatState {
     kChatStateUnknown,
     kChatStateIdle,
@@ -37,6 +48,37 @@ enum ChatState {
 
 #define OPUS_FRAME_DURATION_MS 60
 
+// The server sends speech faster than real time. When the decode queue is
+// full the protocol receiver task waits for the speaker instead of dropping
+// packets, so the queue only has to cover jitter, not a whole reply.
+#if CONFIG_IDF_TARGET_ESP32S3
+#define AUDIO_DECODE_QUEUE_CAPACITY 128
+#define AUDIO_JITTER_BUFFER_CAPACITY 32
+#define AUDIO_MAX_PACKET_SIZE 1024
+#else
+#define AUDIO_DECODE_QUEUE_CAPACITY 24
+#define AUDIO_JITTER_BUFFER_CAPACITY 16
+#define AUDIO_MAX_PACKET_SIZE 512
+#endif
+// The speaker takes a packet every frame, a longer wait means it stalled
+#define AUDIO_DECODE_QUEUE_WAIT_MS 2000
+
+// Packets handed to the decoder ahead of the speaker, this is the playout clock
+#define AUDIO_DECODE_LEAD_PACKETS 2
+
+#if CONFIG_IDF_TARGET_ESP32S3
+// Capture frames are fed to the AFE and released right away
+#define AUDIO_FRAME_POOL_SIZE 12
+// AFE output frames waiting on the encode lane, plus the one being encoded
+// and the one being filled
+#define AUDIO_OUTPUT_FRAME_POOL_SIZE (BACKGROUND_ENCODE_LANE_CAPACITY + 2)
+#else
+// Every frame queued on the encode lane holds a block, plus the one being
+// captured and the one being encoded. The lane drops the oldest frame when
+// encoding falls behind, the pool must never run out before it does.
+#define AUDIO_FRAME_POOL_SIZE (BACKGROUND_ENCODE_LANE_CAPACITY + 2)
+#endif
+
 class Application {
 public:
     static Application& GetInstance() {
@@ -49,7 +91,14 @@ public:
 
     void Start();
     ChatState GetChatState() const { return chat_state_; }
-    void Schedule(std::function<void()> callback);
+    template <typename F>
+    void Schedule(F&& callback) {
+        MainMessage message;
+        message.type = kMainMessageCallback;
+        message.callback = InplaceFunction<MAIN_MESSAGE_CALLBACK_SIZE>(std::forward<F>(callback));
+        PostMessage(std::move(message));
+    }
+    void PostChatState(ChatState state);
     void SetChatState(ChatState state);
     void Alert(const std::string& title, const std::string& message);
     void AbortSpeaking(AbortReason reason);
@@ -63,12 +112,12 @@ private:
     ~Application();
 
 #if CONFIG_IDF_TARGET_ESP32S3
+    AudioFrontEnd audio_front_end_;
     WakeWordDetect wake_word_detect_;
     AudioProcessor audio_processor_;
 #endif
     Ota ota_;
-    std::mutex mutex_;
-    std::list<std::function<void()>> main_tasks_;
+    MainMessageQueue main_messages_;
     std::unique_ptr<Protocol> protocol_;
     EventGroupHandle_t event_group_;
     volatile ChatState chat_state_ = kChatStateUnknown;
@@ -79,24 +128,59 @@ private:
     // Audio encode / decode
     BackgroundTask background_task_;
     std::chrono::steady_clock::time_point last_output_time_;
-    std::list<std::vector<uint8_t>> audio_decode_queue_;
+    OpusPacketQueue audio_decode_queue_;
+    std::mutex decode_queue_producer_mutex_;
+    JitterBuffer jitter_buffer_;
+    std::vector<uint8_t> incoming_packet_;
+    std::atomic<int> decode_in_flight_{0};
+    // Bumped on every state change, audio work scheduled in an older epoch is discarded
+    std::atomic<uint32_t> audio_epoch_{0};
+    bool tts_stop_pending_ = false;
+    // Rest of the local file being played, queued as the speaker makes room
+    const char* local_file_pos_ = nullptr;
+    const char* local_file_end_ = nullptr;
+
+    // Session timing breakdown, logged when the first audio packet goes out
+    int64_t session_start_time_ = 0;
+    bool session_prewarmed_ = false;
+    std::atomic<bool> first_audio_pending_{false};
+
+    // Audio channel kept open while idle, see CONFIG_AUDIO_CHANNEL_PREWARM
+    esp_timer_handle_t standby_timer_ = nullptr;
+    std::atomic<bool> prewarming_{false};
+    // Held while a channel opens, a session waits for a pre-warm in progress
+    std::mutex channel_open_mutex_;
+    int prewarm_count_ = 0;
+    int64_t prewarm_window_start_ = 0;
 
     std::unique_ptr<OpusEncoderWrapper> opus_encoder_;
     std::unique_ptr<OpusDecoderWrapper> opus_decoder_;
 
+    std::unique_ptr<PcmFramePool> pcm_frame_pool_;
     int opus_decode_sample_rate_ = -1;
-    OpusResampler input_resampler_;
-    OpusResampler reference_resampler_;
-    OpusResampler output_resampler_;
+    int opus_encode_sample_rate_ = 16000;
+    bool output_resample_ = false;  // Owned by the decode lane
+    std::unique_ptr<BoardCapturePipeline> capture_pipeline_;
+    PolyphaseResampler output_resampler_;   // Owned by the decode lane
+    std::vector<int16_t> resampled_pcm_;    // Owned by the decode lane
 
+    void PostMessage(MainMessage&& message);
     void MainLoop();
     void InputAudio();
     void OutputAudio();
     void ResetDecoder();
+    void FinishSpeaking();
+    void DecodeAudio(AudioCodec* codec, uint32_t epoch, std::vector<uint8_t>&& opus);
+    void EncodeAudio(uint32_t epoch, uint32_t capture_time_ms, PcmFrame&& frame);
     void SetDecodeSampleRate(int sample_rate);
     void CheckNewVersion();
+    bool OpenAudioChannel(int64_t session_start_time);
+    void PrewarmAudioChannel();
+    void AudioChannelOpened();
+    void LogSessionTimings();
 
     void PlayLocalFile(const char* data, size_t size);
+    void FeedLocalFile();
 };
 
 #endif // _APPLICATION_H_
@@ -26,12 +26,9 @@ void AudioCodec::OutputData(std::vector<int16_t>& data) {
     Write(data.data(), data.size());
 }
 
-bool AudioCodec::InputData(std::vector<int16_t>& data) {
-    int duration = 30;
-    int input_frame_size = input_sample_rate_ / 1000 * duration * input_channels_;
-
-    data.resize(input_frame_size);
-    int samples = Read(data.data(), data.size());
+bool AudioCodec::InputData(PcmFrame& frame) {
+    frame.resize(input_frame_samples());
+    int samples = Read(frame.data(), frame.size());
     if (samples > 0) {
         return true;
     }
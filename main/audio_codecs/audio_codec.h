@@ -10,6 +10,9 @@
 #include <functional>
 
 #include "board.h"
+#include "pcm_frame_pool.h"
+
+#define AUDIO_INPUT_FRAME_DURATION_MS 30
 
 class AudioCodec {
 public:
@@ -22,7 +25,7 @@ public:
 
     void Start();
     void OutputData(std::vector<int16_t>& data);
-    bool InputData(std::vector<int16_t>& data);
+    bool InputData(PcmFrame& frame);
     void OnOutputReady(std::function<bool()> callback);
     void OnInputReady(std::function<bool()> callback);
 
@@ -33,6 +36,9 @@ public:
     inline int input_channels() const { return input_channels_; }
     inline int output_channels() const { return output_channels_; }
     inline int output_volume() const { return output_volume_; }
+    inline int input_frame_samples() const {
+        return input_sample_rate_ / 1000 * AUDIO_INPUT_FRAME_DURATION_MS * input_channels_;
+    }
 
 private:
     std::function<bool()> on_input_ready_;
@@ -1,10 +1,33 @@
 #include "no_audio_codec.h"
 
 #include <esp_log.h>
-#include <cmath>
+#include <algorithm>
 
 #define TAG "NoAudioCodec"
 
+// The I2S bus runs 32 bit slots here, these loops have no branches so the
+// compiler can vectorise them.
+
+// Volume 0-100 to a Q16 gain on a square law curve, 100 is 65536
+static int32_t VolumeToGain(int volume) {
+    volume = std::min(std::max(volume, 0), 100);
+    return (int64_t)volume * volume * 65536 / 10000;
+}
+
+// A gain of at most 65536 cannot overflow, so nothing needs clamping
+static void PcmScaleToSlots(const int16_t* input, int32_t* output, size_t samples, int32_t gain) {
+    for (size_t i = 0; i < samples; i++) {
+        output[i] = input[i] * gain;
+    }
+}
+
+static void PcmSlotsToSamples(const int32_t* input, int16_t* output, size_t samples, int shift) {
+    for (size_t i = 0; i < samples; i++) {
+        int32_t value = input[i] >> shift;
+        output[i] = std::min<int32_t>(std::max<int32_t>(value, -INT16_MAX), INT16_MAX);
+    }
+}
+
 NoAudioCodec::~NoAudioCodec() {
     if (rx_handle_ != nullptr) {
         ESP_ERROR_CHECK(i2s_channel_disable(rx_handle_));
@@ -193,40 +216,32 @@ NoAudioCodec::NoAudioCodec(int input_sample_rate, int output_sample_rate, gpio_n
 }
 
 int NoAudioCodec::Write(const int16_t* data, int samples) {
-    std::vector<int32_t> buffer(samples);
-
-    // output_volume_: 0-100
-    // volume_factor_: 0-65536
-    int32_t volume_factor = pow(double(output_volume_) / 100.0, 2) * 65536;
-    for (int i = 0; i < samples; i++) {
-        int64_t temp = int64_t(data[i]) * volume_factor; // 使用 int64_t 进行乘法运算
-        if (temp > INT32_MAX) {
-            buffer[i] = INT32_MAX;
-        } else if (temp < INT32_MIN) {
-            buffer[i] = INT32_MIN;
-        } else {
-            buffer[i] = static_cast<int32_t>(temp);
-        }
+    if (gain_volume_ != output_volume_) {
+        gain_volume_ = output_volume_;
+        output_gain_ = VolumeToGain(output_volume_);
     }
+    if (write_buffer_.size() < (size_t)samples) {
+        write_buffer_.resize(samples);
+    }
+    PcmScaleToSlots(data, write_buffer_.data(), samples, output_gain_);
 
     size_t bytes_written;
-    ESP_ERROR_CHECK(i2s_channel_write(tx_handle_, buffer.data(), samples * sizeof(int32_t), &bytes_written, portMAX_DELAY));
+    ESP_ERROR_CHECK(i2s_channel_write(tx_handle_, write_buffer_.data(), samples * sizeof(int32_t), &bytes_written, portMAX_DELAY));
     return bytes_written / sizeof(int32_t);
 }
 
 int NoAudioCodec::Read(int16_t* dest, int samples) {
     size_t bytes_read;
 
-    std::vector<int32_t> bit32_buffer(samples);
-    if (i2s_channel_read(rx_handle_, bit32_buffer.data(), samples * sizeof(int32_t), &bytes_read, portMAX_DELAY) != ESP_OK) {
+    if (read_buffer_.size() < (size_t)samples) {
+        read_buffer_.resize(samples);
+    }
+    if (i2s_channel_read(rx_handle_, read_buffer_.data(), samples * sizeof(int32_t), &bytes_read, portMAX_DELAY) != ESP_OK) {
         ESP_LOGE(TAG, "Read Failed!");
         return 0;
     }
 
     samples = bytes_read / sizeof(int32_t);
-    for (int i = 0; i < samples; i++) {
-        int32_t value = bit32_buffer[i] >> 12;
-        dest[i] = (value > INT16_MAX) ? INT16_MAX : (value < -INT16_MAX) ? -INT16_MAX : (int16_t)value;
-    }
+    PcmSlotsToSamples(read_buffer_.data(), dest, samples, 12);
     return samples;
 }
@@ -5,8 +5,19 @@
 
 #include <driver/gpio.h>
 #include <driver/i2s_pdm.h>
+
+#include <vector>
+
 class NoAudioCodec : public AudioCodec {
 private:
+    // I2S slot buffers, kept between calls. Write runs on the decode task
+    // and Read on the main loop, so each has its own.
+    std::vector<int32_t> write_buffer_;
+    std::vector<int32_t> read_buffer_;
+    // Recomputed only when output_volume_ changes
+    int gain_volume_ = -1;
+    int32_t output_gain_ = 0;
+
     virtual int Write(const int16_t* data, int samples) override;
     virtual int Read(int16_t* dest, int samples) override;
 
@@ -0,0 +1,57 @@
+#include "audio_chunk_buffer.h"
+
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <cstring>
+#include <cassert>
+#include <algorithm>
+
+#define TAG "AudioChunkBuffer"
+
+AudioChunkBuffer::~AudioChunkBuffer() {
+    if (buffer_ != nullptr) {
+        heap_caps_free(buffer_);
+    }
+}
+
+void AudioChunkBuffer::Initialize(size_t chunk_samples, size_t chunk_count) {
+    assert(chunk_samples > 0 && chunk_count > 0);
+    if (buffer_ != nullptr) {
+        heap_caps_free(buffer_);
+    }
+    chunk_samples_ = chunk_samples;
+    capacity_ = chunk_samples * chunk_count;
+    // The AFE reads every chunk once right after it is written, keep it in internal RAM
+    buffer_ = (int16_t*)heap_caps_malloc(capacity_ * sizeof(int16_t), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    assert(buffer_ != nullptr);
+    Reset();
+    ESP_LOGI(TAG, "%zu chunks of %zu samples", chunk_count, chunk_samples);
+}
+
+void AudioChunkBuffer::Reset() {
+    write_index_ = 0;
+    read_index_ = 0;
+    count_ = 0;
+}
+
+size_t AudioChunkBuffer::Write(const int16_t* data, size_t samples) {
+    samples = std::min(samples, capacity_ - count_);
+    size_t first = std::min(samples, capacity_ - write_index_);
+    memcpy(buffer_ + write_index_, data, first * sizeof(int16_t));
+    if (samples > first) {
+        memcpy(buffer_, data + first, (samples - first) * sizeof(int16_t));
+    }
+    write_index_ = (write_index_ + samples) % capacity_;
+    count_ += samples;
+    return samples;
+}
+
+const int16_t* AudioChunkBuffer::ReadChunk() {
+    if (count_ < chunk_samples_) {
+        return nullptr;
+    }
+    auto chunk = buffer_ + read_index_;
+    read_index_ = (read_index_ + chunk_samples_) % capacity_;
+    count_ -= chunk_samples_;
+    return chunk;
+}
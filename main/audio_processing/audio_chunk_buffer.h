@@ -0,0 +1,40 @@
+#ifndef AUDIO_CHUNK_BUFFER_H
+#define AUDIO_CHUNK_BUFFER_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Circular accumulator that turns arbitrary sized input frames into fixed
+// size chunks for the AFE. The capacity is a whole number of chunks and
+// chunks are always read from a chunk boundary, so every chunk handed out
+// is contiguous and nothing is ever shifted in memory.
+class AudioChunkBuffer {
+public:
+    AudioChunkBuffer() = default;
+    ~AudioChunkBuffer();
+    AudioChunkBuffer(const AudioChunkBuffer&) = delete;
+    AudioChunkBuffer& operator=(const AudioChunkBuffer&) = delete;
+
+    void Initialize(size_t chunk_samples, size_t chunk_count);
+    void Reset();
+
+    // Returns the number of samples accepted, the rest has to be written
+    // again once chunks have been read
+    size_t Write(const int16_t* data, size_t samples);
+    // Returns the next complete chunk or nullptr. The pointer stays valid
+    // until the next Write().
+    const int16_t* ReadChunk();
+
+    size_t chunk_samples() const { return chunk_samples_; }
+    size_t available() const { return count_; }
+
+private:
+    int16_t* buffer_ = nullptr;
+    size_t chunk_samples_ = 0;
+    size_t capacity_ = 0;
+    size_t write_index_ = 0;
+    size_t read_index_ = 0;
+    size_t count_ = 0;
+};
+
+#endif // AUDIO_CHUNK_BUFFER_H
@@ -0,0 +1,209 @@
+#include "audio_front_end.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_heap_caps.h>
+#include <cstring>
+#include <cstdio>
+
+#define HEAD_BIT(head) (1 << (head))
+#define ALL_HEADS ((1 << kAudioFrontEndHeadCount) - 1)
+// Per stage timing is logged at debug level every 10 seconds while running
+#define TIMING_REPORT_INTERVAL_US (10 * 1000 * 1000)
+
+static const char* TAG = "AudioFrontEnd";
+static const char* HEAD_NAMES[] = { "wake_word", "vad", "communication" };
+
+AudioFrontEnd::AudioFrontEnd() {
+    event_group_ = xEventGroupCreate();
+}
+
+AudioFrontEnd::~AudioFrontEnd() {
+    for (auto instance : { &sr_, &vc_ }) {
+        if (instance->data != nullptr) {
+            instance->iface->destroy(instance->data);
+        }
+    }
+    vEventGroupDelete(event_group_);
+}
+
+void AudioFrontEnd::Initialize(int channels, bool reference) {
+    channels_ = channels;
+    reference_ = reference;
+    int ref_num = reference_ ? 1 : 0;
+
+    models_ = esp_srmodel_init("model");
+    for (int i = 0; i < models_->num; i++) {
+        ESP_LOGI(TAG, "Model %d: %s", i, models_->model_name[i]);
+        if (strstr(models_->model_name[i], ESP_WN_PREFIX) != NULL) {
+            wakenet_model_ = models_->model_name[i];
+        }
+    }
+
+    afe_config_t afe_config = {
+        .aec_init = reference_,
+        .se_init = true,
+        .vad_init = true,
+        .wakenet_init = wakenet_model_ != nullptr,
+        .voice_communication_init = false,
+        .voice_communication_agc_init = false,
+        .voice_communication_agc_gain = 10,
+        .vad_mode = VAD_MODE_3,
+        .wakenet_model_name = wakenet_model_,
+        .wakenet_model_name_2 = NULL,
+        .wakenet_mode = DET_MODE_90,
+        .afe_mode = SR_MODE_HIGH_PERF,
+        .afe_perferred_core = 1,
+        .afe_perferred_priority = 1,
+        .afe_ringbuf_size = 50,
+        .memory_alloc_mode = AFE_MEMORY_ALLOC_MORE_PSRAM,
+        .afe_linear_gain = 1.0,
+        .agc_mode = AFE_MN_PEAK_AGC_MODE_2,
+        .pcm_config = {
+            .total_ch_num = channels_,
+            .mic_num = channels_ - ref_num,
+            .ref_num = ref_num,
+            .sample_rate = 16000
+        },
+        .debug_init = false,
+        .debug_hook = {{ AFE_DEBUG_HOOK_MASE_TASK_IN, NULL }, { AFE_DEBUG_HOOK_FETCH_TASK_IN, NULL }},
+        .afe_ns_mode = NS_MODE_SSP,
+        .afe_ns_model_name = NULL,
+        .fixed_first_channel = true,
+    };
+    sr_.head_mask = HEAD_BIT(kAudioFrontEndHeadWakeWord) | HEAD_BIT(kAudioFrontEndHeadVad);
+    CreateInstance(sr_, afe_config, "afe_sr");
+    // Heads start disabled, wakenet only runs while somebody listens to it
+    if (wakenet_model_ != nullptr) {
+        sr_.iface->disable_wakenet(sr_.data);
+    }
+
+    // The uplink keeps the noise suppression and AGC of the VC pipeline, without AEC
+    afe_config.aec_init = false;
+    afe_config.vad_init = false;
+    afe_config.wakenet_init = false;
+    afe_config.wakenet_model_name = NULL;
+    afe_config.voice_communication_init = true;
+    afe_config.voice_communication_agc_init = true;
+    vc_.head_mask = HEAD_BIT(kAudioFrontEndHeadCommunication);
+    CreateInstance(vc_, afe_config, "afe_vc");
+}
+
+void AudioFrontEnd::CreateInstance(Instance& instance, afe_config_t& config, const char* task_name) {
+    size_t free_psram = heap_caps_get_free_size(MALLOC_CAP_SPIRAM);
+    size_t free_internal = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+    instance.data = instance.iface->create_from_config(&config);
+    ESP_LOGI(TAG, "AFE %s created, psram: %zu bytes, internal: %zu bytes", instance.name,
+        free_psram - heap_caps_get_free_size(MALLOC_CAP_SPIRAM),
+        free_internal - heap_caps_get_free_size(MALLOC_CAP_INTERNAL));
+    instance.input_buffer.Initialize(instance.iface->get_feed_chunksize(instance.data) * channels_, 3);
+
+    instance.owner = this;
+    xTaskCreate([](void* arg) {
+        auto instance = (Instance*)arg;
+        instance->owner->FetchTask(*instance);
+        vTaskDelete(NULL);
+    }, task_name, 4096 * 2, &instance, 1, nullptr);
+}
+
+void AudioFrontEnd::SetHandler(AudioFrontEndHead head, std::function<void(const afe_fetch_result_t* result)> handler) {
+    handlers_[head] = handler;
+}
+
+void AudioFrontEnd::EnableHead(AudioFrontEndHead head, bool enable) {
+    if (IsHeadEnabled(head) == enable) {
+        return;
+    }
+    if (head == kAudioFrontEndHeadWakeWord && wakenet_model_ != nullptr) {
+        if (enable) {
+            sr_.iface->enable_wakenet(sr_.data);
+        } else {
+            sr_.iface->disable_wakenet(sr_.data);
+        }
+    }
+    if (enable) {
+        xEventGroupSetBits(event_group_, HEAD_BIT(head));
+    } else {
+        xEventGroupClearBits(event_group_, HEAD_BIT(head));
+    }
+}
+
+bool AudioFrontEnd::IsHeadEnabled(AudioFrontEndHead head) {
+    return xEventGroupGetBits(event_group_) & HEAD_BIT(head);
+}
+
+bool AudioFrontEnd::IsRunning() {
+    return xEventGroupGetBits(event_group_) & ALL_HEADS;
+}
+
+void AudioFrontEnd::Feed(const int16_t* data, size_t samples) {
+    auto heads = xEventGroupGetBits(event_group_);
+    for (auto instance : { &sr_, &vc_ }) {
+        if (!(heads & instance->head_mask)) {
+            continue;
+        }
+        const int16_t* input = data;
+        size_t remaining = samples;
+        while (remaining > 0) {
+            auto written = instance->input_buffer.Write(input, remaining);
+            input += written;
+            remaining -= written;
+
+            const int16_t* chunk;
+            while ((chunk = instance->input_buffer.ReadChunk()) != nullptr) {
+                auto start_time = esp_timer_get_time();
+                instance->iface->feed(instance->data, chunk);
+                instance->feed_time.fetch_add(esp_timer_get_time() - start_time, std::memory_order_relaxed);
+                instance->feed_count.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+    }
+}
+
+void AudioFrontEnd::FetchTask(Instance& instance) {
+    auto chunk_size = instance.iface->get_fetch_chunksize(instance.data);
+    ESP_LOGI(TAG, "AFE %s fetch task started, chunk size: %d", instance.name, chunk_size);
+    instance.report_time = esp_timer_get_time();
+
+    while (true) {
+        xEventGroupWaitBits(event_group_, instance.head_mask, pdFALSE, pdFALSE, portMAX_DELAY);
+
+        auto res = instance.iface->fetch(instance.data);
+        if (res == nullptr || res->ret_value == ESP_FAIL) {
+            if (res != nullptr) {
+                ESP_LOGI(TAG, "Error code: %d", res->ret_value);
+            }
+            continue;
+        }
+
+        auto heads = xEventGroupGetBits(event_group_) & instance.head_mask;
+        for (int head = 0; head < kAudioFrontEndHeadCount; head++) {
+            if ((heads & HEAD_BIT(head)) && handlers_[head]) {
+                auto start_time = esp_timer_get_time();
+                handlers_[head](res);
+                head_time_[head] += esp_timer_get_time() - start_time;
+            }
+        }
+        instance.fetch_count++;
+
+        auto now = esp_timer_get_time();
+        if (now - instance.report_time >= TIMING_REPORT_INTERVAL_US) {
+            // feed() covers AEC and the copy into the AFE ring, the fetch task does the rest
+            int64_t seconds = (now - instance.report_time) / 1000000;
+            char heads_text[96] = "";
+            int length = 0;
+            for (int head = 0; head < kAudioFrontEndHeadCount; head++) {
+                if (instance.head_mask & HEAD_BIT(head)) {
+                    length += snprintf(heads_text + length, sizeof(heads_text) - length, ", %s %lld us",
+                        HEAD_NAMES[head], head_time_[head] / seconds);
+                    head_time_[head] = 0;
+                }
+            }
+            ESP_LOGD(TAG, "AFE %s timing per second: feed %lld us (%ld chunks)%s, fetched %d", instance.name,
+                instance.feed_time.exchange(0) / seconds, (long)instance.feed_count.exchange(0), heads_text,
+                instance.fetch_count);
+            instance.fetch_count = 0;
+            instance.report_time = now;
+        }
+    }
+}
@@ -0,0 +1,81 @@
+#ifndef AUDIO_FRONT_END_H
+#define AUDIO_FRONT_END_H
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/event_groups.h>
+
+#include <esp_afe_sr_models.h>
+#include <model_path.h>
+
+#include <atomic>
+#include <functional>
+
+#include "audio_chunk_buffer.h"
+
+// Consumers of the processed audio, each one can be switched on and off
+enum AudioFrontEndHead {
+    kAudioFrontEndHeadWakeWord = 0,
+    kAudioFrontEndHeadVad,
+    kAudioFrontEndHeadCommunication,
+    kAudioFrontEndHeadCount
+};
+
+// Front end shared by wake word detection, VAD and the communication
+// encoder. One SR instance (AEC, SE, VAD, WakeNet) serves wake word and VAD,
+// a VC instance with noise suppression and AGC serves the communication
+// head. Each instance is fed and fetched only while one of its heads is
+// enabled, the fetched result is dispatched to every enabled head. The
+// heads are switched by chat state so only one instance runs at a time.
+class AudioFrontEnd {
+public:
+    AudioFrontEnd();
+    ~AudioFrontEnd();
+
+    void Initialize(int channels, bool reference);
+    void Feed(const int16_t* data, size_t samples);
+    void SetHandler(AudioFrontEndHead head, std::function<void(const afe_fetch_result_t* result)> handler);
+    void EnableHead(AudioFrontEndHead head, bool enable);
+    bool IsHeadEnabled(AudioFrontEndHead head);
+    bool IsRunning();
+
+    // Samples per fetch of the instance that serves the head
+    int fetch_chunksize(AudioFrontEndHead head) const {
+        auto& instance = (vc_.head_mask & (1 << head)) ? vc_ : sr_;
+        return instance.iface->get_fetch_chunksize(instance.data);
+    }
+    srmodel_list_t* models() const { return models_; }
+    const char* wakenet_model() const { return wakenet_model_; }
+
+private:
+    struct Instance {
+        const char* name;
+        const esp_afe_sr_iface_t* iface;
+        AudioFrontEnd* owner = nullptr;
+        esp_afe_sr_data_t* data = nullptr;
+        uint32_t head_mask = 0;     // Heads fed from this instance
+        AudioChunkBuffer input_buffer;
+
+        // Timing in microseconds, reset after every report. Feed() runs in
+        // the audio input task, the rest in the instance's fetch task.
+        std::atomic<int32_t> feed_time{0};
+        std::atomic<int32_t> feed_count{0};
+        int64_t report_time = 0;
+        int fetch_count = 0;
+    };
+
+    EventGroupHandle_t event_group_ = nullptr;
+    Instance sr_ = { "sr", &esp_afe_sr_v1 };
+    Instance vc_ = { "vc", &esp_afe_vc_v1 };
+    srmodel_list_t* models_ = nullptr;
+    char* wakenet_model_ = nullptr;
+    std::function<void(const afe_fetch_result_t* result)> handlers_[kAudioFrontEndHeadCount];
+    int64_t head_time_[kAudioFrontEndHeadCount] = {};
+    int channels_;
+    bool reference_;
+
+    void CreateInstance(Instance& instance, afe_config_t& config, const char* task_name);
+    void FetchTask(Instance& instance);
+};
+
+#endif // AUDIO_FRONT_END_H
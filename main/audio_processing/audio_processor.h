@@ -1,36 +1,29 @@
 #ifndef AUDIO_PROCESSOR_H
 #define AUDIO_PROCESSOR_H
 
-#include <esp_afe_sr_models.h>
-#include <freertos/FreeRTOS.h>
-#include <freertos/task.h>
-#include <freertos/event_groups.h>
-
 #include <string>
-#include <vector>
+#include <memory>
 #include <functional>
 
+#include "audio_front_end.h"
+#include "pcm_frame_pool.h"
+
 class AudioProcessor {
 public:
     AudioProcessor();
     ~AudioProcessor();
 
-    void Initialize(int channels, bool reference);
-    void Input(const std::vector<int16_t>& data);
+    // frame_count is how many output frames may be waiting for the encoder at once
+    void Initialize(AudioFrontEnd* front_end, size_t frame_count);
     void Start();
     void Stop();
     bool IsRunning();
-    void OnOutput(std::function<void(std::vector<int16_t>&& data)> callback);
+    void OnOutput(std::function<void(PcmFrame&& frame)> callback);
 
 private:
-    EventGroupHandle_t event_group_ = nullptr;
-    esp_afe_sr_data_t* afe_communication_data_ = nullptr;
-    std::vector<int16_t> input_buffer_;
-    std::function<void(std::vector<int16_t>&& data)> output_callback_;
-    int channels_;
-    bool reference_;
-
-    void AudioProcessorTask();
+    AudioFrontEnd* front_end_ = nullptr;
+    std::unique_ptr<PcmFramePool> frame_pool_;
+    std::function<void(PcmFrame&& frame)> output_callback_;
 };
 
 #endif
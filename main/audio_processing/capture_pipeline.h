@@ -0,0 +1,63 @@
+#ifndef CAPTURE_PIPELINE_H
+#define CAPTURE_PIPELINE_H
+
+#include <sdkconfig.h>
+
+#include "audio_codec.h"
+#include "polyphase_resampler.h"
+
+#if CONFIG_AUDIO_RESAMPLER_QUALITY_FAST
+#define AUDIO_RESAMPLER_QUALITY kResamplerQualityFast
+#elif CONFIG_AUDIO_RESAMPLER_QUALITY_HIGH
+#define AUDIO_RESAMPLER_QUALITY kResamplerQualityHigh
+#else
+#define AUDIO_RESAMPLER_QUALITY kResamplerQualityBalanced
+#endif
+
+constexpr bool IsOpusSampleRate(int sample_rate) {
+    return sample_rate == 8000 || sample_rate == 12000 || sample_rate == 16000 ||
+        sample_rate == 24000 || sample_rate == 48000;
+}
+
+// Brings captured frames to the encoder rate. The capture shape is a
+// template argument taken from the board's config.h, so whether to resample
+// and which resampler kernel runs are settled at compile time.
+template <int kCaptureChannels, int kCaptureSampleRate>
+class CapturePipeline {
+public:
+    static constexpr int kChannels = kCaptureChannels;
+    static constexpr int kInputSampleRate = kCaptureSampleRate;
+#if CONFIG_AUDIO_OPUS_NATIVE_RATE && !CONFIG_IDF_TARGET_ESP32S3
+    // Without the audio front end nothing needs 16kHz, encode what the codec captures
+    static constexpr int kEncodeSampleRate =
+        kChannels == 1 && IsOpusSampleRate(kInputSampleRate) ? kInputSampleRate : 16000;
+#else
+    static constexpr int kEncodeSampleRate = 16000;
+#endif
+    static constexpr bool kResample = kInputSampleRate != kEncodeSampleRate;
+    static constexpr int kInputFrameSamples = kInputSampleRate / 1000 * AUDIO_INPUT_FRAME_DURATION_MS * kChannels;
+
+    // Frames are resampled in place, which only works downwards
+    static_assert(kInputSampleRate >= kEncodeSampleRate, "the codec must capture at 16kHz or above");
+
+    void Configure() {
+        if constexpr (kResample) {
+            resampler_.Configure(kInputSampleRate, kEncodeSampleRate, kChannels, kInputFrameSamples,
+                AUDIO_RESAMPLER_QUALITY);
+        }
+    }
+
+    // Returns the number of samples left in the frame
+    size_t Process(int16_t* samples, size_t count) {
+        if constexpr (kResample) {
+            return resampler_.Process<kChannels, GetResamplerTaps(AUDIO_RESAMPLER_QUALITY)>(samples, count, samples);
+        } else {
+            return count;
+        }
+    }
+
+private:
+    PolyphaseResampler resampler_;
+};
+
+#endif // CAPTURE_PIPELINE_H
@@ -0,0 +1,251 @@
+#include "polyphase_resampler.h"
+
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <cstring>
+#include <cassert>
+#include <cmath>
+#include <algorithm>
+
+#define TAG "PolyphaseResampler"
+
+struct ResamplerTier {
+    int taps;
+    double rolloff;     // Passband edge as a fraction of the lower Nyquist frequency
+    double kaiser_beta;
+};
+
+// Indexed by ResamplerQuality, mirrored in gen_resampler_filters.py
+static constexpr ResamplerTier kResamplerTiers[] = {
+    { 16, 0.85, 5.0 },
+    { 32, 0.9, 7.0 },
+    { 64, 0.94, 9.0 },
+};
+static_assert(kResamplerTiers[kResamplerQualityFast].taps == GetResamplerTaps(kResamplerQualityFast) &&
+    kResamplerTiers[kResamplerQualityBalanced].taps == GetResamplerTaps(kResamplerQualityBalanced) &&
+    kResamplerTiers[kResamplerQualityHigh].taps == GetResamplerTaps(kResamplerQualityHigh),
+    "tap counts out of sync with GetResamplerTaps()");
+
+static int Gcd(int a, int b) {
+    while (b != 0) {
+        int t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+// Zeroth order modified Bessel function, for the Kaiser window
+static double BesselI0(double x) {
+    double sum = 1.0, term = 1.0;
+    for (int k = 1; k < 32; k++) {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+    }
+    return sum;
+}
+
+static inline int16_t Saturate(int32_t value) {
+    return (int16_t)std::min<int32_t>(std::max<int32_t>(value, INT16_MIN), INT16_MAX);
+}
+
+PolyphaseResampler::~PolyphaseResampler() {
+    if (coefficients_ != nullptr) {
+        heap_caps_free(coefficients_);
+    }
+    if (line_ != nullptr) {
+        heap_caps_free(line_);
+    }
+}
+
+void PolyphaseResampler::Configure(int input_rate, int output_rate, int channels, size_t max_input_samples,
+    ResamplerQuality quality) {
+    assert(input_rate > 0 && output_rate > 0 && channels > 0);
+    if (coefficients_ != nullptr) {
+        heap_caps_free(coefficients_);
+    }
+    if (line_ != nullptr) {
+        heap_caps_free(line_);
+    }
+
+    int divisor = Gcd(input_rate, output_rate);
+    up_ = output_rate / divisor;
+    down_ = input_rate / divisor;
+    taps_ = kResamplerTiers[quality].taps;
+    channels_ = channels;
+    max_input_frames_ = std::max<size_t>(max_input_samples / channels, 1);
+
+    // Both are read for every output sample, keep them in internal RAM
+    coefficients_ = (int16_t*)heap_caps_malloc(up_ * taps_ * sizeof(int16_t), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    line_ = (int16_t*)heap_caps_malloc((taps_ - 1 + max_input_frames_) * channels_ * sizeof(int16_t),
+        MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    assert(coefficients_ != nullptr && line_ != nullptr);
+
+    const ResamplerFilterBank* bank = nullptr;
+    for (size_t i = 0; i < kResamplerFilterBankCount; i++) {
+        auto& candidate = kResamplerFilterBanks[i];
+        if (candidate.input_rate == input_rate && candidate.output_rate == output_rate && candidate.quality == quality) {
+            bank = &candidate;
+            break;
+        }
+    }
+    if (bank != nullptr) {
+        memcpy(coefficients_, bank->coefficients, up_ * taps_ * sizeof(int16_t));
+    } else {
+        DesignFilter(quality);
+    }
+
+    if (channels_ == 1) {
+        kernel_ = taps_ == 16 ? &PolyphaseResampler::MonoKernel<16> :
+            taps_ == 32 ? &PolyphaseResampler::MonoKernel<32> : &PolyphaseResampler::MonoKernel<64>;
+    } else if (channels_ == 2) {
+        kernel_ = taps_ == 16 ? &PolyphaseResampler::StereoKernel<16> :
+            taps_ == 32 ? &PolyphaseResampler::StereoKernel<32> : &PolyphaseResampler::StereoKernel<64>;
+    } else {
+        kernel_ = &PolyphaseResampler::GenericKernel;
+    }
+
+    Reset();
+    ESP_LOGI(TAG, "%d -> %d Hz, %d channels, %d phases of %d taps%s", input_rate, output_rate, channels_, up_, taps_,
+        bank != nullptr ? "" : ", designed at runtime");
+}
+
+void PolyphaseResampler::Reset() {
+    memset(line_, 0, (taps_ - 1) * channels_ * sizeof(int16_t));
+    position_ = (taps_ - 1) * up_;
+}
+
+// Kaiser windowed sinc at the upsampled rate, split into up_ phases. Every
+// phase is scaled to unity DC gain, so silence and DC pass through exactly.
+void PolyphaseResampler::DesignFilter(ResamplerQuality quality) {
+    const auto& tier = kResamplerTiers[quality];
+    const int length = up_ * taps_;
+    const double cutoff = 0.5 / std::max(up_, down_) * tier.rolloff;
+    const double center = (length - 1) / 2.0;
+    const double window_scale = 1.0 / BesselI0(tier.kaiser_beta);
+
+    double row[POLYPHASE_RESAMPLER_MAX_TAPS];
+    for (int phase = 0; phase < up_; phase++) {
+        double sum = 0;
+        for (int tap = 0; tap < taps_; tap++) {
+            double x = phase + tap * up_ - center;
+            double sinc = x == 0 ? 2 * cutoff : sin(2 * M_PI * cutoff * x) / (M_PI * x);
+            double ratio = x / center;
+            double window = BesselI0(tier.kaiser_beta * sqrt(std::max(0.0, 1 - ratio * ratio))) * window_scale;
+            row[tap] = sinc * window;
+            sum += row[tap];
+        }
+        // Reversed, so the newest input sample meets the last coefficient
+        int16_t* coefficients = coefficients_ + phase * taps_;
+        for (int tap = 0; tap < taps_; tap++) {
+            coefficients[taps_ - 1 - tap] = Saturate(lrint(row[tap] / sum * (1 << RESAMPLER_COEFFICIENT_SHIFT)));
+        }
+    }
+}
+
+size_t PolyphaseResampler::GetOutputSamples(size_t input_samples) const {
+    return (input_samples / channels_ * up_ / down_ + 1) * channels_;
+}
+
+size_t PolyphaseResampler::Process(const int16_t* input, size_t samples, int16_t* output) {
+    size_t frames = samples / channels_;
+    size_t written = 0;
+    while (frames > 0) {
+        size_t block = std::min(frames, max_input_frames_);
+        memcpy(line_ + (taps_ - 1) * channels_, input, block * channels_ * sizeof(int16_t));
+        written += ProcessBlock(block, output + written);
+        input += block * channels_;
+        frames -= block;
+    }
+    return written;
+}
+
+template <int kChannels, int kTaps>
+size_t PolyphaseResampler::Process(const int16_t* input, size_t samples, int16_t* output) {
+    static_assert(kChannels == 1 || kChannels == 2, "no fixed kernel for this channel count");
+    assert(channels_ == kChannels && taps_ == kTaps);
+    size_t frames = samples / kChannels;
+    size_t written = 0;
+    while (frames > 0) {
+        size_t block = std::min(frames, max_input_frames_);
+        memcpy(line_ + (kTaps - 1) * kChannels, input, block * kChannels * sizeof(int16_t));
+        size_t end = (kTaps - 1 + block) * up_;
+        if constexpr (kChannels == 1) {
+            written += MonoKernel<kTaps>(end, output + written);
+        } else {
+            written += StereoKernel<kTaps>(end, output + written);
+        }
+        KeepHistory(block);
+        input += block * kChannels;
+        frames -= block;
+    }
+    return written;
+}
+
+size_t PolyphaseResampler::ProcessBlock(size_t frames, int16_t* output) {
+    size_t count = (this->*kernel_)((taps_ - 1 + frames) * up_, output);
+    KeepHistory(frames);
+    return count;
+}
+
+// Keep the newest samples as history for the next block
+void PolyphaseResampler::KeepHistory(size_t frames) {
+    position_ -= frames * up_;
+    memmove(line_, line_ + frames * channels_, (taps_ - 1) * channels_ * sizeof(int16_t));
+}
+
+// Input samples are read once per output frame for every channel
+template <int kTaps>
+size_t PolyphaseResampler::MonoKernel(size_t end, int16_t* output) {
+    size_t count = 0;
+    for (; position_ < end; position_ += down_) {
+        const int16_t* x = line_ + (position_ / up_ + 1 - kTaps);
+        const int16_t* h = coefficients_ + (position_ % up_) * kTaps;
+        int32_t sum = 1 << (RESAMPLER_COEFFICIENT_SHIFT - 1);
+        for (int j = 0; j < kTaps; j++) {
+            sum += h[j] * x[j];
+        }
+        output[count++] = Saturate(sum >> RESAMPLER_COEFFICIENT_SHIFT);
+    }
+    return count;
+}
+
+template <int kTaps>
+size_t PolyphaseResampler::StereoKernel(size_t end, int16_t* output) {
+    size_t count = 0;
+    for (; position_ < end; position_ += down_) {
+        const int16_t* x = line_ + (position_ / up_ + 1 - kTaps) * 2;
+        const int16_t* h = coefficients_ + (position_ % up_) * kTaps;
+        int32_t left = 1 << (RESAMPLER_COEFFICIENT_SHIFT - 1), right = 1 << (RESAMPLER_COEFFICIENT_SHIFT - 1);
+        for (int j = 0; j < kTaps; j++) {
+            left += h[j] * x[2 * j];
+            right += h[j] * x[2 * j + 1];
+        }
+        output[count++] = Saturate(left >> RESAMPLER_COEFFICIENT_SHIFT);
+        output[count++] = Saturate(right >> RESAMPLER_COEFFICIENT_SHIFT);
+    }
+    return count;
+}
+
+size_t PolyphaseResampler::GenericKernel(size_t end, int16_t* output) {
+    size_t count = 0;
+    for (; position_ < end; position_ += down_) {
+        const int16_t* x = line_ + (position_ / up_ + 1 - taps_) * channels_;
+        const int16_t* h = coefficients_ + (position_ % up_) * taps_;
+        for (int channel = 0; channel < channels_; channel++) {
+            int32_t sum = 1 << (RESAMPLER_COEFFICIENT_SHIFT - 1);
+            for (int j = 0; j < taps_; j++) {
+                sum += h[j] * x[j * channels_ + channel];
+            }
+            output[count++] = Saturate(sum >> RESAMPLER_COEFFICIENT_SHIFT);
+        }
+    }
+    return count;
+}
+
+template size_t PolyphaseResampler::Process<1, 16>(const int16_t* input, size_t samples, int16_t* output);
+template size_t PolyphaseResampler::Process<1, 32>(const int16_t* input, size_t samples, int16_t* output);
+template size_t PolyphaseResampler::Process<1, 64>(const int16_t* input, size_t samples, int16_t* output);
+template size_t PolyphaseResampler::Process<2, 16>(const int16_t* input, size_t samples, int16_t* output);
+template size_t PolyphaseResampler::Process<2, 32>(const int16_t* input, size_t samples, int16_t* output);
+template size_t PolyphaseResampler::Process<2, 64>(const int16_t* input, size_t samples, int16_t* output);
@@ -0,0 +1,62 @@
+#ifndef POLYPHASE_RESAMPLER_H
+#define POLYPHASE_RESAMPLER_H
+
+#include "resampler_filters.h"
+
+#include <cstddef>
+#include <cstdint>
+
+#define POLYPHASE_RESAMPLER_MAX_TAPS 64
+
+// Fixed point polyphase FIR resampler for interleaved frames. All channels
+// of an output frame are computed from one walk over the input window, so
+// a stereo mic + reference frame is never split and joined again. The
+// filter history carries over between calls, the output goes to a buffer
+// the caller owns.
+class PolyphaseResampler {
+public:
+    PolyphaseResampler() = default;
+    ~PolyphaseResampler();
+    PolyphaseResampler(const PolyphaseResampler&) = delete;
+    PolyphaseResampler& operator=(const PolyphaseResampler&) = delete;
+
+    // Longer inputs are processed in pieces of max_input_samples
+    void Configure(int input_rate, int output_rate, int channels, size_t max_input_samples,
+        ResamplerQuality quality = kResamplerQualityBalanced);
+    void Reset();
+
+    // Upper bound of the samples Process() returns for this input
+    size_t GetOutputSamples(size_t input_samples) const;
+    // Returns the number of samples written. When downsampling the output
+    // may be the input buffer itself.
+    size_t Process(const int16_t* input, size_t samples, int16_t* output);
+    // Same as Process() with the kernel picked at compile time, for callers
+    // that know the shape of their stream. Instantiated for 1 and 2 channels
+    // at every tap count of ResamplerQuality.
+    template <int kChannels, int kTaps>
+    size_t Process(const int16_t* input, size_t samples, int16_t* output);
+
+    bool configured() const { return kernel_ != nullptr; }
+    int taps() const { return taps_; }
+
+private:
+    int channels_ = 1;
+    int up_ = 1;        // Interpolation factor
+    int down_ = 1;      // Decimation factor
+    int taps_ = 0;      // Per phase
+    int16_t* coefficients_ = nullptr;  // One row of taps per phase, reversed
+    int16_t* line_ = nullptr;          // Filter history followed by the current input
+    size_t max_input_frames_ = 0;
+    // Position of the next output in the upsampled grid, relative to the line
+    size_t position_ = 0;
+    size_t (PolyphaseResampler::*kernel_)(size_t end, int16_t* output) = nullptr;
+
+    void DesignFilter(ResamplerQuality quality);
+    size_t ProcessBlock(size_t frames, int16_t* output);
+    void KeepHistory(size_t frames);
+    template <int kTaps> size_t MonoKernel(size_t end, int16_t* output);
+    template <int kTaps> size_t StereoKernel(size_t end, int16_t* output);
+    size_t GenericKernel(size_t end, int16_t* output);
+};
+
+#endif // POLYPHASE_RESAMPLER_H
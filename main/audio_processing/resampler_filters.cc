@@ -0,0 +1,85 @@
+// Generated by gen_resampler_filters.py, do not edit
+#include "resampler_filters.h"
+
+static const int16_t kFast24kTo16k[32] = {
+    17, -143, 25, 572, -509, -1456, 3125, 8969, 6628, 70, -1398, 307, 360, -158, -47, 23,
+    23, -47, -158, 360, 307, -1398, 70, 6628, 8969, 3125, -1456, -509, 572, 25, -143, 17,
+};
+
+static const int16_t kFast48kTo16k[16] = {
+    10, -46, -232, -365, 23, 1281, 3083, 4437, 4437, 3083, 1281, 23, -365, -232, -46, 10,
+};
+
+static const int16_t kFast16kTo24k[48] = {
+    18, -112, 321, -631, 929, -965, 111, 13457, 4841, -2471, 1306, -560, 141, 28, -50, 21,
+    38, -121, 230, -272, 73, 632, -2433, 10045, 10045, -2433, 632, 73, -272, 230, -121, 38,
+    21, -50, 28, 141, -560, 1306, -2471, 4841, 13457, 111, -965, 929, -631, 321, -112, 18,
+};
+
+static const int16_t kBalanced24kTo16k[64] = {
+    -2, 10, -3, -36, 48, 49, -164, 38, 311, -347, -312, 953, -218, -1932, 2890, 9462,
+    6817, -448, -1530, 816, 369, -574, 65, 261, -143, -61, 86, -8, -27, 11, 3, -2,
+    -2, 3, 11, -27, -8, 86, -61, -143, 261, 65, -574, 369, 816, -1530, -448, 6817,
+    9462, 2890, -1932, -218, 953, -312, -347, 311, 38, -164, 49, 48, -36, -3, 10, -2,
+};
+
+static const int16_t kBalanced48kTo16k[32] = {
+    2, 6, 3, -22, -55, -42, 65, 212, 220, -69, -555, -782, -197, 1355, 3332, 4720,
+    4720, 3332, 1355, -197, -782, -555, -69, 220, 212, 65, -42, -55, -22, 3, 6, 2,
+};
+
+static const int16_t kBalanced16kTo24k[96] = {
+    -4, 8, -11, 7, 11, -52, 123, -226, 358, -502, 631, -705, 656, -354, -687, 14202,
+    4386, -2427, 1638, -1109, 706, -401, 184, -45, -31, 60, -60, 47, -29, 15, -6, 1,
+    0, -1, 9, -26, 55, -98, 150, -200, 228, -206, 99, 139, -576, 1360, -3009, 10269,
+    10269, -3009, 1360, -576, 139, 99, -206, 228, -200, 150, -98, 55, -26, 9, -1, 0,
+    1, -6, 15, -29, 47, -60, 60, -31, -45, 184, -401, 706, -1109, 1638, -2427, 4386,
+    14202, -687, -354, 656, -705, 631, -502, 358, -226, 123, -52, 11, 7, -11, 8, -4,
+};
+
+static const int16_t kHigh24kTo16k[128] = {
+    0, 0, 1, -2, -1, 5, -4, -6, 15, -4, -24, 31, 10, -61, 44, 53,
+    -119, 32, 148, -188, -42, 314, -233, -241, 570, -183, -698, 991, 176, -2179, 2608, 9855,
+    6906, -880, -1403, 1168, 73, -747, 421, 227, -429, 120, 217, -221, -6, 154, -93, -43,
+    87, -26, -39, 39, 0, -23, 13, 5, -9, 3, 3, -3, 0, 1, 0, 0,
+    0, 0, 1, 0, -3, 3, 3, -9, 5, 13, -23, 0, 39, -39, -26, 87,
+    -43, -93, 154, -6, -221, 217, 120, -429, 227, 421, -747, 73, 1168, -1403, -880, 6906,
+    9855, 2608, -2179, 176, 991, -698, -183, 570, -241, -233, 314, -42, -188, 148, 32, -119,
+    53, 44, -61, 10, 31, -24, -4, 15, -6, -4, 5, -1, -2, 1, 0, 0,
+};
+
+static const int16_t kHigh48kTo16k[64] = {
+    0, 0, -1, 0, 3, 4, 0, -8, -12, -3, 19, 33, 15, -34, -72, -46,
+    49, 138, 113, -54, -240, -242, 27, 390, 486, 77, -636, -1020, -423, 1278, 3428, 4924,
+    4924, 3428, 1278, -423, -1020, -636, 77, 486, 390, 27, -242, -240, -54, 113, 138, 49,
+    -46, -72, -34, 15, 33, 19, -3, -12, -8, 0, 4, 3, 0, -1, 0, 0,
+};
+
+static const int16_t kHigh16kTo24k[192] = {
+    0, 1, -1, 2, -4, 5, -7, 9, -10, 11, -9, 5, 3, -15, 33, -58,
+    89, -128, 172, -221, 273, -324, 371, -409, 431, -429, 393, -301, 116, 271, -1329, 14785,
+    3927, -2142, 1551, -1212, 969, -773, 608, -466, 345, -243, 158, -91, 39, -2, -24, 39,
+    -46, 47, -43, 38, -31, 24, -18, 12, -8, 5, -3, 1, -1, 0, 0, 0,
+    0, 0, -1, 1, -1, 1, -1, -1, 4, -9, 16, -26, 39, -55, 73, -93,
+    113, -131, 144, -150, 144, -123, 81, -14, -86, 227, -425, 704, -1118, 1811, -3307, 10373,
+    10373, -3307, 1811, -1118, 704, -425, 227, -86, -14, 81, -123, 144, -150, 144, -131, 113,
+    -93, 73, -55, 39, -26, 16, -9, 4, -1, -1, 1, -1, 1, -1, 0, 0,
+    0, 0, 0, -1, 1, -3, 5, -8, 12, -18, 24, -31, 38, -43, 47, -46,
+    39, -24, -2, 39, -91, 158, -243, 345, -466, 608, -773, 969, -1212, 1551, -2142, 3927,
+    14785, -1329, 271, 116, -301, 393, -429, 431, -409, 371, -324, 273, -221, 172, -128, 89,
+    -58, 33, -15, 3, 5, -9, 11, -10, 9, -7, 5, -4, 2, -1, 1, 0,
+};
+
+const ResamplerFilterBank kResamplerFilterBanks[] = {
+    { 24000, 16000, kResamplerQualityFast, 16, kFast24kTo16k },
+    { 48000, 16000, kResamplerQualityFast, 16, kFast48kTo16k },
+    { 16000, 24000, kResamplerQualityFast, 16, kFast16kTo24k },
+    { 24000, 16000, kResamplerQualityBalanced, 32, kBalanced24kTo16k },
+    { 48000, 16000, kResamplerQualityBalanced, 32, kBalanced48kTo16k },
+    { 16000, 24000, kResamplerQualityBalanced, 32, kBalanced16kTo24k },
+    { 24000, 16000, kResamplerQualityHigh, 64, kHigh24kTo16k },
+    { 48000, 16000, kResamplerQualityHigh, 64, kHigh48kTo16k },
+    { 16000, 24000, kResamplerQualityHigh, 64, kHigh16kTo24k },
+};
+
+const size_t kResamplerFilterBankCount = sizeof(kResamplerFilterBanks) / sizeof(kResamplerFilterBanks[0]);
@@ -0,0 +1,35 @@
+#ifndef RESAMPLER_FILTERS_H
+#define RESAMPLER_FILTERS_H
+
+#include <cstddef>
+#include <cstdint>
+
+enum ResamplerQuality {
+    kResamplerQualityFast,      // 16 taps per phase
+    kResamplerQualityBalanced,  // 32 taps per phase
+    kResamplerQualityHigh       // 64 taps per phase
+};
+
+constexpr int GetResamplerTaps(ResamplerQuality quality) {
+    return 16 << quality;
+}
+
+// Coefficients are Q14, the taps of a phase add up to as much as 2.4 in
+// absolute value and the int32 accumulators must not overflow
+#define RESAMPLER_COEFFICIENT_SHIFT 14
+
+// Coefficients for up phases of taps each, every row reversed and scaled to
+// unity DC gain
+struct ResamplerFilterBank {
+    int input_rate;
+    int output_rate;
+    ResamplerQuality quality;
+    int taps;
+    const int16_t* coefficients;
+};
+
+// Precomputed for the rates the boards use, see gen_resampler_filters.py
+extern const ResamplerFilterBank kResamplerFilterBanks[];
+extern const size_t kResamplerFilterBankCount;
+
+#endif // RESAMPLER_FILTERS_H
@@ -2,93 +2,67 @@
 #include "application.h"
 
 #include <esp_log.h>
-#include <model_path.h>
 #include <arpa/inet.h>
 #include <sstream>
-
-#define DETECTION_RUNNING_EVENT 1
+#include <cstring>
+#include <cassert>
+#include <algorithm>
 
 static const char* TAG = "WakeWordDetect";
 
 WakeWordDetect::WakeWordDetect()
-    : afe_detection_data_(nullptr),
-      wake_word_pcm_(),
-      wake_word_opus_() {
-
-    event_group_ = xEventGroupCreate();
+    : wake_word_opus_(WAKE_WORD_PREROLL_MS / OPUS_FRAME_DURATION_MS, WAKE_WORD_MAX_PACKET_SIZE, kPacketQueueDropOldest) {
 }
 
 WakeWordDetect::~WakeWordDetect() {
-    if (afe_detection_data_ != nullptr) {
-        esp_afe_sr_v1.destroy(afe_detection_data_);
+    if (wake_word_encode_task_ != nullptr) {
+        vTaskDelete(wake_word_encode_task_);
     }
-
     if (wake_word_encode_task_stack_ != nullptr) {
         heap_caps_free(wake_word_encode_task_stack_);
     }
-
-    vEventGroupDelete(event_group_);
+    if (wake_word_pcm_ != nullptr) {
+        heap_caps_free(wake_word_pcm_);
+    }
 }
 
-void WakeWordDetect::Initialize(int channels, bool reference) {
-    channels_ = channels;
-    reference_ = reference;
-    int ref_num = reference_ ? 1 : 0;
-
-    srmodel_list_t *models = esp_srmodel_init("model");
-    for (int i = 0; i < models->num; i++) {
-        ESP_LOGI(TAG, "Model %d: %s", i, models->model_name[i]);
-        if (strstr(models->model_name[i], ESP_WN_PREFIX) != NULL) {
-            wakenet_model_ = models->model_name[i];
-            auto words = esp_srmodel_get_wake_words(models, wakenet_model_);
-            // split by ";" to get all wake words
-            std::stringstream ss(words);
-            std::string word;
-            while (std::getline(ss, word, ';')) {
-                wake_words_.push_back(word);
-            }
+void WakeWordDetect::Initialize(AudioFrontEnd* front_end) {
+    front_end_ = front_end;
+
+    auto wakenet_model = front_end_->wakenet_model();
+    if (wakenet_model != nullptr) {
+        auto words = esp_srmodel_get_wake_words(front_end_->models(), (char*)wakenet_model);
+        // split by ";" to get all wake words
+        std::stringstream ss(words);
+        std::string word;
+        while (std::getline(ss, word, ';')) {
+            wake_words_.push_back(word);
         }
+    } else {
+        ESP_LOGW(TAG, "No wakenet model found");
     }
 
-    afe_config_t afe_config = {
-        .aec_init = reference_,
-        .se_init = true,
-        .vad_init = true,
-        .wakenet_init = true,
-        .voice_communication_init = false,
-        .voice_communication_agc_init = false,
-        .voice_communication_agc_gain = 10,
-        .vad_mode = VAD_MODE_3,
-        .wakenet_model_name = wakenet_model_,
-        .wakenet_model_name_2 = NULL,
-        .wakenet_mode = DET_MODE_90,
-        .afe_mode = SR_MODE_HIGH_PERF,
-        .afe_perferred_core = 1,
-        .afe_perferred_priority = 1,
-        .afe_ringbuf_size = 50,
-        .memory_alloc_mode = AFE_MEMORY_ALLOC_MORE_PSRAM,
-        .afe_linear_gain = 1.0,
-        .agc_mode = AFE_MN_PEAK_AGC_MODE_2,
-        .pcm_config = {
-            .total_ch_num = channels_,
-            .mic_num = channels_ - ref_num,
-            .ref_num = ref_num,
-            .sample_rate = 16000
-        },
-        .debug_init = false,
-        .debug_hook = {{ AFE_DEBUG_HOOK_MASE_TASK_IN, NULL }, { AFE_DEBUG_HOOK_FETCH_TASK_IN, NULL }},
-        .afe_ns_mode = NS_MODE_SSP,
-        .afe_ns_model_name = NULL,
-        .fixed_first_channel = true,
-    };
+    front_end_->SetHandler(kAudioFrontEndHeadWakeWord, [this](const afe_fetch_result_t* res) {
+        OnFetchResult(res);
+    });
+    front_end_->SetHandler(kAudioFrontEndHeadVad, [this](const afe_fetch_result_t* res) {
+        OnVadResult(res);
+    });
+    wake_word_pcm_slot_samples_ = front_end_->fetch_chunksize(kAudioFrontEndHeadWakeWord);
+    wake_word_pcm_ = (int16_t*)heap_caps_malloc(WAKE_WORD_PCM_SLOTS * wake_word_pcm_slot_samples_ * sizeof(int16_t),
+        MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    assert(wake_word_pcm_ != nullptr);
 
-    afe_detection_data_ = esp_afe_sr_v1.create_from_config(&afe_config);
+    // The pre-roll encoder runs all the time detection is on, keep it cheap
+    wake_word_encoder_ = std::make_unique<OpusEncoderWrapper>(16000, 1, OPUS_FRAME_DURATION_MS);
+    wake_word_encoder_->SetComplexity(0);
 
-    xTaskCreate([](void* arg) {
+    wake_word_encode_task_stack_ = (StackType_t*)heap_caps_malloc(4096 * 8, MALLOC_CAP_SPIRAM);
+    wake_word_encode_task_ = xTaskCreateStatic([](void* arg) {
         auto this_ = (WakeWordDetect*)arg;
-        this_->AudioDetectionTask();
+        this_->WakeWordEncodeTask();
         vTaskDelete(NULL);
-    }, "audio_detection", 4096 * 2, this, 1, nullptr);
+    }, "encode_detect_packets", 4096 * 8, this, 1, wake_word_encode_task_stack_, &wake_word_encode_task_buffer_);
 }
 
 void WakeWordDetect::OnWakeWordDetected(std::function<void(const std::string& wake_word)> callback) {
@@ -100,115 +74,127 @@ void WakeWordDetect::OnVadStateChange(std::function<void(bool speaking)> callbac
 }
 
 void WakeWordDetect::StartDetection() {
-    xEventGroupSetBits(event_group_, DETECTION_RUNNING_EVENT);
+    if (IsDetectionRunning()) {
+        return;
+    }
+    // Start a fresh pre-roll window, the encode task drops what is left
+    wake_word_reset_ = true;
+    xTaskNotifyGive(wake_word_encode_task_);
+    front_end_->EnableHead(kAudioFrontEndHeadWakeWord, true);
+    front_end_->EnableHead(kAudioFrontEndHeadVad, true);
 }
 
+// The SR instance stops with both of its heads, listening runs the VC instance alone
 void WakeWordDetect::StopDetection() {
-    xEventGroupClearBits(event_group_, DETECTION_RUNNING_EVENT);
+    front_end_->EnableHead(kAudioFrontEndHeadWakeWord, false);
+    front_end_->EnableHead(kAudioFrontEndHeadVad, false);
 }
 
 bool WakeWordDetect::IsDetectionRunning() {
-    return xEventGroupGetBits(event_group_) & DETECTION_RUNNING_EVENT;
+    return front_end_->IsHeadEnabled(kAudioFrontEndHeadWakeWord);
 }
 
-void WakeWordDetect::Feed(const std::vector<int16_t>& data) {
-    input_buffer_.insert(input_buffer_.end(), data.begin(), data.end());
-
-    auto chunk_size = esp_afe_sr_v1.get_feed_chunksize(afe_detection_data_) * channels_;
-    while (input_buffer_.size() >= chunk_size) {
-        esp_afe_sr_v1.feed(afe_detection_data_, input_buffer_.data());
-        input_buffer_.erase(input_buffer_.begin(), input_buffer_.begin() + chunk_size);
+void WakeWordDetect::OnVadResult(const afe_fetch_result_t* res) {
+    if (vad_state_change_callback_) {
+        if (res->vad_state == AFE_VAD_SPEECH && !is_speaking_) {
+            is_speaking_ = true;
+            vad_state_change_callback_(true);
+        } else if (res->vad_state == AFE_VAD_SILENCE && is_speaking_) {
+            is_speaking_ = false;
+            vad_state_change_callback_(false);
+        }
     }
 }
 
-void WakeWordDetect::AudioDetectionTask() {
-    auto chunk_size = esp_afe_sr_v1.get_fetch_chunksize(afe_detection_data_);
-    ESP_LOGI(TAG, "Audio detection task started, chunk size: %d", chunk_size);
-
-    while (true) {
-        xEventGroupWaitBits(event_group_, DETECTION_RUNNING_EVENT, pdFALSE, pdTRUE, portMAX_DELAY);
-
-        auto res = esp_afe_sr_v1.fetch(afe_detection_data_);
-        if (res == nullptr || res->ret_value == ESP_FAIL) {
-            if (res != nullptr) {
-                ESP_LOGI(TAG, "Error code: %d", res->ret_value);
-            }
-            continue;;
-        }
-
-        // Store the wake word data for voice recognition, like who is speaking
-        StoreWakeWordData((uint16_t*)res->data, res->data_size / sizeof(uint16_t));
-
-        // VAD state change
-        if (vad_state_change_callback_) {
-            if (res->vad_state == AFE_VAD_SPEECH && !is_speaking_) {
-                is_speaking_ = true;
-                vad_state_change_callback_(true);
-            } else if (res->vad_state == AFE_VAD_SILENCE && is_speaking_) {
-                is_speaking_ = false;
-                vad_state_change_callback_(false);
-            }
-        }
+void WakeWordDetect::OnFetchResult(const afe_fetch_result_t* res) {
+    // Store the wake word data for voice recognition, like who is speaking
+    StoreWakeWordData(res->data, res->data_size / sizeof(int16_t));
 
-        if (res->wakeup_state == WAKENET_DETECTED) {
-            StopDetection();
-            last_detected_wake_word_ = wake_words_[res->wake_word_index - 1];
+    if (res->wakeup_state == WAKENET_DETECTED) {
+        last_detected_time_ = esp_timer_get_time();
+        StopDetection();
+        wake_word_flush_ = true;
+        xTaskNotifyGive(wake_word_encode_task_);
+        last_detected_wake_word_ = wake_words_[res->wake_word_index - 1];
 
-            if (wake_word_detected_callback_) {
-                wake_word_detected_callback_(last_detected_wake_word_);
-            }
+        if (wake_word_detected_callback_) {
+            wake_word_detected_callback_(last_detected_wake_word_);
         }
     }
 }
 
-void WakeWordDetect::StoreWakeWordData(uint16_t* data, size_t samples) {
-    // store audio data to wake_word_pcm_
-    wake_word_pcm_.emplace_back(std::vector<int16_t>(data, data + samples));
-    // keep about 2 seconds of data, detect duration is 32ms (sample_rate == 16000, chunksize == 512)
-    while (wake_word_pcm_.size() > 2000 / 32) {
-        wake_word_pcm_.pop_front();
+void WakeWordDetect::StoreWakeWordData(const int16_t* data, size_t samples) {
+    uint32_t head = wake_word_pcm_head_.load(std::memory_order_relaxed);
+    if (head - wake_word_pcm_tail_.load(std::memory_order_acquire) >= WAKE_WORD_PCM_SLOTS) {
+        if (wake_word_pcm_dropped_++ % 100 == 0) {
+            ESP_LOGW(TAG, "Pre-roll encoder is behind, %lu chunks dropped", (unsigned long)wake_word_pcm_dropped_);
+        }
+        return;
     }
+
+    samples = std::min(samples, wake_word_pcm_slot_samples_);
+    auto slot = head % WAKE_WORD_PCM_SLOTS;
+    memcpy(wake_word_pcm_ + slot * wake_word_pcm_slot_samples_, data, samples * sizeof(int16_t));
+    wake_word_pcm_sizes_[slot] = samples;
+    wake_word_pcm_head_.store(head + 1, std::memory_order_release);
+    xTaskNotifyGive(wake_word_encode_task_);
 }
 
-void WakeWordDetect::EncodeWakeWordData() {
-    wake_word_opus_.clear();
-    if (wake_word_encode_task_stack_ == nullptr) {
-        wake_word_encode_task_stack_ = (StackType_t*)heap_caps_malloc(4096 * 8, MALLOC_CAP_SPIRAM);
-    }
-    wake_word_encode_task_ = xTaskCreateStatic([](void* arg) {
-        auto this_ = (WakeWordDetect*)arg;
-        {
-            auto start_time = esp_timer_get_time();
-            auto encoder = std::make_unique<OpusEncoderWrapper>(16000, 1, OPUS_FRAME_DURATION_MS);
-            encoder->SetComplexity(0); // 0 is the fastest
-
-            for (auto& pcm: this_->wake_word_pcm_) {
-                encoder->Encode(std::move(pcm), [this_](std::vector<uint8_t>&& opus) {
-                    std::lock_guard<std::mutex> lock(this_->wake_word_mutex_);
-                    this_->wake_word_opus_.emplace_back(std::move(opus));
-                    this_->wake_word_cv_.notify_all();
-                });
-            }
-            this_->wake_word_pcm_.clear();
-
-            auto end_time = esp_timer_get_time();
-            ESP_LOGI(TAG, "Encode wake word opus %zu packets in %lld ms",
-                this_->wake_word_opus_.size(), (end_time - start_time) / 1000);
-
-            std::lock_guard<std::mutex> lock(this_->wake_word_mutex_);
-            this_->wake_word_opus_.push_back(std::vector<uint8_t>());
-            this_->wake_word_cv_.notify_all();
+void WakeWordDetect::WakeWordEncodeTask() {
+    const size_t frame_samples = 16000 / 1000 * OPUS_FRAME_DURATION_MS;
+    auto push_packet = [this](std::vector<uint8_t>&& opus) {
+        wake_word_opus_.Push(opus);
+    };
+
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        if (wake_word_reset_.exchange(false)) {
+            wake_word_pcm_tail_.store(wake_word_pcm_head_.load(std::memory_order_acquire), std::memory_order_release);
+            wake_word_encoder_->ResetState();
+            wake_word_opus_.Clear();
+            wake_word_pending_samples_ = 0;
         }
-        vTaskDelete(NULL);
-    }, "encode_detect_packets", 4096 * 8, this, 1, wake_word_encode_task_stack_, &wake_word_encode_task_buffer_);
+
+        uint32_t tail = wake_word_pcm_tail_.load(std::memory_order_relaxed);
+        while (tail != wake_word_pcm_head_.load(std::memory_order_acquire)) {
+            wake_word_encoding_ = true;
+            auto slot = tail % WAKE_WORD_PCM_SLOTS;
+            auto pcm_data = wake_word_pcm_ + slot * wake_word_pcm_slot_samples_;
+            std::vector<int16_t> pcm(pcm_data, pcm_data + wake_word_pcm_sizes_[slot]);
+            wake_word_pcm_tail_.store(++tail, std::memory_order_release);
+
+            wake_word_pending_samples_ = (wake_word_pending_samples_ + pcm.size()) % frame_samples;
+            wake_word_encoder_->Encode(std::move(pcm), push_packet);
+            std::lock_guard<std::mutex> lock(wake_word_mutex_);
+            wake_word_cv_.notify_all();
+        }
+
+        // The encoder holds up to a frame of the audio right before the
+        // wake word, complete it with silence so it is sent too
+        bool flush = wake_word_flush_.load();
+        if (flush && wake_word_pending_samples_ > 0) {
+            wake_word_encoding_ = true;
+            wake_word_encoder_->Encode(std::vector<int16_t>(frame_samples - wake_word_pending_samples_, 0), push_packet);
+            wake_word_pending_samples_ = 0;
+        }
+
+        std::lock_guard<std::mutex> lock(wake_word_mutex_);
+        if (flush) {
+            wake_word_flush_ = false;
+        }
+        wake_word_encoding_ = false;
+        wake_word_cv_.notify_all();
+    }
 }
 
 bool WakeWordDetect::GetWakeWordOpus(std::vector<uint8_t>& opus) {
+    // Detection has stopped, wait only for the chunks still being encoded
+    // and the padded last frame
     std::unique_lock<std::mutex> lock(wake_word_mutex_);
     wake_word_cv_.wait(lock, [this]() {
-        return !wake_word_opus_.empty();
+        return !wake_word_opus_.empty() || (!wake_word_encoding_ && !wake_word_flush_ &&
+            wake_word_pcm_tail_.load() == wake_word_pcm_head_.load());
     });
-    opus.swap(wake_word_opus_.front());
-    wake_word_opus_.pop_front();
-    return !opus.empty();
+    return wake_word_opus_.Pop(opus);
 }
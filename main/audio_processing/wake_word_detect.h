@@ -3,58 +3,78 @@
 
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
-#include <freertos/event_groups.h>
 
-#include <esp_afe_sr_models.h>
-#include <esp_nsn_models.h>
-
-#include <list>
+#include <atomic>
+#include <memory>
 #include <string>
 #include <vector>
 #include <functional>
 #include <mutex>
 #include <condition_variable>
 
+#include "audio_front_end.h"
+#include "opus_packet_queue.h"
+
+// Audio kept from before the wake word, encoded while detection runs
+#define WAKE_WORD_PREROLL_MS 2000
+#define WAKE_WORD_PCM_SLOTS 4
+#define WAKE_WORD_MAX_PACKET_SIZE 512
+
+class OpusEncoderWrapper;
+
 
 class WakeWordDetect {
 public:
     WakeWordDetect();
     ~WakeWordDetect();
 
-    void Initialize(int channels, bool reference);
-    void Feed(const std::vector<int16_t>& data);
+    void Initialize(AudioFrontEnd* front_end);
     void OnWakeWordDetected(std::function<void(const std::string& wake_word)> callback);
     void OnVadStateChange(std::function<void(bool speaking)> callback);
     void StartDetection();
     void StopDetection();
     bool IsDetectionRunning();
-    void EncodeWakeWordData();
+    // Returns the pre-roll packets one by one, false once they are all taken
     bool GetWakeWordOpus(std::vector<uint8_t>& opus);
     const std::string& GetLastDetectedWakeWord() const { return last_detected_wake_word_; }
+    int64_t GetLastDetectedTime() const { return last_detected_time_; }
 
 private:
-    esp_afe_sr_data_t* afe_detection_data_ = nullptr;
-    char* wakenet_model_ = NULL;
+    AudioFrontEnd* front_end_ = nullptr;
     std::vector<std::string> wake_words_;
-    std::vector<int16_t> input_buffer_;
-    EventGroupHandle_t event_group_;
     std::function<void(const std::string& wake_word)> wake_word_detected_callback_;
     std::function<void(bool speaking)> vad_state_change_callback_;
     bool is_speaking_ = false;
-    int channels_;
-    bool reference_;
     std::string last_detected_wake_word_;
+    int64_t last_detected_time_ = 0;
 
     TaskHandle_t wake_word_encode_task_ = nullptr;
     StaticTask_t wake_word_encode_task_buffer_;
     StackType_t* wake_word_encode_task_stack_ = nullptr;
-    std::list<std::vector<int16_t>> wake_word_pcm_;
-    std::list<std::vector<uint8_t>> wake_word_opus_;
+    std::unique_ptr<OpusEncoderWrapper> wake_word_encoder_;
+
+    // PCM handed from the front end task to the encode task, one chunk per slot
+    int16_t* wake_word_pcm_ = nullptr;
+    uint16_t wake_word_pcm_sizes_[WAKE_WORD_PCM_SLOTS] = {};
+    size_t wake_word_pcm_slot_samples_ = 0;
+    std::atomic<uint32_t> wake_word_pcm_head_{0};
+    std::atomic<uint32_t> wake_word_pcm_tail_{0};
+    std::atomic<bool> wake_word_encoding_{false};
+    std::atomic<bool> wake_word_reset_{false};
+    // Set on detection, the encode task then pads out the frame it holds
+    std::atomic<bool> wake_word_flush_{false};
+    size_t wake_word_pending_samples_ = 0;  // Owned by the encode task
+    uint32_t wake_word_pcm_dropped_ = 0;
+
+    // Rolling window of encoded packets, the oldest falls out
+    OpusPacketQueue wake_word_opus_;
     std::mutex wake_word_mutex_;
     std::condition_variable wake_word_cv_;
 
-    void StoreWakeWordData(uint16_t* data, size_t size);
-    void AudioDetectionTask();
+    void StoreWakeWordData(const int16_t* data, size_t samples);
+    void WakeWordEncodeTask();
+    void OnFetchResult(const afe_fetch_result_t* res);
+    void OnVadResult(const afe_fetch_result_t* res);
 };
 
 #endif
@@ -1,67 +1,198 @@
 #include "background_task.h"
 
 #include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_heap_caps.h>
+#include <cassert>
 
 #define TAG "BackgroundTask"
 
-BackgroundTask::BackgroundTask(uint32_t stack_size) {
+#define LANE_BIT(lane) (1 << (lane))
+
+struct LaneConfig {
+    const char* name;
+    size_t capacity;
+    BackgroundFullPolicy policy;
+};
+
+// Stale microphone audio is worth less than fresh audio, so encodes drop
+// the oldest frame. Decodes are paced by the playout clock and never pile up.
+static const LaneConfig kLaneConfigs[kBackgroundLaneCount] = {
+    { "encode", BACKGROUND_ENCODE_LANE_CAPACITY, kBackgroundFullDropOldest },
+    { "decode", 8, kBackgroundFullBlock },
+};
+
+BackgroundTask::BackgroundTask() {
+    for (int i = 0; i < kBackgroundLaneCount; i++) {
+        auto& lane = lanes_[i];
+        lane.capacity = kLaneConfigs[i].capacity;
+        lane.policy = kLaneConfigs[i].policy;
+        lane.slots.reset(new Slot[lane.capacity]);
+    }
+
 #if CONFIG_IDF_TARGET_ESP32S3
-    task_stack_ = (StackType_t*)heap_caps_malloc(stack_size, MALLOC_CAP_SPIRAM);
-    background_task_handle_ = xTaskCreateStatic([](void* arg) {
-        BackgroundTask* task = (BackgroundTask*)arg;
-        task->BackgroundTaskLoop();
-    }, "background_task", stack_size, this, 1, task_stack_, &task_buffer_);
+    // The AFE fetch tasks run on core 1, the encoder always runs beside them
+    // so it stays on core 0. The decoder goes wherever there is room.
+    StartWorker("bg_encode", LANE_BIT(kBackgroundLaneEncode), 4096 * 8, 0);
+    StartWorker("bg_decode", LANE_BIT(kBackgroundLaneDecode), 4096 * 6, tskNO_AFFINITY);
 #else
-    xTaskCreate([](void* arg) {
-        BackgroundTask* task = (BackgroundTask*)arg;
-        task->BackgroundTaskLoop();
-    }, "background_task", stack_size, this, 1, &background_task_handle_);
+    StartWorker("background_task", LANE_BIT(kBackgroundLaneEncode) | LANE_BIT(kBackgroundLaneDecode),
+        4096 * 8, tskNO_AFFINITY);
 #endif
 }
 
 BackgroundTask::~BackgroundTask() {
-    if (background_task_handle_ != nullptr) {
-        vTaskDelete(background_task_handle_);
+    for (size_t i = 0; i < worker_count_; i++) {
+        auto& worker = workers_[i];
+        if (worker.handle != nullptr) {
+            vTaskDelete(worker.handle);
+        }
+        if (worker.task_stack != nullptr) {
+            heap_caps_free(worker.task_stack);
+        }
     }
 }
 
-void BackgroundTask::Schedule(std::function<void()> callback) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    if (active_tasks_ >= 30) {
-        ESP_LOGW(TAG, "active_tasks_ == %u", active_tasks_.load());
+void BackgroundTask::StartWorker(const char* name, uint32_t lane_mask, uint32_t stack_size, int core) {
+    auto& worker = workers_[worker_count_++];
+    worker.owner = this;
+    worker.lane_mask = lane_mask;
+#if CONFIG_IDF_TARGET_ESP32S3
+    worker.task_stack = (StackType_t*)heap_caps_malloc(stack_size, MALLOC_CAP_SPIRAM);
+#else
+    worker.task_stack = (StackType_t*)heap_caps_malloc(stack_size, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+#endif
+    assert(worker.task_stack != nullptr);
+    worker.handle = xTaskCreateStaticPinnedToCore([](void* arg) {
+        auto worker = (Worker*)arg;
+        worker->owner->WorkerLoop(worker->lane_mask);
+    }, name, stack_size, &worker, 1, worker.task_stack, &worker.task_buffer, core);
+}
+
+// Removes the oldest callback that is not a control one, keeping the order of the rest
+bool BackgroundTask::DropOldestData(Lane& lane) {
+    size_t index = 0;
+    while (index < lane.count && lane.slots[(lane.head + index) % lane.capacity].control) {
+        index++;
+    }
+    if (index == lane.count) {
+        return false;
+    }
+    for (; index > 0; index--) {
+        auto& slot = lane.slots[(lane.head + index) % lane.capacity];
+        auto& previous = lane.slots[(lane.head + index - 1) % lane.capacity];
+        slot.callback = std::move(previous.callback);
+        slot.enqueue_time = previous.enqueue_time;
+        slot.control = previous.control;
     }
-    active_tasks_++;
-    main_tasks_.emplace_back([this, cb = std::move(callback)]() {
-        cb();
-        {
-            std::lock_guard<std::mutex> lock(mutex_);
-            active_tasks_--;
-            if (main_tasks_.empty() && active_tasks_ == 0) {
-                condition_variable_.notify_all();
+    lane.slots[lane.head].callback.Reset();
+    lane.head = (lane.head + 1) % lane.capacity;
+    lane.count--;
+    return true;
+}
+
+bool BackgroundTask::Push(BackgroundLane lane_index, BackgroundCallback&& callback, bool control) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto& lane = lanes_[lane_index];
+    lane.stats.scheduled++;
+
+    if (lane.count == lane.capacity) {
+        auto policy = lane.policy;
+        // A control callback is never the one dropped
+        if (control && policy == kBackgroundFullDropNewest) {
+            policy = kBackgroundFullBlock;
+        }
+        if (policy == kBackgroundFullDropOldest) {
+            if (DropOldestData(lane)) {
+                lane.stats.dropped++;
+                ESP_LOGW(TAG, "Lane %s is full, oldest callback dropped", kLaneConfigs[lane_index].name);
+            } else {
+                policy = kBackgroundFullBlock;
             }
         }
-    });
+        switch (policy) {
+            case kBackgroundFullBlock:
+                condition_variable_.wait(lock, [&lane]() { return lane.count < lane.capacity; });
+                break;
+            case kBackgroundFullDropNewest:
+                lane.stats.dropped++;
+                ESP_LOGW(TAG, "Lane %s is full, callback dropped", kLaneConfigs[lane_index].name);
+                return false;
+            case kBackgroundFullDropOldest:
+                break;
+        }
+    }
+
+    auto& slot = lane.slots[(lane.head + lane.count) % lane.capacity];
+    slot.callback = std::move(callback);
+    slot.enqueue_time = esp_timer_get_time();
+    slot.control = control;
+    lane.count++;
+    if (lane.count > lane.stats.max_depth) {
+        lane.stats.max_depth = lane.count;
+    }
     condition_variable_.notify_all();
+    return true;
 }
 
-void BackgroundTask::WaitForCompletion() {
+void BackgroundTask::WorkerLoop(uint32_t lane_mask) {
+    ESP_LOGI(TAG, "Worker started, lanes 0x%lx", (unsigned long)lane_mask);
     std::unique_lock<std::mutex> lock(mutex_);
-    condition_variable_.wait(lock, [this]() {
-        return main_tasks_.empty() && active_tasks_ == 0;
-    });
+    while (true) {
+        condition_variable_.wait(lock, [this, lane_mask]() {
+            for (int i = 0; i < kBackgroundLaneCount; i++) {
+                if ((lane_mask & LANE_BIT(i)) && lanes_[i].count > 0) {
+                    return true;
+                }
+            }
+            return false;
+        });
+
+        // Take at most one callback from each lane per round
+        for (int i = 0; i < kBackgroundLaneCount; i++) {
+            auto& lane = lanes_[i];
+            if (!(lane_mask & LANE_BIT(i)) || lane.count == 0) {
+                continue;
+            }
+
+            auto& slot = lane.slots[lane.head];
+            BackgroundCallback callback = std::move(slot.callback);
+            int64_t latency = esp_timer_get_time() - slot.enqueue_time;
+            lane.head = (lane.head + 1) % lane.capacity;
+            lane.count--;
+            lane.stats.total_latency_us += latency;
+            if (latency > lane.stats.max_latency_us) {
+                lane.stats.max_latency_us = latency;
+            }
+            // Wake up producers waiting for a free slot
+            condition_variable_.notify_all();
+            lock.unlock();
+
+            callback();
+            callback.Reset();
+
+            lock.lock();
+            lane.stats.executed++;
+        }
+    }
 }
 
-void BackgroundTask::BackgroundTaskLoop() {
-    ESP_LOGI(TAG, "background_task started");
-    while (true) {
-        std::unique_lock<std::mutex> lock(mutex_);
-        condition_variable_.wait(lock, [this]() { return !main_tasks_.empty(); });
-        
-        std::list<std::function<void()>> tasks = std::move(main_tasks_);
-        lock.unlock();
-
-        for (auto& task : tasks) {
-            task();
+BackgroundLaneStats BackgroundTask::GetLaneStats(BackgroundLane lane) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto stats = lanes_[lane].stats;
+    stats.depth = lanes_[lane].count;
+    return stats;
+}
+
+void BackgroundTask::LogStats() {
+    for (int i = 0; i < kBackgroundLaneCount; i++) {
+        auto stats = GetLaneStats((BackgroundLane)i);
+        if (stats.executed == 0) {
+            continue;
         }
+        ESP_LOGI(TAG, "Lane %s: executed %lu, dropped %lu, depth %zu/%zu, latency avg %lld us, max %lld us",
+            kLaneConfigs[i].name, (unsigned long)stats.executed, (unsigned long)stats.dropped,
+            stats.max_depth, kLaneConfigs[i].capacity,
+            stats.total_latency_us / stats.executed, stats.max_latency_us);
     }
 }
@@ -4,30 +4,100 @@
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 #include <mutex>
-#include <list>
 #include <condition_variable>
-#include <atomic>
+#include <memory>
+#include <cstddef>
+#include <cstdint>
 
+#include "inplace_function.h"
+
+// Bytes available for the captures of a scheduled callback
+#define BACKGROUND_TASK_CALLBACK_SIZE 32
+// Callbacks the encode lane holds before it drops the oldest
+#define BACKGROUND_ENCODE_LANE_CAPACITY 16
+
+enum BackgroundLane {
+    kBackgroundLaneEncode,
+    kBackgroundLaneDecode,
+    kBackgroundLaneCount
+};
+
+enum BackgroundFullPolicy {
+    kBackgroundFullBlock,       // Schedule() waits for a free slot
+    kBackgroundFullDropNewest,  // The new callback is rejected
+    kBackgroundFullDropOldest   // The oldest queued callback is discarded
+};
+
+struct BackgroundLaneStats {
+    uint32_t scheduled = 0;
+    uint32_t executed = 0;
+    uint32_t dropped = 0;
+    size_t depth = 0;
+    size_t max_depth = 0;
+    int64_t total_latency_us = 0;
+    int64_t max_latency_us = 0;
+};
+
+typedef InplaceFunction<BACKGROUND_TASK_CALLBACK_SIZE> BackgroundCallback;
+
+// Runs callbacks off the main loop in separate lanes, so a burst of work in
+// one lane does not hold up the others. Each lane is a fixed ring of inline
+// callbacks. On ESP32-S3 every lane has its own worker, elsewhere one
+// worker takes turns between the lanes.
 class BackgroundTask {
 public:
-    BackgroundTask(uint32_t stack_size = 4096 * 2);
+    BackgroundTask();
     ~BackgroundTask();
 
-    void Schedule(std::function<void()> callback);
-    void WaitForCompletion();
+    // Returns false if the callback was dropped
+    template <typename F>
+    bool Schedule(BackgroundLane lane, F&& callback) {
+        return Push(lane, BackgroundCallback(std::forward<F>(callback)), false);
+    }
+    // For state changes such as a codec reset. A full lane never drops
+    // them, it drops an older data callback or waits instead.
+    template <typename F>
+    void ScheduleControl(BackgroundLane lane, F&& callback) {
+        Push(lane, BackgroundCallback(std::forward<F>(callback)), true);
+    }
+
+    BackgroundLaneStats GetLaneStats(BackgroundLane lane);
+    void LogStats();
 
 private:
+    struct Slot {
+        BackgroundCallback callback;
+        int64_t enqueue_time;
+        bool control;
+    };
+
+    struct Lane {
+        std::unique_ptr<Slot[]> slots;
+        size_t capacity = 0;
+        size_t head = 0;
+        size_t count = 0;
+        BackgroundFullPolicy policy = kBackgroundFullBlock;
+        BackgroundLaneStats stats;
+    };
+
+    struct Worker {
+        BackgroundTask* owner = nullptr;
+        uint32_t lane_mask = 0;
+        TaskHandle_t handle = nullptr;
+        StaticTask_t task_buffer;
+        StackType_t* task_stack = nullptr;
+    };
+
     std::mutex mutex_;
-    std::list<std::function<void()>> main_tasks_;
     std::condition_variable condition_variable_;
-    TaskHandle_t background_task_handle_ = nullptr;
-    std::atomic<size_t> active_tasks_{0};
-
-    TaskHandle_t task_ = nullptr;
-    StaticTask_t task_buffer_;
-    StackType_t* task_stack_ = nullptr;
+    Lane lanes_[kBackgroundLaneCount];
+    Worker workers_[kBackgroundLaneCount];
+    size_t worker_count_ = 0;
 
-    void BackgroundTaskLoop();
+    bool Push(BackgroundLane lane, BackgroundCallback&& callback, bool control);
+    bool DropOldestData(Lane& lane);
+    void StartWorker(const char* name, uint32_t lane_mask, uint32_t stack_size, int core);
+    void WorkerLoop(uint32_t lane_mask);
 };
 
 #endif
@@ -20,6 +20,39 @@ Display* Board::GetDisplay() {
     return &display;
 }
 
+void Board::RecordConnect(ConnectionKind kind, int64_t duration_us, bool success) {
+    std::lock_guard<std::mutex> lock(connection_mutex_);
+    auto& metrics = connection_metrics_[kind];
+    if (!success) {
+        metrics.failures++;
+        return;
+    }
+    metrics.connects++;
+    metrics.total_connect_us += duration_us;
+    if (duration_us > metrics.max_connect_us) {
+        metrics.max_connect_us = duration_us;
+    }
+}
+
+ConnectionMetrics Board::GetConnectionMetrics(ConnectionKind kind) {
+    std::lock_guard<std::mutex> lock(connection_mutex_);
+    return connection_metrics_[kind];
+}
+
+void Board::LogConnectionMetrics() {
+    static const char* const kind_names[kConnectionKindCount] = { "http", "websocket", "mqtt" };
+    for (int i = 0; i < kConnectionKindCount; i++) {
+        auto metrics = GetConnectionMetrics((ConnectionKind)i);
+        if (metrics.connects == 0 && metrics.failures == 0) {
+            continue;
+        }
+        ESP_LOGI(TAG, "Connections %s: %lu ok, %lu failed, avg %lld ms, max %lld ms",
+            kind_names[i], (unsigned long)metrics.connects, (unsigned long)metrics.failures,
+            metrics.connects > 0 ? metrics.total_connect_us / metrics.connects / 1000 : 0LL,
+            metrics.max_connect_us / 1000);
+    }
+}
+
 
 std::string Board::GetJson() {
     /* 
@@ -56,59 +89,60 @@ std::string Board::GetJson() {
             }
         }
     */
-    std::string json = "{";
-    json += "\"flash_size\":" + std::to_string(SystemInfo::GetFlashSize()) + ",";
-    json += "\"minimum_free_heap_size\":" + std::to_string(SystemInfo::GetMinimumFreeHeapSize()) + ",";
-    json += "\"mac_address\":\"" + SystemInfo::GetMacAddress() + "\",";
-    json += "\"chip_model_name\":\"" + SystemInfo::GetChipModelName() + "\",";
-    json += "\"chip_info\":{";
+    JsonWriter writer(BOARD_JSON_CAPACITY);
+    writer.BeginObject();
+    writer.Key("flash_size").Number(SystemInfo::GetFlashSize());
+    writer.Key("minimum_free_heap_size").Number(SystemInfo::GetMinimumFreeHeapSize());
+    writer.Key("mac_address").String(SystemInfo::GetMacAddress());
+    writer.Key("chip_model_name").String(SystemInfo::GetChipModelName());
 
     esp_chip_info_t chip_info;
     esp_chip_info(&chip_info);
-    json += "\"model\":" + std::to_string(chip_info.model) + ",";
-    json += "\"cores\":" + std::to_string(chip_info.cores) + ",";
-    json += "\"revision\":" + std::to_string(chip_info.revision) + ",";
-    json += "\"features\":" + std::to_string(chip_info.features);
-    json += "},";
+    writer.Key("chip_info").BeginObject();
+    writer.Key("model").Number(chip_info.model);
+    writer.Key("cores").Number(chip_info.cores);
+    writer.Key("revision").Number(chip_info.revision);
+    writer.Key("features").Number(chip_info.features);
+    writer.EndObject();
 
-    json += "\"application\":{";
     auto app_desc = esp_app_get_description();
-    json += "\"name\":\"" + std::string(app_desc->project_name) + "\",";
-    json += "\"version\":\"" + std::string(app_desc->version) + "\",";
-    json += "\"compile_time\":\"" + std::string(app_desc->date) + "T" + std::string(app_desc->time) + "Z\",";
-    json += "\"idf_version\":\"" + std::string(app_desc->idf_ver) + "\",";
-
+    char compile_time[40];
+    snprintf(compile_time, sizeof(compile_time), "%sT%sZ", app_desc->date, app_desc->time);
     char sha256_str[65];
     for (int i = 0; i < 32; i++) {
         snprintf(sha256_str + i * 2, sizeof(sha256_str) - i * 2, "%02x", app_desc->app_elf_sha256[i]);
     }
-    json += "\"elf_sha256\":\"" + std::string(sha256_str) + "\"";
-    json += "},";
+    writer.Key("application").BeginObject();
+    writer.Key("name").String(app_desc->project_name);
+    writer.Key("version").String(app_desc->version);
+    writer.Key("compile_time").String(compile_time);
+    writer.Key("idf_version").String(app_desc->idf_ver);
+    writer.Key("elf_sha256").String(sha256_str);
+    writer.EndObject();
 
-    json += "\"partition_table\": [";
+    writer.Key("partition_table").BeginArray();
     esp_partition_iterator_t it = esp_partition_find(ESP_PARTITION_TYPE_ANY, ESP_PARTITION_SUBTYPE_ANY, NULL);
     while (it) {
         const esp_partition_t *partition = esp_partition_get(it);
-        json += "{";
-        json += "\"label\":\"" + std::string(partition->label) + "\",";
-        json += "\"type\":" + std::to_string(partition->type) + ",";
-        json += "\"subtype\":" + std::to_string(partition->subtype) + ",";
-        json += "\"address\":" + std::to_string(partition->address) + ",";
-        json += "\"size\":" + std::to_string(partition->size);
-        json += "},";
+        writer.BeginObject();
+        writer.Key("label").String(partition->label);
+        writer.Key("type").Number(partition->type);
+        writer.Key("subtype").Number(partition->subtype);
+        writer.Key("address").Number(partition->address);
+        writer.Key("size").Number(partition->size);
+        writer.EndObject();
         it = esp_partition_next(it);
     }
-    json.pop_back(); // Remove the last comma
-    json += "],";
+    writer.EndArray();
 
-    json += "\"ota\":{";
     auto ota_partition = esp_ota_get_running_partition();
-    json += "\"label\":\"" + std::string(ota_partition->label) + "\"";
-    json += "},";
+    writer.Key("ota").BeginObject();
+    writer.Key("label").String(ota_partition->label);
+    writer.EndObject();
 
-    json += "\"board\":" + GetBoardJson();
+    writer.Key("board");
+    GetBoardJson(writer);
 
-    // Close the JSON object
-    json += "}";
-    return json;
+    writer.EndObject();
+    return writer.TakeString();
 }
\ No newline at end of file
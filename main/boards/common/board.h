@@ -6,8 +6,29 @@
 #include <mqtt.h>
 #include <udp.h>
 #include <string>
+#include <mutex>
+#include <cstdint>
 
 #include "led.h"
+#include "json_writer.h"
+
+// Reserved for the device description posted to the OTA server
+#define BOARD_JSON_CAPACITY 2048
+
+enum ConnectionKind {
+    kConnectionHttp,
+    kConnectionWebSocket,
+    kConnectionMqtt,
+    kConnectionKindCount
+};
+
+// Time spent in connection setup, which includes the TLS handshake
+struct ConnectionMetrics {
+    uint32_t connects = 0;
+    uint32_t failures = 0;
+    int64_t total_connect_us = 0;
+    int64_t max_connect_us = 0;
+};
 
 void* create_board();
 class AudioCodec;
@@ -16,7 +37,10 @@ class Board {
 private:
     Board(const Board&) = delete; // 禁用拷贝构造函数
     Board& operator=(const Board&) = delete; // 禁用赋值操作
-    virtual std::string GetBoardJson() = 0;
+    virtual void GetBoardJson(JsonWriter& writer) = 0;
+
+    std::mutex connection_mutex_;
+    ConnectionMetrics connection_metrics_[kConnectionKindCount];
 
 protected:
     Board();
@@ -39,6 +63,9 @@ public:
     virtual WebSocket* CreateWebSocket() = 0;
     virtual Mqtt* CreateMqtt() = 0;
     virtual Udp* CreateUdp() = 0;
+    void RecordConnect(ConnectionKind kind, int64_t duration_us, bool success);
+    ConnectionMetrics GetConnectionMetrics(ConnectionKind kind);
+    void LogConnectionMetrics();
     virtual bool GetNetworkState(std::string& network_name, int& signal_quality, std::string& signal_quality_text) = 0;
     virtual const char* GetNetworkStateIcon() = 0;
     virtual bool GetBatteryLevel(int &level, bool& charging);
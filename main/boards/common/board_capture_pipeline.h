@@ -0,0 +1,18 @@
+#ifndef BOARD_CAPTURE_PIPELINE_H
+#define BOARD_CAPTURE_PIPELINE_H
+
+// The config.h of the board being built, see main/CMakeLists.txt
+#include BOARD_CONFIG_HEADER
+#include "capture_pipeline.h"
+
+#ifdef AUDIO_INPUT_REFERENCE
+#define BOARD_INPUT_CHANNELS (AUDIO_INPUT_REFERENCE ? 2 : 1)
+#else
+#define BOARD_INPUT_CHANNELS 1
+#endif
+
+// A class rather than an alias, so it can be forward declared
+class BoardCapturePipeline : public CapturePipeline<BOARD_INPUT_CHANNELS, AUDIO_INPUT_SAMPLE_RATE> {
+};
+
+#endif // BOARD_CAPTURE_PIPELINE_H
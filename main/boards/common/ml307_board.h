@@ -8,7 +8,7 @@ class Ml307Board : public Board {
 protected:
     Ml307AtModem modem_;
 
-    virtual std::string GetBoardJson() override;
+    virtual void GetBoardJson(JsonWriter& writer) override;
     void WaitForNetworkReady();
 
 public:
@@ -0,0 +1,112 @@
+#include "tls_session_transport.h"
+
+#include <esp_log.h>
+#include <esp_crt_bundle.h>
+#include <cstring>
+#include <mutex>
+#include <string>
+
+#define TAG "TlsSessionTransport"
+
+#ifdef CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+// One cached session, the device talks to one server at a time
+static std::mutex session_mutex;
+static esp_tls_client_session_t* cached_session = nullptr;
+static std::string cached_host;
+static int cached_port = 0;
+#endif
+
+TlsSessionTransport::TlsSessionTransport() {
+}
+
+TlsSessionTransport::~TlsSessionTransport() {
+    Disconnect();
+}
+
+bool TlsSessionTransport::Connect(const char* host, int port) {
+    esp_tls_cfg_t cfg = {};
+    cfg.crt_bundle_attach = esp_crt_bundle_attach;
+
+    tls_client_ = esp_tls_init();
+    if (tls_client_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to initialize TLS");
+        return false;
+    }
+
+#ifdef CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+    // Held through the handshake, which copies the cached session
+    std::lock_guard<std::mutex> lock(session_mutex);
+    bool resuming = cached_session != nullptr && cached_host == host && cached_port == port;
+    if (resuming) {
+        cfg.client_session = cached_session;
+    }
+#endif
+
+    int ret = esp_tls_conn_new_sync(host, strlen(host), port, &cfg, tls_client_);
+    if (ret != 1) {
+        ESP_LOGE(TAG, "Failed to connect to %s:%d", host, port);
+        esp_tls_conn_destroy(tls_client_);
+        tls_client_ = nullptr;
+#ifdef CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+        // The server may have forgotten the session, start over next time
+        if (resuming) {
+            esp_tls_free_client_session(cached_session);
+            cached_session = nullptr;
+        }
+#endif
+        return false;
+    }
+
+#ifdef CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+    // Keep the newest session, the server may have issued a fresh ticket
+    auto session = esp_tls_get_client_session(tls_client_);
+    if (session != nullptr) {
+        if (cached_session != nullptr) {
+            esp_tls_free_client_session(cached_session);
+        }
+        cached_session = session;
+        cached_host = host;
+        cached_port = port;
+    }
+    ESP_LOGI(TAG, "Connected to %s:%d, %s", host, port, resuming ? "offered cached session" : "full handshake");
+#endif
+
+    connected_ = true;
+    return true;
+}
+
+void TlsSessionTransport::Disconnect() {
+    if (tls_client_ != nullptr) {
+        esp_tls_conn_destroy(tls_client_);
+        tls_client_ = nullptr;
+    }
+    connected_ = false;
+}
+
+int TlsSessionTransport::Send(const char* data, size_t length) {
+    size_t sent = 0;
+    while (sent < length) {
+        int ret = esp_tls_conn_write(tls_client_, data + sent, length - sent);
+        if (ret == ESP_TLS_ERR_SSL_WANT_READ || ret == ESP_TLS_ERR_SSL_WANT_WRITE) {
+            continue;
+        }
+        if (ret <= 0) {
+            ESP_LOGE(TAG, "Send failed: %d", ret);
+            connected_ = false;
+            return ret;
+        }
+        sent += ret;
+    }
+    return sent;
+}
+
+int TlsSessionTransport::Receive(char* buffer, size_t bufferSize) {
+    int ret;
+    do {
+        ret = esp_tls_conn_read(tls_client_, buffer, bufferSize);
+    } while (ret == ESP_TLS_ERR_SSL_WANT_READ || ret == ESP_TLS_ERR_SSL_WANT_WRITE);
+    if (ret <= 0) {
+        connected_ = false;
+    }
+    return ret;
+}
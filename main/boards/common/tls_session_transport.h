@@ -0,0 +1,26 @@
+#ifndef TLS_SESSION_TRANSPORT_H
+#define TLS_SESSION_TRANSPORT_H
+
+#include <transport.h>
+#include <esp_tls.h>
+
+// TLS over esp-tls like TlsTransport, but the session of the last
+// successful handshake is kept and offered to the next connection to the
+// same host, so a reconnect resumes it instead of doing a full handshake.
+// Needs CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS, without it every connection
+// does a full handshake.
+class TlsSessionTransport : public Transport {
+public:
+    TlsSessionTransport();
+    ~TlsSessionTransport();
+
+    bool Connect(const char* host, int port) override;
+    void Disconnect() override;
+    int Send(const char* data, size_t length) override;
+    int Receive(char* buffer, size_t bufferSize) override;
+
+private:
+    esp_tls_t* tls_client_ = nullptr;
+};
+
+#endif // TLS_SESSION_TRANSPORT_H
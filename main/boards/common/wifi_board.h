@@ -7,7 +7,7 @@ class WifiBoard : public Board {
 protected:
     bool wifi_config_mode_ = false;
 
-    virtual std::string GetBoardJson() override;
+    virtual void GetBoardJson(JsonWriter& writer) override;
 
 public:
     virtual void StartNetwork() override;
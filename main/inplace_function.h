@@ -0,0 +1,75 @@
+#ifndef INPLACE_FUNCTION_H
+#define INPLACE_FUNCTION_H
+
+#include <new>
+#include <utility>
+#include <type_traits>
+#include <cstddef>
+
+// A void() callable stored inline, it never allocates. Callables larger
+// than the buffer are rejected at compile time.
+template <size_t Capacity>
+class InplaceFunction {
+public:
+    InplaceFunction() = default;
+
+    template <typename F, typename T = std::decay_t<F>,
+              typename = std::enable_if_t<!std::is_same<T, InplaceFunction>::value>>
+    InplaceFunction(F&& f) {
+        static_assert(sizeof(T) <= Capacity, "Callback captures too much, move the data into a buffer");
+        static_assert(alignof(T) <= alignof(std::max_align_t), "Callback is over aligned");
+        new (storage_) T(std::forward<F>(f));
+        invoke_ = [](void* callable) { (*static_cast<T*>(callable))(); };
+        manage_ = [](void* to, void* from) {
+            if (to != nullptr) {
+                new (to) T(std::move(*static_cast<T*>(from)));
+            }
+            static_cast<T*>(from)->~T();
+        };
+    }
+
+    InplaceFunction(InplaceFunction&& other) noexcept {
+        MoveFrom(other);
+    }
+
+    InplaceFunction& operator=(InplaceFunction&& other) noexcept {
+        if (this != &other) {
+            Reset();
+            MoveFrom(other);
+        }
+        return *this;
+    }
+
+    InplaceFunction(const InplaceFunction&) = delete;
+    InplaceFunction& operator=(const InplaceFunction&) = delete;
+
+    ~InplaceFunction() { Reset(); }
+
+    void operator()() { invoke_(storage_); }
+    explicit operator bool() const { return invoke_ != nullptr; }
+
+    void Reset() {
+        if (manage_ != nullptr) {
+            manage_(nullptr, storage_);
+            invoke_ = nullptr;
+            manage_ = nullptr;
+        }
+    }
+
+private:
+    alignas(std::max_align_t) unsigned char storage_[Capacity];
+    void (*invoke_)(void* callable) = nullptr;
+    void (*manage_)(void* to, void* from) = nullptr;
+
+    void MoveFrom(InplaceFunction& other) {
+        if (other.manage_ != nullptr) {
+            other.manage_(storage_, other.storage_);
+            invoke_ = other.invoke_;
+            manage_ = other.manage_;
+            other.invoke_ = nullptr;
+            other.manage_ = nullptr;
+        }
+    }
+};
+
+#endif // INPLACE_FUNCTION_H
@@ -26,41 +26,45 @@ Thing* CreateThing(const std::string& type) {
     return creator->second();
 }
 
-std::string Thing::GetDescriptorJson() {
-    std::string json_str = "{";
-    json_str += "\"name\":\"" + name_ + "\",";
-    json_str += "\"description\":\"" + description_ + "\",";
-    json_str += "\"properties\":" + properties_.GetDescriptorJson() + ",";
-    json_str += "\"methods\":" + methods_.GetDescriptorJson();
-    json_str += "}";
-    return json_str;
+void Thing::GetDescriptorJson(JsonWriter& writer) {
+    writer.BeginObject();
+    writer.Key("name").String(name_);
+    writer.Key("description").String(description_);
+    writer.Key("properties");
+    properties_.GetDescriptorJson(writer);
+    writer.Key("methods");
+    methods_.GetDescriptorJson(writer);
+    writer.EndObject();
 }
 
-std::string Thing::GetStateJson() {
-    std::string json_str = "{";
-    json_str += "\"name\":\"" + name_ + "\",";
-    json_str += "\"state\":" + properties_.GetStateJson();
-    json_str += "}";
-    return json_str;
+void Thing::GetStateJson(JsonWriter& writer) {
+    writer.BeginObject();
+    writer.Key("name").String(name_);
+    writer.Key("state");
+    properties_.GetStateJson(writer);
+    writer.EndObject();
 }
 
-void Thing::Invoke(const cJSON* command) {
-    auto method_name = cJSON_GetObjectItem(command, "method");
-    auto input_params = cJSON_GetObjectItem(command, "parameters");
+void Thing::Invoke(const JsonValue& command) {
+    auto method_name = command["method"].ToString();
+    auto input_params = command["parameters"];
 
     try {
-        auto& method = methods_[method_name->valuestring];
+        auto& method = methods_[method_name];
         for (auto& param : method.parameters()) {
-            auto input_param = cJSON_GetObjectItem(input_params, param.name().c_str());
-            if (param.required() && input_param == nullptr) {
-                throw std::runtime_error("Parameter " + param.name() + " is required");
+            auto input_param = input_params[param.name().c_str()];
+            if (!input_param.IsValid()) {
+                if (param.required()) {
+                    throw std::runtime_error("Parameter " + param.name() + " is required");
+                }
+                continue;
             }
             if (param.type() == kValueTypeNumber) {
-                param.set_number(input_param->valueint);
+                param.set_number(input_param.ToInt());
             } else if (param.type() == kValueTypeString) {
-                param.set_string(input_param->valuestring);
+                param.set_string(input_param.ToString());
             } else if (param.type() == kValueTypeBoolean) {
-                param.set_boolean(input_param->valueint == 1);
+                param.set_boolean(input_param.ToBool());
             }
         }
 
@@ -68,7 +72,7 @@ void Thing::Invoke(const cJSON* command) {
             method.Invoke();
         });
     } catch (const std::runtime_error& e) {
-        ESP_LOGE(TAG, "Method not found: %s", method_name->valuestring);
+        ESP_LOGE(TAG, "Method not found: %s", method_name.c_str());
         return;
     }
 }
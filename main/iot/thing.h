@@ -6,7 +6,8 @@
 #include <functional>
 #include <vector>
 #include <stdexcept>
-#include <cJSON.h>
+#include "json_writer.h"
+#include "json_reader.h"
 
 namespace iot {
 
@@ -16,6 +17,15 @@ enum ValueType {
     kValueTypeString
 };
 
+inline const char* ValueTypeName(ValueType type) {
+    switch (type) {
+        case kValueTypeBoolean: return "boolean";
+        case kValueTypeNumber: return "number";
+        case kValueTypeString: return "string";
+    }
+    return "unknown";
+}
+
 class Property {
 private:
     std::string name_;
@@ -41,29 +51,23 @@ public:
     int number() const { return number_getter_(); }
     std::string string() const { return string_getter_(); }
 
-    std::string GetDescriptorJson() {
-        std::string json_str = "{";
-        json_str += "\"description\":\"" + description_ + "\",";
-        if (type_ == kValueTypeBoolean) {
-            json_str += "\"type\":\"boolean\"";
-        } else if (type_ == kValueTypeNumber) {
-            json_str += "\"type\":\"number\"";
-        } else if (type_ == kValueTypeString) {
-            json_str += "\"type\":\"string\"";
-        }
-        json_str += "}";
-        return json_str;
+    void GetDescriptorJson(JsonWriter& writer) {
+        writer.BeginObject();
+        writer.Key("description").String(description_);
+        writer.Key("type").String(ValueTypeName(type_));
+        writer.EndObject();
     }
 
-    std::string GetStateJson() {
+    void GetStateJson(JsonWriter& writer) {
         if (type_ == kValueTypeBoolean) {
-            return boolean_getter_() ? "true" : "false";
+            writer.Bool(boolean_getter_());
         } else if (type_ == kValueTypeNumber) {
-            return std::to_string(number_getter_());
+            writer.Number(number_getter_());
         } else if (type_ == kValueTypeString) {
-            return "\"" + string_getter_() + "\"";
+            writer.String(string_getter_());
+        } else {
+            writer.Null();
         }
-        return "null";
     }
 };
 
@@ -94,28 +98,22 @@ public:
         throw std::runtime_error("Property not found: " + name);
     }
 
-    std::string GetDescriptorJson() {
-        std::string json_str = "{";
+    void GetDescriptorJson(JsonWriter& writer) {
+        writer.BeginObject();
         for (auto& property : properties_) {
-            json_str += "\"" + property.name() + "\":" + property.GetDescriptorJson() + ",";
-        }
-        if (json_str.back() == ',') {
-            json_str.pop_back();
+            writer.Key(property.name());
+            property.GetDescriptorJson(writer);
         }
-        json_str += "}";
-        return json_str;
+        writer.EndObject();
     }
 
-    std::string GetStateJson() {
-        std::string json_str = "{";
+    void GetStateJson(JsonWriter& writer) {
+        writer.BeginObject();
         for (auto& property : properties_) {
-            json_str += "\"" + property.name() + "\":" + property.GetStateJson() + ",";
+            writer.Key(property.name());
+            property.GetStateJson(writer);
         }
-        if (json_str.back() == ',') {
-            json_str.pop_back();
-        }
-        json_str += "}";
-        return json_str;
+        writer.EndObject();
     }
 };
 
@@ -146,18 +144,11 @@ public:
     void set_number(int value) { number_ = value; }
     void set_string(const std::string& value) { string_ = value; }
 
-    std::string GetDescriptorJson() {
-        std::string json_str = "{";
-        json_str += "\"description\":\"" + description_ + "\",";
-        if (type_ == kValueTypeBoolean) {
-            json_str += "\"type\":\"boolean\"";
-        } else if (type_ == kValueTypeNumber) {
-            json_str += "\"type\":\"number\"";
-        } else if (type_ == kValueTypeString) {
-            json_str += "\"type\":\"string\"";
-        }
-        json_str += "}";
-        return json_str;
+    void GetDescriptorJson(JsonWriter& writer) {
+        writer.BeginObject();
+        writer.Key("description").String(description_);
+        writer.Key("type").String(ValueTypeName(type_));
+        writer.EndObject();
     }
 };
 
@@ -185,16 +176,13 @@ public:
     auto begin() { return parameters_.begin(); }
     auto end() { return parameters_.end(); }
 
-    std::string GetDescriptorJson() {
-        std::string json_str = "{";
+    void GetDescriptorJson(JsonWriter& writer) {
+        writer.BeginObject();
         for (auto& parameter : parameters_) {
-            json_str += "\"" + parameter.name() + "\":" + parameter.GetDescriptorJson() + ",";
-        }
-        if (json_str.back() == ',') {
-            json_str.pop_back();
+            writer.Key(parameter.name());
+            parameter.GetDescriptorJson(writer);
         }
-        json_str += "}";
-        return json_str;
+        writer.EndObject();
     }
 };
 
@@ -213,12 +201,12 @@ public:
     const std::string& description() const { return description_; }
     ParameterList& parameters() { return parameters_; }
 
-    std::string GetDescriptorJson() {
-        std::string json_str = "{";
-        json_str += "\"description\":\"" + description_ + "\",";
-        json_str += "\"parameters\":" + parameters_.GetDescriptorJson();
-        json_str += "}";
-        return json_str;
+    void GetDescriptorJson(JsonWriter& writer) {
+        writer.BeginObject();
+        writer.Key("description").String(description_);
+        writer.Key("parameters");
+        parameters_.GetDescriptorJson(writer);
+        writer.EndObject();
     }
 
     void Invoke() {
@@ -247,16 +235,13 @@ public:
         throw std::runtime_error("Method not found: " + name);
     }
 
-    std::string GetDescriptorJson() {
-        std::string json_str = "{";
+    void GetDescriptorJson(JsonWriter& writer) {
+        writer.BeginObject();
         for (auto& method : methods_) {
-            json_str += "\"" + method.name() + "\":" + method.GetDescriptorJson() + ",";
-        }
-        if (json_str.back() == ',') {
-            json_str.pop_back();
+            writer.Key(method.name());
+            method.GetDescriptorJson(writer);
         }
-        json_str += "}";
-        return json_str;
+        writer.EndObject();
     }
 };
 
@@ -266,9 +251,9 @@ public:
         name_(name), description_(description) {}
     virtual ~Thing() = default;
 
-    virtual std::string GetDescriptorJson();
-    virtual std::string GetStateJson();
-    virtual void Invoke(const cJSON* command);
+    virtual void GetDescriptorJson(JsonWriter& writer);
+    virtual void GetStateJson(JsonWriter& writer);
+    virtual void Invoke(const JsonValue& command);
 
     const std::string& name() const { return name_; }
     const std::string& description() const { return description_; }
@@ -11,33 +11,29 @@ void ThingManager::AddThing(Thing* thing) {
 }
 
 std::string ThingManager::GetDescriptorsJson() {
-    std::string json_str = "[";
+    JsonWriter writer(THING_MANAGER_DESCRIPTOR_CAPACITY * (things_.size() + 1));
+    writer.BeginArray();
     for (auto& thing : things_) {
-        json_str += thing->GetDescriptorJson() + ",";
+        thing->GetDescriptorJson(writer);
     }
-    if (json_str.back() == ',') {
-        json_str.pop_back();
-    }
-    json_str += "]";
-    return json_str;
+    writer.EndArray();
+    return writer.TakeString();
 }
 
 std::string ThingManager::GetStatesJson() {
-    std::string json_str = "[";
+    JsonWriter writer(THING_MANAGER_STATE_CAPACITY * (things_.size() + 1));
+    writer.BeginArray();
     for (auto& thing : things_) {
-        json_str += thing->GetStateJson() + ",";
-    }
-    if (json_str.back() == ',') {
-        json_str.pop_back();
+        thing->GetStateJson(writer);
     }
-    json_str += "]";
-    return json_str;
+    writer.EndArray();
+    return writer.TakeString();
 }
 
-void ThingManager::Invoke(const cJSON* command) {
-    auto name = cJSON_GetObjectItem(command, "name");
+void ThingManager::Invoke(const JsonValue& command) {
+    auto name = command["name"];
     for (auto& thing : things_) {
-        if (thing->name() == name->valuestring) {
+        if (name.Equals(thing->name().c_str())) {
             thing->Invoke(command);
             return;
         }
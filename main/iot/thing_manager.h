@@ -4,13 +4,15 @@
 
 #include "thing.h"
 
-#include <cJSON.h>
-
 #include <vector>
 #include <memory>
 #include <functional>
 #include <map>
 
+// Buffer reserved per thing, enough for a typical descriptor or state
+#define THING_MANAGER_DESCRIPTOR_CAPACITY 512
+#define THING_MANAGER_STATE_CAPACITY 96
+
 namespace iot {
 
 class ThingManager {
@@ -26,7 +28,7 @@ public:
 
     std::string GetDescriptorsJson();
     std::string GetStatesJson();
-    void Invoke(const cJSON* command);
+    void Invoke(const JsonValue& command);
 
 private:
     ThingManager() = default;
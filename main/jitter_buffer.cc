@@ -0,0 +1,182 @@
+#include "jitter_buffer.h"
+
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <cstring>
+#include <cassert>
+#include <algorithm>
+
+#define TAG "JitterBuffer"
+
+JitterBuffer::JitterBuffer(size_t capacity, size_t max_packet_size, int frame_duration_ms)
+    : capacity_(capacity), max_packet_size_(max_packet_size), frame_duration_ms_(frame_duration_ms) {
+#if CONFIG_IDF_TARGET_ESP32S3
+    slab_ = (uint8_t*)heap_caps_malloc(capacity_ * max_packet_size_, MALLOC_CAP_SPIRAM);
+#else
+    slab_ = (uint8_t*)heap_caps_malloc(capacity_ * max_packet_size_, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+#endif
+    sizes_ = (uint16_t*)heap_caps_malloc(capacity_ * sizeof(uint16_t), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    valid_ = (bool*)heap_caps_malloc(capacity_ * sizeof(bool), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    assert(slab_ != nullptr && sizes_ != nullptr && valid_ != nullptr);
+    Reset();
+}
+
+JitterBuffer::~JitterBuffer() {
+    heap_caps_free(slab_);
+    heap_caps_free(sizes_);
+    heap_caps_free(valid_);
+}
+
+void JitterBuffer::Reset() {
+    memset(valid_, 0, capacity_ * sizeof(bool));
+    count_ = 0;
+    started_ = false;
+    prebuffering_ = true;
+    starved_ = false;
+    has_transit_ = false;
+    jitter_ms_ = 0;
+    stats_ = JitterBufferStats();
+    stats_.target_depth = 1;
+}
+
+size_t JitterBuffer::Span() const {
+    if (count_ == 0) {
+        return 0;
+    }
+    return highest_sequence_ - next_sequence_ + 1;
+}
+
+void JitterBuffer::Release(size_t index) {
+    valid_[index] = false;
+    count_--;
+}
+
+void JitterBuffer::UpdateJitter(uint32_t sequence, uint32_t arrival_ms) {
+    // Transit time relative to the fastest packet of the current talk spurt.
+    // The server sends faster than real time, so only lateness counts.
+    int32_t transit = (int32_t)(arrival_ms - sequence * frame_duration_ms_);
+    if (!has_transit_ || transit < min_transit_) {
+        min_transit_ = transit;
+        has_transit_ = true;
+    }
+    int lateness = transit - min_transit_;
+    if (lateness > jitter_ms_) {
+        jitter_ms_ = lateness;
+    } else {
+        jitter_ms_ += (lateness - jitter_ms_) / 16;
+    }
+
+    int target = (jitter_ms_ + frame_duration_ms_ - 1) / frame_duration_ms_ + 1;
+    stats_.jitter_ms = jitter_ms_;
+    stats_.target_depth = std::clamp(target, 1, (int)capacity_ / 2);
+}
+
+bool JitterBuffer::Put(uint32_t sequence, uint32_t arrival_ms, const uint8_t* data, size_t size) {
+    if (size > max_packet_size_) {
+        ESP_LOGW(TAG, "Packet too large: %zu > %zu", size, max_packet_size_);
+        return false;
+    }
+
+    if (count_ == 0 && prebuffering_) {
+        // A new talk spurt starts, measure its jitter from a fresh baseline
+        prebuffer_start_ms_ = arrival_ms;
+        has_transit_ = false;
+    }
+
+    if (sequence == 0) {
+        sequence = started_ ? highest_sequence_ + 1 : 1;
+    } else {
+        UpdateJitter(sequence, arrival_ms);
+    }
+
+    if (!started_) {
+        started_ = true;
+        next_sequence_ = sequence;
+        highest_sequence_ = sequence;
+    }
+
+    int32_t offset = (int32_t)(sequence - next_sequence_);
+    if (offset < 0) {
+        stats_.late++;
+        return false;
+    }
+    if ((size_t)offset >= capacity_) {
+        // Too far ahead, give up everything that does not fit in the window
+        uint32_t new_next = sequence - capacity_ + 1;
+        while (next_sequence_ != new_next) {
+            size_t index = next_sequence_ % capacity_;
+            if (valid_[index]) {
+                Release(index);
+                stats_.overflowed++;
+            }
+            next_sequence_++;
+        }
+    }
+
+    size_t index = sequence % capacity_;
+    if (valid_[index]) {
+        stats_.duplicated++;
+        return false;
+    }
+
+    memcpy(slab_ + index * max_packet_size_, data, size);
+    sizes_[index] = size;
+    valid_[index] = true;
+    if (count_ == 0 || (int32_t)(sequence - highest_sequence_) > 0) {
+        highest_sequence_ = sequence;
+    }
+    count_++;
+    stats_.received++;
+
+    if (starved_) {
+        starved_ = false;
+        stats_.underruns++;
+    }
+    return true;
+}
+
+JitterBufferResult JitterBuffer::Get(uint32_t now_ms, std::vector<uint8_t>& packet) {
+    if (count_ == 0) {
+        if (!prebuffering_) {
+            prebuffering_ = true;
+            starved_ = true;
+        }
+        return kJitterBufferWait;
+    }
+
+    int target = stats_.target_depth;
+    if (prebuffering_) {
+        // Start once the target depth is buffered, or once the first packet
+        // has waited as long as the target depth (the tail of a stream)
+        if (Span() < (size_t)target && now_ms - prebuffer_start_ms_ < (uint32_t)(target * frame_duration_ms_)) {
+            return kJitterBufferWait;
+        }
+        prebuffering_ = false;
+    }
+
+    while (count_ > 0) {
+        size_t index = next_sequence_ % capacity_;
+        if (!valid_[index]) {
+            next_sequence_++;
+            stats_.concealed++;
+            packet.clear();
+            return kJitterBufferLost;
+        }
+
+        // Catch up without time stretching by skipping silence frames
+        if (sizes_[index] <= JITTER_BUFFER_SILENCE_PACKET_SIZE && Span() > (size_t)target + 2) {
+            Release(index);
+            next_sequence_++;
+            stats_.silence_dropped++;
+            continue;
+        }
+
+        auto data = slab_ + index * max_packet_size_;
+        packet.assign(data, data + sizes_[index]);
+        Release(index);
+        next_sequence_++;
+        stats_.played++;
+        return kJitterBufferPacket;
+    }
+    return kJitterBufferWait;
+}
@@ -0,0 +1,79 @@
+#ifndef JITTER_BUFFER_H
+#define JITTER_BUFFER_H
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+// Opus packets at or below this size carry (near) silence, they are the
+// ones dropped when the buffer has to catch up without time stretching.
+#define JITTER_BUFFER_SILENCE_PACKET_SIZE 10
+
+enum JitterBufferResult {
+    kJitterBufferPacket,    // A packet is ready to decode
+    kJitterBufferLost,      // The next packet is missing, run packet loss concealment
+    kJitterBufferWait       // Nothing to play yet
+};
+
+struct JitterBufferStats {
+    uint32_t received = 0;
+    uint32_t played = 0;
+    uint32_t late = 0;
+    uint32_t duplicated = 0;
+    uint32_t concealed = 0;
+    uint32_t underruns = 0;
+    uint32_t overflowed = 0;
+    uint32_t silence_dropped = 0;
+    int jitter_ms = 0;
+    int target_depth = 0;
+};
+
+// Reorders incoming packets by sequence number and releases them at the
+// pace of the playout clock. The target depth follows the measured arrival
+// jitter. Not thread safe, it is owned by the main loop.
+class JitterBuffer {
+public:
+    JitterBuffer(size_t capacity, size_t max_packet_size, int frame_duration_ms);
+    ~JitterBuffer();
+    JitterBuffer(const JitterBuffer&) = delete;
+    JitterBuffer& operator=(const JitterBuffer&) = delete;
+
+    void Reset();
+    // A sequence number of 0 means the packet is played in arrival order
+    bool Put(uint32_t sequence, uint32_t arrival_ms, const uint8_t* data, size_t size);
+    JitterBufferResult Get(uint32_t now_ms, std::vector<uint8_t>& packet);
+
+    bool empty() const { return count_ == 0; }
+    bool full() const { return count_ >= capacity_; }
+    size_t depth() const { return count_; }
+    int latency_ms() const { return stats_.target_depth * frame_duration_ms_; }
+    const JitterBufferStats& stats() const { return stats_; }
+
+private:
+    const size_t capacity_;
+    const size_t max_packet_size_;
+    const int frame_duration_ms_;
+    uint8_t* slab_ = nullptr;
+    uint16_t* sizes_ = nullptr;
+    bool* valid_ = nullptr;
+
+    bool started_ = false;
+    bool prebuffering_ = true;
+    bool starved_ = false;
+    uint32_t prebuffer_start_ms_ = 0;
+    uint32_t next_sequence_ = 0;
+    uint32_t highest_sequence_ = 0;
+    size_t count_ = 0;
+
+    bool has_transit_ = false;
+    int32_t min_transit_ = 0;
+    int jitter_ms_ = 0;
+
+    JitterBufferStats stats_;
+
+    void UpdateJitter(uint32_t sequence, uint32_t arrival_ms);
+    size_t Span() const;
+    void Release(size_t index);
+};
+
+#endif // JITTER_BUFFER_H
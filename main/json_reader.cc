@@ -0,0 +1,473 @@
+#include "json_reader.h"
+
+#include <cstring>
+#include <cstdlib>
+
+enum ParseState {
+    kParseValue,
+    kParseKey,
+    kParseColon,
+    kParseCommaOrEnd,
+    kParseDone
+};
+
+static inline bool IsWhitespace(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+static inline bool IsDelimiter(char c) {
+    return IsWhitespace(c) || c == ',' || c == ']' || c == '}';
+}
+
+static inline bool IsDigit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+// -?(0|[1-9][0-9]*)(\.[0-9]+)?([eE][+-]?[0-9]+)?
+static bool IsNumber(const char* text, size_t length) {
+    size_t i = 0;
+    if (i < length && text[i] == '-') {
+        i++;
+    }
+    if (i < length && text[i] == '0') {
+        i++;
+    } else if (i < length && IsDigit(text[i])) {
+        while (i < length && IsDigit(text[i])) {
+            i++;
+        }
+    } else {
+        return false;
+    }
+    if (i < length && text[i] == '.') {
+        size_t digits = ++i;
+        while (i < length && IsDigit(text[i])) {
+            i++;
+        }
+        if (i == digits) {
+            return false;
+        }
+    }
+    if (i < length && (text[i] == 'e' || text[i] == 'E')) {
+        i++;
+        if (i < length && (text[i] == '+' || text[i] == '-')) {
+            i++;
+        }
+        size_t digits = i;
+        while (i < length && IsDigit(text[i])) {
+            i++;
+        }
+        if (i == digits) {
+            return false;
+        }
+    }
+    return i == length;
+}
+
+static inline int HexValue(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
+}
+
+int JsonReader::AddToken(JsonTokenType type, int parent, size_t start, size_t length) {
+    if (count_ == JSON_READER_MAX_TOKENS) {
+        error_ = "too many tokens";
+        return -1;
+    }
+    int index = count_++;
+    auto& token = tokens_[index];
+    token.type = type;
+    token.parent = parent;
+    token.size = 0;
+    token.next = index + 1;
+    token.start = start;
+    token.length = length;
+    // Keys count as the members of an object, values as the elements of an array
+    if (parent >= 0 && tokens_[parent].type != kJsonTokenKey) {
+        tokens_[parent].size++;
+    }
+    return index;
+}
+
+// Closes a value and returns the container that holds it, -1 for the root
+int JsonReader::FinishValue(int index) {
+    tokens_[index].next = count_;
+    int parent = tokens_[index].parent;
+    if (parent >= 0 && tokens_[parent].type == kJsonTokenKey) {
+        tokens_[parent].next = count_;
+        parent = tokens_[parent].parent;
+    }
+    return parent;
+}
+
+bool JsonReader::ScanString(size_t& pos, size_t length) {
+    // pos is just after the opening quote
+    while (pos < length) {
+        unsigned char c = data_[pos];
+        if (c == '"') {
+            return true;
+        }
+        if (c < 0x20) {
+            error_ = "control character in string";
+            return false;
+        }
+        if (c == '\\') {
+            if (++pos >= length) {
+                break;
+            }
+            switch (data_[pos]) {
+                case '"': case '\\': case '/': case 'b': case 'f': case 'n': case 'r': case 't':
+                    break;
+                case 'u':
+                    if (pos + 4 >= length) {
+                        error_ = "truncated escape";
+                        return false;
+                    }
+                    for (int i = 1; i <= 4; i++) {
+                        if (HexValue(data_[pos + i]) < 0) {
+                            error_ = "invalid escape";
+                            return false;
+                        }
+                    }
+                    pos += 4;
+                    break;
+                default:
+                    error_ = "invalid escape";
+                    return false;
+            }
+        }
+        pos++;
+    }
+    error_ = "unterminated string";
+    return false;
+}
+
+bool JsonReader::ScanPrimitive(size_t& pos, size_t length, JsonTokenType& type) {
+    size_t start = pos;
+    while (pos < length && !IsDelimiter(data_[pos])) {
+        pos++;
+    }
+    const char* text = data_ + start;
+    size_t text_length = pos - start;
+    if (text_length == 4 && memcmp(text, "true", 4) == 0) {
+        type = kJsonTokenTrue;
+        return true;
+    }
+    if (text_length == 5 && memcmp(text, "false", 5) == 0) {
+        type = kJsonTokenFalse;
+        return true;
+    }
+    if (text_length == 4 && memcmp(text, "null", 4) == 0) {
+        type = kJsonTokenNull;
+        return true;
+    }
+
+    if (!IsNumber(text, text_length)) {
+        error_ = "invalid value";
+        return false;
+    }
+    type = kJsonTokenNumber;
+    return true;
+}
+
+bool JsonReader::Parse(const char* data, size_t length) {
+    data_ = data;
+    count_ = 0;
+    error_ = nullptr;
+
+    ParseState state = kParseValue;
+    // An empty container may be closed right after it is opened
+    bool allow_close = false;
+    int current = -1;
+    size_t pos = 0;
+
+    while (pos < length) {
+        char c = data_[pos];
+        if (IsWhitespace(c)) {
+            pos++;
+            continue;
+        }
+        if (state == kParseDone) {
+            error_ = "trailing characters";
+            return false;
+        }
+
+        switch (c) {
+            case '{':
+            case '[': {
+                if (state != kParseValue) {
+                    error_ = "unexpected container";
+                    return false;
+                }
+                current = AddToken(c == '{' ? kJsonTokenObject : kJsonTokenArray, current, pos, 0);
+                if (current < 0) {
+                    return false;
+                }
+                state = c == '{' ? kParseKey : kParseValue;
+                allow_close = true;
+                pos++;
+                break;
+            }
+            case '}':
+            case ']': {
+                JsonTokenType type = c == '}' ? kJsonTokenObject : kJsonTokenArray;
+                bool can_close = state == kParseCommaOrEnd ||
+                    (allow_close && (state == kParseKey || state == kParseValue));
+                if (current < 0 || tokens_[current].type != type || !can_close) {
+                    error_ = "unexpected close";
+                    return false;
+                }
+                tokens_[current].length = pos + 1 - tokens_[current].start;
+                current = FinishValue(current);
+                state = current < 0 ? kParseDone : kParseCommaOrEnd;
+                allow_close = false;
+                pos++;
+                break;
+            }
+            case '"': {
+                if (state != kParseKey && state != kParseValue) {
+                    error_ = "unexpected string";
+                    return false;
+                }
+                size_t start = ++pos;
+                if (!ScanString(pos, length)) {
+                    return false;
+                }
+                int index = AddToken(state == kParseKey ? kJsonTokenKey : kJsonTokenString, current, start, pos - start);
+                if (index < 0) {
+                    return false;
+                }
+                if (state == kParseKey) {
+                    current = index;
+                    state = kParseColon;
+                } else {
+                    current = FinishValue(index);
+                    state = current < 0 ? kParseDone : kParseCommaOrEnd;
+                }
+                allow_close = false;
+                pos++;
+                break;
+            }
+            case ':':
+                if (state != kParseColon) {
+                    error_ = "unexpected colon";
+                    return false;
+                }
+                state = kParseValue;
+                pos++;
+                break;
+            case ',':
+                if (state != kParseCommaOrEnd) {
+                    error_ = "unexpected comma";
+                    return false;
+                }
+                state = tokens_[current].type == kJsonTokenObject ? kParseKey : kParseValue;
+                pos++;
+                break;
+            default: {
+                if (state != kParseValue) {
+                    error_ = "unexpected value";
+                    return false;
+                }
+                size_t start = pos;
+                JsonTokenType type;
+                if (!ScanPrimitive(pos, length, type)) {
+                    return false;
+                }
+                int index = AddToken(type, current, start, pos - start);
+                if (index < 0) {
+                    return false;
+                }
+                current = FinishValue(index);
+                state = current < 0 ? kParseDone : kParseCommaOrEnd;
+                allow_close = false;
+                break;
+            }
+        }
+    }
+
+    if (state != kParseDone) {
+        error_ = "unexpected end";
+        return false;
+    }
+    return true;
+}
+
+JsonValue JsonReader::root() const {
+    if (count_ == 0 || error_ != nullptr) {
+        return JsonValue();
+    }
+    return JsonValue(this, 0);
+}
+
+const JsonToken& JsonValue::token() const {
+    return reader_->tokens_[index_];
+}
+
+bool JsonValue::Is(JsonTokenType type) const {
+    return reader_ != nullptr && token().type == type;
+}
+
+size_t JsonValue::size() const {
+    if (!IsObject() && !IsArray()) {
+        return 0;
+    }
+    return token().size;
+}
+
+const char* JsonValue::data() const {
+    if (reader_ == nullptr) {
+        return "";
+    }
+    return reader_->data_ + token().start;
+}
+
+size_t JsonValue::length() const {
+    if (reader_ == nullptr) {
+        return 0;
+    }
+    return token().length;
+}
+
+JsonValue JsonValue::operator[](const char* key) const {
+    if (!IsObject()) {
+        return JsonValue();
+    }
+    size_t key_length = strlen(key);
+    int index = index_ + 1;
+    for (size_t i = 0; i < token().size; i++) {
+        auto& member = reader_->tokens_[index];
+        if (member.length == key_length && memcmp(reader_->data_ + member.start, key, key_length) == 0) {
+            return JsonValue(reader_, index + 1);
+        }
+        index = member.next;
+    }
+    return JsonValue();
+}
+
+JsonValue JsonValue::operator[](size_t position) const {
+    if (!IsArray() || position >= token().size) {
+        return JsonValue();
+    }
+    int index = index_ + 1;
+    for (size_t i = 0; i < position; i++) {
+        index = reader_->tokens_[index].next;
+    }
+    return JsonValue(reader_, index);
+}
+
+bool JsonValue::Equals(const char* text) const {
+    if (!IsString()) {
+        return false;
+    }
+    size_t text_length = strlen(text);
+    return token().length == text_length && memcmp(data(), text, text_length) == 0;
+}
+
+int JsonValue::ToInt(int default_value) const {
+    if (!IsNumber()) {
+        return default_value;
+    }
+    // The token is not null terminated
+    char text[32];
+    size_t text_length = token().length;
+    if (text_length >= sizeof(text)) {
+        return default_value;
+    }
+    memcpy(text, data(), text_length);
+    text[text_length] = '\0';
+    char* end = nullptr;
+    double value = strtod(text, &end);
+    if (end != text + text_length) {
+        return default_value;
+    }
+    return (int)value;
+}
+
+bool JsonValue::ToBool(bool default_value) const {
+    if (Is(kJsonTokenTrue)) {
+        return true;
+    }
+    if (Is(kJsonTokenFalse)) {
+        return false;
+    }
+    if (IsNumber()) {
+        return ToInt() != 0;
+    }
+    return default_value;
+}
+
+static void AppendUtf8(std::string& out, uint32_t code_point) {
+    if (code_point < 0x80) {
+        out.push_back(code_point);
+    } else if (code_point < 0x800) {
+        out.push_back(0xC0 | (code_point >> 6));
+        out.push_back(0x80 | (code_point & 0x3F));
+    } else if (code_point < 0x10000) {
+        out.push_back(0xE0 | (code_point >> 12));
+        out.push_back(0x80 | ((code_point >> 6) & 0x3F));
+        out.push_back(0x80 | (code_point & 0x3F));
+    } else {
+        out.push_back(0xF0 | (code_point >> 18));
+        out.push_back(0x80 | ((code_point >> 12) & 0x3F));
+        out.push_back(0x80 | ((code_point >> 6) & 0x3F));
+        out.push_back(0x80 | (code_point & 0x3F));
+    }
+}
+
+static uint32_t ReadHex4(const char* text) {
+    return (HexValue(text[0]) << 12) | (HexValue(text[1]) << 8) | (HexValue(text[2]) << 4) | HexValue(text[3]);
+}
+
+std::string JsonValue::ToString() const {
+    std::string out;
+    if (!IsString()) {
+        return out;
+    }
+    // Escapes were validated by the tokenizer
+    const char* text = data();
+    size_t text_length = token().length;
+    out.reserve(text_length);
+    for (size_t i = 0; i < text_length; i++) {
+        char c = text[i];
+        if (c != '\\') {
+            out.push_back(c);
+            continue;
+        }
+        c = text[++i];
+        switch (c) {
+            case 'b': out.push_back('\b'); break;
+            case 'f': out.push_back('\f'); break;
+            case 'n': out.push_back('\n'); break;
+            case 'r': out.push_back('\r'); break;
+            case 't': out.push_back('\t'); break;
+            case 'u': {
+                uint32_t code_point = ReadHex4(text + i + 1);
+                i += 4;
+                // Join a surrogate pair, a lone surrogate becomes U+FFFD
+                if (code_point >= 0xD800 && code_point <= 0xDBFF) {
+                    if (i + 6 < text_length && text[i + 1] == '\\' && text[i + 2] == 'u') {
+                        uint32_t low = ReadHex4(text + i + 3);
+                        if (low >= 0xDC00 && low <= 0xDFFF) {
+                            code_point = 0x10000 + ((code_point - 0xD800) << 10) + (low - 0xDC00);
+                            i += 6;
+                        } else {
+                            code_point = 0xFFFD;
+                        }
+                    } else {
+                        code_point = 0xFFFD;
+                    }
+                } else if (code_point >= 0xDC00 && code_point <= 0xDFFF) {
+                    code_point = 0xFFFD;
+                }
+                AppendUtf8(out, code_point);
+                break;
+            }
+            default:
+                out.push_back(c);
+                break;
+        }
+    }
+    return out;
+}
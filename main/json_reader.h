@@ -0,0 +1,98 @@
+#ifndef JSON_READER_H
+#define JSON_READER_H
+
+#include <string>
+#include <cstddef>
+#include <cstdint>
+
+// Enough for any control message the server sends
+#define JSON_READER_MAX_TOKENS 128
+
+enum JsonTokenType {
+    kJsonTokenObject,
+    kJsonTokenArray,
+    kJsonTokenKey,
+    kJsonTokenString,
+    kJsonTokenNumber,
+    kJsonTokenTrue,
+    kJsonTokenFalse,
+    kJsonTokenNull
+};
+
+// Strings point into the parsed text, without the quotes and still escaped
+struct JsonToken {
+    uint8_t type;
+    int16_t parent;
+    uint16_t size;      // Members of an object, elements of an array
+    uint16_t next;      // Index of the token after this subtree
+    uint32_t start;
+    uint32_t length;
+};
+
+class JsonReader;
+
+// A view of one value in a JsonReader. A missing member gives an invalid
+// value, so lookups can be chained and checked once at the end.
+class JsonValue {
+public:
+    JsonValue() = default;
+    JsonValue(const JsonReader* reader, int index) : reader_(reader), index_(index) {}
+
+    bool IsValid() const { return reader_ != nullptr; }
+    bool IsObject() const { return Is(kJsonTokenObject); }
+    bool IsArray() const { return Is(kJsonTokenArray); }
+    bool IsString() const { return Is(kJsonTokenString); }
+    bool IsNumber() const { return Is(kJsonTokenNumber); }
+    bool IsBool() const { return Is(kJsonTokenTrue) || Is(kJsonTokenFalse); }
+    bool IsNull() const { return Is(kJsonTokenNull); }
+
+    size_t size() const;
+    JsonValue operator[](const char* key) const;
+    JsonValue operator[](size_t index) const;
+    // A literal 0 would be ambiguous between the two above
+    JsonValue operator[](int index) const { return index < 0 ? JsonValue() : (*this)[(size_t)index]; }
+
+    // Compares the raw text of a string, escape sequences are not decoded
+    bool Equals(const char* text) const;
+    int ToInt(int default_value = 0) const;
+    bool ToBool(bool default_value = false) const;
+    // Decodes escape sequences, including \u escapes, into UTF-8
+    std::string ToString() const;
+
+    const char* data() const;
+    size_t length() const;
+
+private:
+    const JsonReader* reader_ = nullptr;
+    int index_ = 0;
+
+    bool Is(JsonTokenType type) const;
+    const JsonToken& token() const;
+};
+
+// Tokenizes a JSON document into a fixed token array, nothing is allocated
+// and the text is not copied. The text must outlive the values read from it.
+class JsonReader {
+public:
+    bool Parse(const char* data, size_t length);
+    bool Parse(const std::string& text) { return Parse(text.data(), text.size()); }
+
+    JsonValue root() const;
+    const char* error() const { return error_; }
+    size_t token_count() const { return count_; }
+
+private:
+    friend class JsonValue;
+
+    JsonToken tokens_[JSON_READER_MAX_TOKENS];
+    size_t count_ = 0;
+    const char* data_ = nullptr;
+    const char* error_ = nullptr;
+
+    int AddToken(JsonTokenType type, int parent, size_t start, size_t length);
+    int FinishValue(int index);
+    bool ScanString(size_t& pos, size_t length);
+    bool ScanPrimitive(size_t& pos, size_t length, JsonTokenType& type);
+};
+
+#endif // JSON_READER_H
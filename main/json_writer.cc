@@ -0,0 +1,173 @@
+#include "json_writer.h"
+
+#include <cstdio>
+#include <cstring>
+#include <cassert>
+
+static const char hex_chars[] = "0123456789abcdef";
+
+JsonWriter::JsonWriter(size_t capacity) : capacity_(capacity) {
+    buffer_.reserve(capacity_);
+}
+
+void JsonWriter::Clear() {
+    buffer_.clear();
+    if (buffer_.capacity() < capacity_) {
+        buffer_.reserve(capacity_);
+    }
+    has_items_ = 0;
+    depth_ = 0;
+    after_key_ = false;
+}
+
+void JsonWriter::Append(const char* data, size_t length) {
+    if (buffer_.size() + length > buffer_.capacity()) {
+        grow_count_++;
+    }
+    buffer_.append(data, length);
+}
+
+void JsonWriter::Append(char c) {
+    if (buffer_.size() == buffer_.capacity()) {
+        grow_count_++;
+    }
+    buffer_.push_back(c);
+}
+
+// Values inside a container are separated by commas, except right after a key
+void JsonWriter::BeginValue() {
+    if (after_key_) {
+        after_key_ = false;
+        return;
+    }
+    if (depth_ > 0) {
+        uint32_t bit = 1u << (depth_ - 1);
+        if (has_items_ & bit) {
+            Append(',');
+        }
+        has_items_ |= bit;
+    }
+}
+
+void JsonWriter::Begin(char bracket) {
+    BeginValue();
+    assert(depth_ < JSON_WRITER_MAX_DEPTH);
+    Append(bracket);
+    depth_++;
+    has_items_ &= ~(1u << (depth_ - 1));
+}
+
+void JsonWriter::End(char bracket) {
+    assert(depth_ > 0 && !after_key_);
+    depth_--;
+    Append(bracket);
+}
+
+JsonWriter& JsonWriter::BeginObject() {
+    Begin('{');
+    return *this;
+}
+
+JsonWriter& JsonWriter::EndObject() {
+    End('}');
+    return *this;
+}
+
+JsonWriter& JsonWriter::BeginArray() {
+    Begin('[');
+    return *this;
+}
+
+JsonWriter& JsonWriter::EndArray() {
+    End(']');
+    return *this;
+}
+
+JsonWriter& JsonWriter::Key(const char* key) {
+    BeginValue();
+    Append('"');
+    AppendEscaped(key, strlen(key));
+    Append("\":", 2);
+    after_key_ = true;
+    return *this;
+}
+
+JsonWriter& JsonWriter::String(const char* value, size_t length) {
+    BeginValue();
+    Append('"');
+    AppendEscaped(value, length);
+    Append('"');
+    return *this;
+}
+
+JsonWriter& JsonWriter::String(const char* value) {
+    if (value == nullptr) {
+        return Null();
+    }
+    return String(value, strlen(value));
+}
+
+JsonWriter& JsonWriter::Number(int64_t value) {
+    BeginValue();
+    char text[24];
+    int length = snprintf(text, sizeof(text), "%lld", (long long)value);
+    Append(text, length);
+    return *this;
+}
+
+JsonWriter& JsonWriter::Bool(bool value) {
+    BeginValue();
+    if (value) {
+        Append("true", 4);
+    } else {
+        Append("false", 5);
+    }
+    return *this;
+}
+
+JsonWriter& JsonWriter::Null() {
+    BeginValue();
+    Append("null", 4);
+    return *this;
+}
+
+JsonWriter& JsonWriter::Raw(const std::string& json) {
+    BeginValue();
+    Append(json.data(), json.size());
+    return *this;
+}
+
+// Copies runs of plain characters in one go, UTF-8 passes through untouched
+void JsonWriter::AppendEscaped(const char* value, size_t length) {
+    size_t start = 0;
+    for (size_t i = 0; i < length; i++) {
+        unsigned char c = value[i];
+        if (c >= 0x20 && c != '"' && c != '\\') {
+            continue;
+        }
+        Append(value + start, i - start);
+        start = i + 1;
+
+        char escaped[6] = { '\\', 0 };
+        size_t escaped_length = 2;
+        switch (c) {
+            case '"': escaped[1] = '"'; break;
+            case '\\': escaped[1] = '\\'; break;
+            case '\b': escaped[1] = 'b'; break;
+            case '\f': escaped[1] = 'f'; break;
+            case '\n': escaped[1] = 'n'; break;
+            case '\r': escaped[1] = 'r'; break;
+            case '\t': escaped[1] = 't'; break;
+            default:
+                escaped[1] = 'u';
+                escaped[2] = '0';
+                escaped[3] = '0';
+                escaped[4] = hex_chars[c >> 4];
+                escaped[5] = hex_chars[c & 0x0F];
+                escaped_length = 6;
+                break;
+        }
+        Append(escaped, escaped_length);
+    }
+    Append(value + start, length - start);
+}
@@ -0,0 +1,60 @@
+#ifndef JSON_WRITER_H
+#define JSON_WRITER_H
+
+#include <string>
+#include <cstddef>
+#include <cstdint>
+
+#define JSON_WRITER_DEFAULT_CAPACITY 256
+// Nesting is tracked in a bitmask, one bit per level
+#define JSON_WRITER_MAX_DEPTH 32
+
+// Streams JSON into a single buffer reserved up front. The writer inserts
+// the commas and escapes strings, callers only describe the structure:
+//
+//   JsonWriter writer;
+//   writer.BeginObject().Key("type").String("listen").EndObject();
+class JsonWriter {
+public:
+    explicit JsonWriter(size_t capacity = JSON_WRITER_DEFAULT_CAPACITY);
+
+    JsonWriter& BeginObject();
+    JsonWriter& EndObject();
+    JsonWriter& BeginArray();
+    JsonWriter& EndArray();
+
+    JsonWriter& Key(const char* key);
+    JsonWriter& Key(const std::string& key) { return Key(key.c_str()); }
+    JsonWriter& String(const char* value, size_t length);
+    JsonWriter& String(const char* value);
+    JsonWriter& String(const std::string& value) { return String(value.data(), value.size()); }
+    JsonWriter& Number(int64_t value);
+    JsonWriter& Bool(bool value);
+    JsonWriter& Null();
+    // Appends an already serialized value as is
+    JsonWriter& Raw(const std::string& json);
+
+    const std::string& str() const { return buffer_; }
+    std::string TakeString() { return std::move(buffer_); }
+    size_t size() const { return buffer_.size(); }
+    // Number of times the buffer outgrew its reserved capacity
+    uint32_t grow_count() const { return grow_count_; }
+    void Clear();
+
+private:
+    std::string buffer_;
+    size_t capacity_;
+    uint32_t grow_count_ = 0;
+    uint32_t has_items_ = 0;
+    int depth_ = 0;
+    bool after_key_ = false;
+
+    void BeginValue();
+    void Begin(char bracket);
+    void End(char bracket);
+    void Append(const char* data, size_t length);
+    void Append(char c);
+    void AppendEscaped(const char* value, size_t length);
+};
+
+#endif // JSON_WRITER_H
@@ -0,0 +1,46 @@
+#include "main_message_queue.h"
+
+#include <esp_log.h>
+
+#define TAG "MainMessageQueue"
+
+MainMessageQueue::MainMessageQueue(size_t capacity)
+    : slots_(new MainMessage[capacity]), capacity_(capacity) {
+}
+
+void MainMessageQueue::Push(MainMessage&& message) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    pushed_count_++;
+    // Keep the order, once something overflowed the rest follows it
+    if (count_ == capacity_ || !overflow_.empty()) {
+        if (overflowed_count_++ % 10 == 0) {
+            ESP_LOGW(TAG, "Queue full, %zu messages waiting", count_ + overflow_.size());
+        }
+        overflow_.emplace_back(std::move(message));
+        return;
+    }
+
+    slots_[(head_ + count_) % capacity_] = std::move(message);
+    count_++;
+    if (count_ > high_watermark_) {
+        high_watermark_ = count_;
+    }
+}
+
+bool MainMessageQueue::Pop(MainMessage& message) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (count_ == 0) {
+        return false;
+    }
+
+    message = std::move(slots_[head_]);
+    head_ = (head_ + 1) % capacity_;
+    count_--;
+    // Refill the ring from the overflow list in order
+    if (!overflow_.empty()) {
+        slots_[(head_ + count_) % capacity_] = std::move(overflow_.front());
+        overflow_.pop_front();
+        count_++;
+    }
+    return true;
+}
@@ -0,0 +1,56 @@
+#ifndef MAIN_MESSAGE_QUEUE_H
+#define MAIN_MESSAGE_QUEUE_H
+
+#include <mutex>
+#include <list>
+#include <memory>
+#include <cstddef>
+#include <cstdint>
+
+#include "inplace_function.h"
+
+// Bytes available for the captures of a callback run on the main loop
+#define MAIN_MESSAGE_CALLBACK_SIZE 32
+
+enum MainMessageType {
+    kMainMessageCallback,   // Run callback on the main loop
+    kMainMessageChatState   // Switch to chat_state
+};
+
+struct MainMessage {
+    MainMessageType type = kMainMessageCallback;
+    int chat_state = 0;
+    InplaceFunction<MAIN_MESSAGE_CALLBACK_SIZE> callback;
+};
+
+// Multi-producer queue of messages for the main loop. The slots are
+// allocated once, messages posted while it is full go to an overflow list
+// so nothing is lost, at the cost of an allocation.
+class MainMessageQueue {
+public:
+    MainMessageQueue(size_t capacity);
+    MainMessageQueue(const MainMessageQueue&) = delete;
+    MainMessageQueue& operator=(const MainMessageQueue&) = delete;
+
+    void Push(MainMessage&& message);
+    bool Pop(MainMessage& message);
+
+    uint32_t pushed_count() const { return pushed_count_; }
+    uint32_t overflowed_count() const { return overflowed_count_; }
+    size_t high_watermark() const { return high_watermark_; }
+    size_t capacity() const { return capacity_; }
+
+private:
+    std::mutex mutex_;
+    std::unique_ptr<MainMessage[]> slots_;
+    const size_t capacity_;
+    size_t head_ = 0;
+    size_t count_ = 0;
+    std::list<MainMessage> overflow_;
+
+    uint32_t pushed_count_ = 0;
+    uint32_t overflowed_count_ = 0;
+    size_t high_watermark_ = 0;
+};
+
+#endif // MAIN_MESSAGE_QUEUE_H
@@ -0,0 +1,110 @@
+#include "opus_packet_queue.h"
+
+#include <freertos/task.h>
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <cstring>
+#include <cassert>
+
+#define TAG "OpusPacketQueue"
+
+OpusPacketQueue::OpusPacketQueue(size_t capacity, size_t max_packet_size, PacketQueueFullPolicy policy)
+    : capacity_(capacity), max_packet_size_(max_packet_size), policy_(policy) {
+    assert(max_packet_size_ <= UINT16_MAX);
+#if CONFIG_IDF_TARGET_ESP32S3
+    slab_ = (uint8_t*)heap_caps_malloc(capacity_ * max_packet_size_, MALLOC_CAP_SPIRAM);
+#else
+    slab_ = (uint8_t*)heap_caps_malloc(capacity_ * max_packet_size_, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+#endif
+    sizes_ = (uint16_t*)heap_caps_malloc(capacity_ * sizeof(uint16_t), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    infos_ = (OpusPacketInfo*)heap_caps_malloc(capacity_ * sizeof(OpusPacketInfo), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    space_available_ = xSemaphoreCreateBinary();
+    assert(slab_ != nullptr && sizes_ != nullptr && infos_ != nullptr && space_available_ != nullptr);
+}
+
+OpusPacketQueue::~OpusPacketQueue() {
+    heap_caps_free(slab_);
+    heap_caps_free(sizes_);
+    heap_caps_free(infos_);
+    vSemaphoreDelete(space_available_);
+}
+
+size_t OpusPacketQueue::size() const {
+    return head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_acquire);
+}
+
+bool OpusPacketQueue::Push(const uint8_t* data, size_t size, const OpusPacketInfo& info) {
+    if (size > max_packet_size_) {
+        oversized_count_.fetch_add(1, std::memory_order_relaxed);
+        ESP_LOGW(TAG, "Packet too large: %zu > %zu", size, max_packet_size_);
+        return false;
+    }
+
+    uint32_t head = head_.load(std::memory_order_relaxed);
+    uint32_t tail = tail_.load(std::memory_order_acquire);
+    if (head - tail >= capacity_) {
+        if (policy_ == kPacketQueueDropNewest) {
+            dropped_count_.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        // Take the oldest slot away from the consumer. If the CAS fails the
+        // consumer has just released a slot, so there is room anyway.
+        if (tail_.compare_exchange_strong(tail, tail + 1, std::memory_order_acq_rel)) {
+            dropped_count_.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    memcpy(SlotData(head), data, size);
+    sizes_[head % capacity_] = size;
+    infos_[head % capacity_] = info;
+    head_.store(head + 1, std::memory_order_release);
+    pushed_count_.fetch_add(1, std::memory_order_relaxed);
+
+    size_t occupancy = head + 1 - tail_.load(std::memory_order_relaxed);
+    if (occupancy > high_watermark_.load(std::memory_order_relaxed)) {
+        high_watermark_.store(occupancy, std::memory_order_relaxed);
+    }
+    return true;
+}
+
+bool OpusPacketQueue::WaitForSpace(TickType_t timeout) {
+    TickType_t start = xTaskGetTickCount();
+    while (size() >= capacity_) {
+        TickType_t elapsed = xTaskGetTickCount() - start;
+        if (elapsed >= timeout) {
+            return false;
+        }
+        xSemaphoreTake(space_available_, timeout - elapsed);
+    }
+    return true;
+}
+
+bool OpusPacketQueue::Pop(std::vector<uint8_t>& packet, OpusPacketInfo* info) {
+    while (true) {
+        uint32_t tail = tail_.load(std::memory_order_acquire);
+        uint32_t head = head_.load(std::memory_order_acquire);
+        if (tail == head) {
+            return false;
+        }
+
+        auto data = SlotData(tail);
+        packet.assign(data, data + sizes_[tail % capacity_]);
+        if (info != nullptr) {
+            *info = infos_[tail % capacity_];
+        }
+        // If the producer dropped this slot while we were copying it, the
+        // copy may be torn, discard it and read the next one.
+        if (tail_.compare_exchange_strong(tail, tail + 1, std::memory_order_acq_rel)) {
+            popped_count_.fetch_add(1, std::memory_order_relaxed);
+            xSemaphoreGive(space_available_);
+            return true;
+        }
+    }
+}
+
+void OpusPacketQueue::Clear() {
+    uint32_t tail = tail_.load(std::memory_order_acquire);
+    while (!tail_.compare_exchange_weak(tail, head_.load(std::memory_order_acquire), std::memory_order_acq_rel)) {
+    }
+    xSemaphoreGive(space_available_);
+}
@@ -0,0 +1,82 @@
+#ifndef OPUS_PACKET_QUEUE_H
+#define OPUS_PACKET_QUEUE_H
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
+#include <atomic>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+struct OpusPacketInfo {
+    uint32_t sequence = 0;  // 0 means the packet carries no sequence number
+    uint32_t timestamp = 0; // Arrival time in milliseconds
+    uint32_t epoch = 0;     // Owner defined, lets the consumer skip stale packets
+};
+
+enum PacketQueueFullPolicy {
+    kPacketQueueDropOldest,
+    kPacketQueueDropNewest
+};
+
+// Fixed capacity single-producer / single-consumer ring of packet slots.
+// The slab is allocated once in the constructor, Push() and Pop() never
+// touch the heap and never take a lock. A producer that must not lose
+// packets waits for room with WaitForSpace() before pushing.
+class OpusPacketQueue {
+public:
+    OpusPacketQueue(size_t capacity, size_t max_packet_size, PacketQueueFullPolicy policy = kPacketQueueDropOldest);
+    ~OpusPacketQueue();
+    OpusPacketQueue(const OpusPacketQueue&) = delete;
+    OpusPacketQueue& operator=(const OpusPacketQueue&) = delete;
+
+    // Producer side
+    bool Push(const uint8_t* data, size_t size, const OpusPacketInfo& info = {});
+    bool Push(const std::vector<uint8_t>& packet, const OpusPacketInfo& info = {}) {
+        return Push(packet.data(), packet.size(), info);
+    }
+
+    // Blocks until a slot is free or the timeout expires, the consumer
+    // wakes the producer up from Pop() and Clear()
+    bool WaitForSpace(TickType_t timeout);
+
+    // Consumer side
+    bool Pop(std::vector<uint8_t>& packet, OpusPacketInfo* info = nullptr);
+    void Clear();
+
+    size_t size() const;
+    bool empty() const { return size() == 0; }
+    size_t capacity() const { return capacity_; }
+    size_t max_packet_size() const { return max_packet_size_; }
+    size_t high_watermark() const { return high_watermark_.load(std::memory_order_relaxed); }
+    uint32_t pushed_count() const { return pushed_count_.load(std::memory_order_relaxed); }
+    uint32_t popped_count() const { return popped_count_.load(std::memory_order_relaxed); }
+    uint32_t dropped_count() const { return dropped_count_.load(std::memory_order_relaxed); }
+    uint32_t oversized_count() const { return oversized_count_.load(std::memory_order_relaxed); }
+
+private:
+    const size_t capacity_;
+    const size_t max_packet_size_;
+    const PacketQueueFullPolicy policy_;
+    uint8_t* slab_ = nullptr;
+    uint16_t* sizes_ = nullptr;
+    OpusPacketInfo* infos_ = nullptr;
+    SemaphoreHandle_t space_available_ = nullptr;
+
+    // Free running counters, the slot index is counter % capacity_
+    std::atomic<uint32_t> head_{0};
+    std::atomic<uint32_t> tail_{0};
+
+    std::atomic<size_t> high_watermark_{0};
+    std::atomic<uint32_t> pushed_count_{0};
+    std::atomic<uint32_t> popped_count_{0};
+    std::atomic<uint32_t> dropped_count_{0};
+    std::atomic<uint32_t> oversized_count_{0};
+
+    inline uint8_t* SlotData(uint32_t index) const {
+        return slab_ + (index % capacity_) * max_packet_size_;
+    }
+};
+
+#endif // OPUS_PACKET_QUEUE_H
@@ -2,6 +2,9 @@
 #include "system_info.h"
 #include "board.h"
 #include "settings.h"
+#include "ota_flash_writer.h"
+#include "ota_patch.h"
+#include "ota_decompressor.h"
 
 #include <cJSON.h>
 #include <esp_log.h>
@@ -13,9 +16,15 @@
 #include <vector>
 #include <sstream>
 #include <algorithm>
+#include <memory>
 
 #define TAG "Ota"
 
+#define OTA_READ_SIZE 4096
+#define OTA_MAX_RETRIES 5
+// Resume point is saved to NVS at most this often
+#define OTA_SAVE_INTERVAL (64 * 1024)
+
 
 Ota::Ota() {
 }
@@ -44,24 +53,29 @@ bool Ota::CheckVersion() {
         return false;
     }
 
-    auto http = Board::GetInstance().CreateHttp();
+    auto& board = Board::GetInstance();
+    auto http = board.CreateHttp();
     for (const auto& header : headers_) {
         http->SetHeader(header.first, header.second);
     }
 
     http->SetHeader("Content-Type", "application/json");
+    http->SetHeader("Ota-Formats", "xzdp, xzlz");
     std::string method = post_data_.length() > 0 ? "POST" : "GET";
-    if (!http->Open(method, check_version_url_, post_data_)) {
+    auto open_start = esp_timer_get_time();
+    bool opened = http->Open(method, check_version_url_, post_data_);
+    board.RecordConnect(kConnectionHttp, esp_timer_get_time() - open_start, opened);
+    if (!opened) {
         ESP_LOGE(TAG, "Failed to open HTTP connection");
         delete http;
         return false;
     }
 
     auto response = http->GetBody();
-    http->Close();
     delete http;
 
     // Response: { "firmware": { "version": "1.0.0", "url": "http://" } }
+    // Optional in firmware: "sha256" of the image, "patch": { "url": "http://", "base": elf_sha256 }
     // Parse the JSON response and check if the version is newer
     // If it is, set has_new_version_ to true and store the new version and URL
     
@@ -106,6 +120,21 @@ bool Ota::CheckVersion() {
 
     firmware_version_ = version->valuestring;
     firmware_url_ = url->valuestring;
+    // Optional, checked against the image once it is written
+    cJSON *sha256 = cJSON_GetObjectItem(firmware, "sha256");
+    firmware_sha256_ = cJSON_IsString(sha256) ? sha256->valuestring : "";
+
+    // A delta is only usable when it was made against the running image
+    firmware_patch_url_.clear();
+    cJSON *patch = cJSON_GetObjectItem(firmware, "patch");
+    if (patch != NULL) {
+        cJSON *patch_url = cJSON_GetObjectItem(patch, "url");
+        cJSON *patch_base = cJSON_GetObjectItem(patch, "base");
+        if (cJSON_IsString(patch_url) && cJSON_IsString(patch_base) && GetElfSha256() == patch_base->valuestring) {
+            firmware_patch_url_ = patch_url->valuestring;
+            ESP_LOGI(TAG, "Delta upgrade available");
+        }
+    }
     cJSON_Delete(root);
 
     // Check if the version is newer, for example, 0.1.0 is newer than 0.0.1
@@ -118,6 +147,15 @@ bool Ota::CheckVersion() {
     return true;
 }
 
+std::string Ota::GetElfSha256() {
+    auto app_desc = esp_app_get_description();
+    char sha256_str[65];
+    for (int i = 0; i < 32; i++) {
+        snprintf(sha256_str + i * 2, sizeof(sha256_str) - i * 2, "%02x", app_desc->app_elf_sha256[i]);
+    }
+    return sha256_str;
+}
+
 void Ota::MarkCurrentVersionValid() {
     auto partition = esp_ota_get_running_partition();
     if (strcmp(partition->label, "factory") == 0) {
@@ -138,23 +176,53 @@ void Ota::MarkCurrentVersionValid() {
     }
 }
 
-void Ota::Upgrade(const std::string& firmware_url) {
+// Resumes at offset with a Range header, the caller deletes the client
+Http* Ota::OpenFirmware(const std::string& firmware_url, size_t offset) {
+    auto& board = Board::GetInstance();
+    auto http = board.CreateHttp();
+    if (offset > 0) {
+        http->SetHeader("Range", "bytes=" + std::to_string(offset) + "-");
+    }
+    auto open_start = esp_timer_get_time();
+    bool opened = http->Open("GET", firmware_url);
+    board.RecordConnect(kConnectionHttp, esp_timer_get_time() - open_start, opened);
+    if (!opened) {
+        ESP_LOGE(TAG, "Failed to open HTTP connection");
+        delete http;
+        return nullptr;
+    }
+    return http;
+}
+
+void Ota::SaveUpgradeProgress(const std::string& firmware_url, size_t content_length, size_t offset) {
+    Settings settings("ota", true);
+    settings.SetString("url", firmware_url);
+    settings.SetInt("size", content_length);
+    settings.SetInt("offset", offset);
+}
+
+void Ota::Upgrade(const std::string& firmware_url, bool is_patch) {
     ESP_LOGI(TAG, "Upgrading firmware from %s", firmware_url.c_str());
-    esp_ota_handle_t update_handle = 0;
     auto update_partition = esp_ota_get_next_update_partition(NULL);
     if (update_partition == NULL) {
         ESP_LOGE(TAG, "Failed to get update partition");
         return;
     }
-
     ESP_LOGI(TAG, "Writing to partition %s at offset 0x%lx", update_partition->label, update_partition->address);
-    bool image_header_checked = false;
-    std::string image_header;
 
-    auto http = Board::GetInstance().CreateHttp();
-    if (!http->Open("GET", firmware_url)) {
-        ESP_LOGE(TAG, "Failed to open HTTP connection");
-        delete http;
+    // Pick up an interrupted download of the same image. Patches start over,
+    // their download offset does not match the flash offset.
+    size_t offset = 0, saved_length = 0;
+    if (!is_patch) {
+        Settings settings("ota");
+        if (firmware_url == settings.GetString("url").c_str()) {
+            offset = settings.GetInt("offset");
+            saved_length = settings.GetInt("size");
+        }
+    }
+
+    auto http = OpenFirmware(firmware_url, offset);
+    if (http == nullptr) {
         return;
     }
 
@@ -164,38 +232,42 @@ void Ota::Upgrade(const std::string& firmware_url) {
         delete http;
         return;
     }
-
-    std::vector<char> buffer(4096);
-    size_t total_read = 0, recent_read = 0;
-    auto last_calc_time = esp_timer_get_time();
-    while (true) {
-        int ret = http->Read(buffer.data(), buffer.size());
-        if (ret < 0) {
-            ESP_LOGE(TAG, "Failed to read HTTP data: %s", esp_err_to_name(ret));
+    if (offset > 0) {
+        if (offset + content_length == saved_length) {
+            ESP_LOGI(TAG, "Resuming download at %zu/%zu", offset, saved_length);
+            content_length = saved_length;
+        } else {
+            // The server ignored the range, or the image changed
+            ESP_LOGW(TAG, "Cannot resume download, starting over");
             delete http;
-            return;
-        }
-
-        // Calculate speed and progress every second
-        recent_read += ret;
-        total_read += ret;
-        if (esp_timer_get_time() - last_calc_time >= 1000000 || ret == 0) {
-            size_t progress = total_read * 100 / content_length;
-            ESP_LOGI(TAG, "Progress: %zu%% (%zu/%zu), Speed: %zuB/s", progress, total_read, content_length, recent_read);
-            if (upgrade_callback_) {
-                upgrade_callback_(progress, recent_read);
+            offset = 0;
+            http = OpenFirmware(firmware_url, offset);
+            if (http == nullptr) {
+                return;
+            }
+            content_length = http->GetBodyLength();
+            if (content_length == 0) {
+                ESP_LOGE(TAG, "Failed to get content length");
+                delete http;
+                return;
             }
-            last_calc_time = esp_timer_get_time();
-            recent_read = 0;
-        }
-
-        if (ret == 0) {
-            break;
         }
+    }
 
+    OtaFlashWriter writer(update_partition);
+    if (!writer.Begin(offset)) {
+        delete http;
+        return;
+    }
+    if (!is_patch) {
+        SaveUpgradeProgress(firmware_url, content_length, offset);
+    }
 
+    bool image_header_checked = offset > 0;
+    std::string image_header;
+    auto write_image = [&](const uint8_t* data, size_t size) {
         if (!image_header_checked) {
-            image_header.append(buffer.data(), ret);
+            image_header.append((const char*)data, size);
             if (image_header.size() >= sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t) + sizeof(esp_app_desc_t)) {
                 esp_app_desc_t new_app_info;
                 memcpy(&new_app_info, image_header.data() + sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t), sizeof(esp_app_desc_t));
@@ -204,41 +276,140 @@ void Ota::Upgrade(const std::string& firmware_url) {
                 auto current_version = esp_app_get_description()->version;
                 if (memcmp(new_app_info.version, current_version, sizeof(new_app_info.version)) == 0) {
                     ESP_LOGE(TAG, "Firmware version is the same, skipping upgrade");
-                    delete http;
-                    return;
+                    return false;
                 }
+                image_header_checked = true;
+                image_header.clear();
+            }
+        }
+        return writer.Write(data, size);
+    };
 
-                if (esp_ota_begin(update_partition, OTA_WITH_SEQUENTIAL_WRITES, &update_handle)) {
-                    esp_ota_abort(update_handle);
-                    delete http;
-                    ESP_LOGE(TAG, "Failed to begin OTA");
-                    return;
-                }
+    std::unique_ptr<OtaPatcher> patcher;
+    if (is_patch) {
+        patcher = std::make_unique<OtaPatcher>(esp_ota_get_running_partition());
+    }
+    auto write_patched = [&](const uint8_t* data, size_t size) {
+        return patcher ? patcher->Feed(data, size, write_image) : write_image(data, size);
+    };
+
+    // Either stream may come compressed, which is known from its first bytes.
+    // Only plain images are resumable, so a resumed one needs no check.
+    std::unique_ptr<OtaDecompressor> decompressor;
+    bool resumable = !is_patch;
+    bool format_checked = offset > 0;
+    std::string stream_head;
+
+    std::vector<uint8_t> buffer(OTA_READ_SIZE);
+    size_t total_read = offset, recent_read = 0, saved_offset = offset;
+    int retries = 0;
+    auto last_calc_time = esp_timer_get_time();
+    while (total_read < content_length) {
+        if (http == nullptr) {
+            if (++retries > OTA_MAX_RETRIES) {
+                ESP_LOGE(TAG, "Giving up after %d retries", OTA_MAX_RETRIES);
+                writer.Abort();
+                return;
+            }
+            ESP_LOGW(TAG, "Download interrupted at %zu, retry %d", total_read, retries);
+            vTaskDelay(pdMS_TO_TICKS(1000 << retries));
+            http = OpenFirmware(firmware_url, total_read);
+            if (http != nullptr && total_read + http->GetBodyLength() != content_length) {
+                ESP_LOGE(TAG, "Server does not support range requests");
+                delete http;
+                writer.Abort();
+                return;
+            }
+            continue;
+        }
 
-                image_header_checked = true;
+        int ret = http->Read((char*)buffer.data(), buffer.size());
+        if (ret <= 0) {
+            if (ret < 0) {
+                ESP_LOGE(TAG, "Failed to read HTTP data: %s", esp_err_to_name(ret));
+            }
+            // The decoded data is kept, ask for the rest
+            delete http;
+            http = nullptr;
+            continue;
+        }
+        retries = 0;
+        total_read += ret;
+        recent_read += ret;
+
+        // Calculate speed and progress every second
+        if (esp_timer_get_time() - last_calc_time >= 1000000 || total_read == content_length) {
+            size_t progress = total_read * 100 / content_length;
+            ESP_LOGI(TAG, "Progress: %zu%% (%zu/%zu), Speed: %zuB/s", progress, total_read, content_length, recent_read);
+            if (upgrade_callback_) {
+                upgrade_callback_(progress, recent_read);
             }
+            last_calc_time = esp_timer_get_time();
+            recent_read = 0;
+        }
+
+        const uint8_t* data = buffer.data();
+        size_t size = ret;
+        if (!format_checked) {
+            stream_head.append((const char*)data, size);
+            if (stream_head.size() < 4 && total_read < content_length) {
+                continue;
+            }
+            format_checked = true;
+            if (stream_head.size() >= 4 && memcmp(stream_head.data(), OTA_COMPRESSED_MAGIC, 4) == 0) {
+                ESP_LOGI(TAG, "Firmware is compressed");
+                decompressor = std::make_unique<OtaDecompressor>();
+                resumable = false;
+            }
+            data = (const uint8_t*)stream_head.data();
+            size = stream_head.size();
         }
-        auto err = esp_ota_write(update_handle, buffer.data(), ret);
-        if (err != ESP_OK) {
-            ESP_LOGE(TAG, "Failed to write OTA data: %s", esp_err_to_name(err));
-            esp_ota_abort(update_handle);
+
+        bool written = decompressor ? decompressor->Feed(data, size, write_patched) : write_patched(data, size);
+        if (!written) {
+            // Nothing resumable is left behind
             delete http;
+            writer.Abort();
+            if (!is_patch) {
+                Settings("ota", true).EraseAll();
+            }
             return;
         }
+
+        // Only what reached flash can be resumed from
+        if (resumable && writer.written() >= saved_offset + OTA_SAVE_INTERVAL) {
+            saved_offset = writer.written();
+            SaveUpgradeProgress(firmware_url, content_length, saved_offset);
+        }
     }
     delete http;
 
-    esp_err_t err = esp_ota_end(update_handle);
-    if (err != ESP_OK) {
-        if (err == ESP_ERR_OTA_VALIDATE_FAILED) {
-            ESP_LOGE(TAG, "Image validation failed, image is corrupted");
-        } else {
-            ESP_LOGE(TAG, "Failed to end OTA: %s", esp_err_to_name(err));
-        }
+    if (decompressor && !decompressor->done()) {
+        ESP_LOGE(TAG, "Compressed image ended early");
+        writer.Abort();
+        return;
+    }
+    if (patcher && !patcher->done()) {
+        ESP_LOGE(TAG, "Patch ended early");
+        writer.Abort();
         return;
     }
 
-    err = esp_ota_set_boot_partition(update_partition);
+    std::string sha256;
+    bool finished = writer.Finish(sha256);
+    if (!is_patch) {
+        Settings("ota", true).EraseAll();
+    }
+    if (!finished) {
+        return;
+    }
+    if (!firmware_sha256_.empty() && strcasecmp(firmware_sha256_.c_str(), sha256.c_str()) != 0) {
+        ESP_LOGE(TAG, "SHA-256 mismatch, expected %s, got %s", firmware_sha256_.c_str(), sha256.c_str());
+        return;
+    }
+    ESP_LOGI(TAG, "Firmware SHA-256: %s", sha256.c_str());
+
+    esp_err_t err = esp_ota_set_boot_partition(update_partition);
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "Failed to set boot partition: %s", esp_err_to_name(err));
         return;
@@ -251,7 +422,11 @@ void Ota::Upgrade(const std::string& firmware_url) {
 
 void Ota::StartUpgrade(std::function<void(int progress, size_t speed)> callback) {
     upgrade_callback_ = callback;
-    Upgrade(firmware_url_);
+    if (!firmware_patch_url_.empty()) {
+        Upgrade(firmware_patch_url_, true);
+        ESP_LOGW(TAG, "Delta upgrade failed, downloading the full image");
+    }
+    Upgrade(firmware_url_, false);
 }
 
 std::vector<int> Ota::ParseVersion(const std::string& version) {
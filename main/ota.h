@@ -4,6 +4,9 @@
 #include <functional>
 #include <string>
 #include <map>
+#include <vector>
+
+class Http;
 
 class Ota {
 public:
@@ -29,11 +32,16 @@ private:
     std::string current_version_;
     std::string firmware_version_;
     std::string firmware_url_;
+    std::string firmware_sha256_;
+    std::string firmware_patch_url_;
     std::string post_data_;
     std::map<std::string, std::string> headers_;
 
-    void Upgrade(const std::string& firmware_url);
+    void Upgrade(const std::string& firmware_url, bool is_patch);
+    Http* OpenFirmware(const std::string& firmware_url, size_t offset);
+    void SaveUpgradeProgress(const std::string& firmware_url, size_t content_length, size_t offset);
     std::function<void(int progress, size_t speed)> upgrade_callback_;
+    std::string GetElfSha256();
     std::vector<int> ParseVersion(const std::string& version);
     bool IsNewVersionAvailable(const std::string& currentVersion, const std::string& newVersion);
 };
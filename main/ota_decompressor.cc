@@ -0,0 +1,158 @@
+#include "ota_decompressor.h"
+
+#include <esp_log.h>
+#include <cstring>
+#include <algorithm>
+
+#define TAG "OtaDecompressor"
+
+bool OtaDecompressor::Fail(const char* reason) {
+    ESP_LOGE(TAG, "Bad compressed image at output %zu: %s", written_, reason);
+    state_ = kStateError;
+    return false;
+}
+
+bool OtaDecompressor::Feed(const uint8_t* data, size_t size, const Output& output) {
+    while (size > 0) {
+        switch (state_) {
+        case kStateHeader: {
+            size_t count = std::min(size, OTA_COMPRESSED_HEADER_SIZE - header_filled_);
+            memcpy(header_ + header_filled_, data, count);
+            header_filled_ += count;
+            data += count;
+            size -= count;
+            if (header_filled_ == OTA_COMPRESSED_HEADER_SIZE && !OnHeader()) {
+                return false;
+            }
+            break;
+        }
+        case kStateToken: {
+            uint8_t token = *data++;
+            size--;
+            literal_length_ = token >> 4;
+            match_length_ = (token & 0x0F) + 4;
+            match_extended_ = (token & 0x0F) == 0x0F;
+            if (literal_length_ == 0x0F) {
+                state_ = kStateLiteralLength;
+            } else if (!BeginLiterals()) {
+                return false;
+            }
+            break;
+        }
+        case kStateLiteralLength: {
+            uint8_t value = *data++;
+            size--;
+            literal_length_ += value;
+            if (value != 0xFF && !BeginLiterals()) {
+                return false;
+            }
+            break;
+        }
+        case kStateLiterals: {
+            size_t count = std::min(size, std::min(literal_length_, window_.size() - window_pos_));
+            if (written_ + count > image_size_) {
+                return Fail("output overflow");
+            }
+            memcpy(&window_[window_pos_], data, count);
+            if (!output(&window_[window_pos_], count)) {
+                state_ = kStateError;
+                return false;
+            }
+            window_pos_ = (window_pos_ + count) & window_mask_;
+            written_ += count;
+            literal_length_ -= count;
+            data += count;
+            size -= count;
+            if (literal_length_ == 0 && !AfterLiterals()) {
+                return false;
+            }
+            break;
+        }
+        case kStateOffset:
+            offset_ |= *data++ << (offset_bytes_ * 8);
+            size--;
+            if (++offset_bytes_ == 2) {
+                if (offset_ == 0 || offset_ > written_ || offset_ > window_.size()) {
+                    return Fail("match offset outside window");
+                }
+                if (match_extended_) {
+                    state_ = kStateMatchLength;
+                } else if (!CopyMatch(output)) {
+                    return false;
+                }
+            }
+            break;
+        case kStateMatchLength: {
+            uint8_t value = *data++;
+            size--;
+            match_length_ += value;
+            if (value != 0xFF && !CopyMatch(output)) {
+                return false;
+            }
+            break;
+        }
+        case kStateDone:
+            return Fail("data after end");
+        case kStateError:
+            return false;
+        }
+    }
+    return true;
+}
+
+bool OtaDecompressor::OnHeader() {
+    if (memcmp(header_, OTA_COMPRESSED_MAGIC, 4) != 0) {
+        return Fail("bad magic");
+    }
+    int window_bits = header_[4];
+    if (window_bits < OTA_COMPRESSED_MIN_WINDOW_BITS || window_bits > OTA_COMPRESSED_MAX_WINDOW_BITS) {
+        return Fail("unsupported window");
+    }
+    image_size_ = header_[8] | (header_[9] << 8) | (header_[10] << 16) | ((size_t)header_[11] << 24);
+    window_.resize(1 << window_bits);
+    window_mask_ = window_.size() - 1;
+    ESP_LOGI(TAG, "Image of %zu bytes, %zu bytes window", image_size_, window_.size());
+    state_ = image_size_ > 0 ? kStateToken : kStateDone;
+    return true;
+}
+
+bool OtaDecompressor::BeginLiterals() {
+    if (literal_length_ > 0) {
+        state_ = kStateLiterals;
+        return true;
+    }
+    return AfterLiterals();
+}
+
+bool OtaDecompressor::AfterLiterals() {
+    if (written_ == image_size_) {
+        state_ = kStateDone;
+        return true;
+    }
+    offset_ = 0;
+    offset_bytes_ = 0;
+    state_ = kStateOffset;
+    return true;
+}
+
+bool OtaDecompressor::CopyMatch(const Output& output) {
+    if (written_ + match_length_ > image_size_) {
+        return Fail("output overflow");
+    }
+    while (match_length_ > 0) {
+        // Byte by byte, a match may overlap the bytes it produces
+        size_t count = std::min(match_length_, window_.size() - window_pos_);
+        for (size_t i = 0; i < count; i++) {
+            window_[window_pos_ + i] = window_[(window_pos_ + i - offset_) & window_mask_];
+        }
+        if (!output(&window_[window_pos_], count)) {
+            state_ = kStateError;
+            return false;
+        }
+        window_pos_ = (window_pos_ + count) & window_mask_;
+        written_ += count;
+        match_length_ -= count;
+    }
+    state_ = kStateToken;
+    return true;
+}
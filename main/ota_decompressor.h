@@ -0,0 +1,63 @@
+#ifndef OTA_DECOMPRESSOR_H
+#define OTA_DECOMPRESSOR_H
+
+#include <functional>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+// Compressed image format, made by release.py:
+//   "XZLZ", u8 window bits, 3 reserved bytes, u32 image size
+//   then LZ4 style sequences, all integers little endian
+//     token: literal count << 4 | (match length - 4), 15 means more bytes follow
+//     literal count extension, literals, u16 match offset, match length extension
+//   The last sequence has literals only and ends at the image size.
+#define OTA_COMPRESSED_MAGIC "XZLZ"
+#define OTA_COMPRESSED_HEADER_SIZE 12
+#define OTA_COMPRESSED_MIN_WINDOW_BITS 8
+#define OTA_COMPRESSED_MAX_WINDOW_BITS 15
+
+// Decompresses an image as it downloads. Only the window named in the
+// header is kept in memory, matches cannot reach further back.
+class OtaDecompressor {
+public:
+    using Output = std::function<bool(const uint8_t* data, size_t size)>;
+
+    bool Feed(const uint8_t* data, size_t size, const Output& output);
+    bool done() const { return state_ == kStateDone; }
+    size_t image_size() const { return image_size_; }
+
+private:
+    enum State {
+        kStateHeader,
+        kStateToken,
+        kStateLiteralLength,
+        kStateLiterals,
+        kStateOffset,
+        kStateMatchLength,
+        kStateDone,
+        kStateError
+    };
+
+    State state_ = kStateHeader;
+    uint8_t header_[OTA_COMPRESSED_HEADER_SIZE];
+    size_t header_filled_ = 0;
+    std::vector<uint8_t> window_;
+    size_t window_mask_ = 0;
+    size_t window_pos_ = 0;
+    size_t image_size_ = 0;
+    size_t written_ = 0;
+    size_t literal_length_ = 0;
+    size_t match_length_ = 0;
+    bool match_extended_ = false;
+    size_t offset_ = 0;
+    int offset_bytes_ = 0;
+
+    bool OnHeader();
+    bool BeginLiterals();
+    bool AfterLiterals();
+    bool CopyMatch(const Output& output);
+    bool Fail(const char* reason);
+};
+
+#endif // OTA_DECOMPRESSOR_H
@@ -0,0 +1,206 @@
+#include "ota_flash_writer.h"
+
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <esp_image_format.h>
+#include <cstring>
+#include <algorithm>
+
+#define TAG "OtaFlashWriter"
+
+// Flash encryption needs writes in multiples of 16 bytes
+#define OTA_WRITE_ALIGNMENT 16
+
+OtaFlashWriter::OtaFlashWriter(const esp_partition_t* partition) : partition_(partition) {
+    free_queue_ = xQueueCreate(OTA_BUFFER_COUNT, sizeof(uint8_t*));
+    // One extra slot for the end marker
+    write_queue_ = xQueueCreate(OTA_BUFFER_COUNT + 1, sizeof(Chunk));
+    done_semaphore_ = xSemaphoreCreateBinary();
+    mbedtls_sha256_init(&sha256_);
+}
+
+OtaFlashWriter::~OtaFlashWriter() {
+    Abort();
+    for (auto buffer : buffers_) {
+        if (buffer != nullptr) {
+            heap_caps_free(buffer);
+        }
+    }
+    mbedtls_sha256_free(&sha256_);
+    vSemaphoreDelete(done_semaphore_);
+    vQueueDelete(write_queue_);
+    vQueueDelete(free_queue_);
+}
+
+bool OtaFlashWriter::Begin(size_t offset) {
+    for (auto& buffer : buffers_) {
+#if CONFIG_IDF_TARGET_ESP32S3
+        buffer = (uint8_t*)heap_caps_malloc(OTA_BUFFER_SIZE, MALLOC_CAP_SPIRAM);
+#else
+        buffer = (uint8_t*)heap_caps_malloc(OTA_BUFFER_SIZE, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+#endif
+        if (buffer == nullptr) {
+            ESP_LOGE(TAG, "Failed to allocate download buffer");
+            return false;
+        }
+        xQueueSend(free_queue_, &buffer, 0);
+    }
+
+    // Sectors are erased just before they are written, so a resumed image keeps its head
+    mbedtls_sha256_starts(&sha256_, 0);
+    if (offset > 0 && !HashExisting(offset)) {
+        return false;
+    }
+    written_ = offset;
+
+    if (xTaskCreate([](void* arg) {
+        auto writer = (OtaFlashWriter*)arg;
+        writer->WriterTask();
+        vTaskDelete(NULL);
+    }, "ota_writer", 4096, this, 4, &task_) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create writer task");
+        return false;
+    }
+    return true;
+}
+
+bool OtaFlashWriter::HashExisting(size_t length) {
+    ESP_LOGI(TAG, "Resuming at %zu, hashing the data already in flash", length);
+    auto buffer = buffers_[0];
+    for (size_t offset = 0; offset < length; offset += OTA_BUFFER_SIZE) {
+        size_t size = std::min<size_t>(OTA_BUFFER_SIZE, length - offset);
+        if (esp_partition_read(partition_, offset, buffer, size) != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to read partition at %zu", offset);
+            return false;
+        }
+        mbedtls_sha256_update(&sha256_, buffer, size);
+    }
+    return true;
+}
+
+uint8_t* OtaFlashWriter::AcquireBuffer() {
+    uint8_t* buffer = nullptr;
+    while (!failed_) {
+        if (xQueueReceive(free_queue_, &buffer, pdMS_TO_TICKS(100)) == pdTRUE) {
+            return buffer;
+        }
+    }
+    return nullptr;
+}
+
+bool OtaFlashWriter::Submit(uint8_t* buffer, size_t size) {
+    if (failed_) {
+        xQueueSend(free_queue_, &buffer, 0);
+        return false;
+    }
+    Chunk chunk = { buffer, size };
+    xQueueSend(write_queue_, &chunk, portMAX_DELAY);
+    return true;
+}
+
+bool OtaFlashWriter::Write(const uint8_t* data, size_t size) {
+    while (size > 0) {
+        if (current_ == nullptr) {
+            current_ = AcquireBuffer();
+            if (current_ == nullptr) {
+                return false;
+            }
+        }
+        size_t count = std::min<size_t>(size, OTA_BUFFER_SIZE - filled_);
+        memcpy(current_ + filled_, data, count);
+        filled_ += count;
+        data += count;
+        size -= count;
+        if (filled_ == OTA_BUFFER_SIZE) {
+            auto buffer = current_;
+            current_ = nullptr;
+            filled_ = 0;
+            if (!Submit(buffer, OTA_BUFFER_SIZE)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+void OtaFlashWriter::WriterTask() {
+    Chunk chunk;
+    while (xQueueReceive(write_queue_, &chunk, portMAX_DELAY) == pdTRUE) {
+        // The end marker
+        if (chunk.buffer == nullptr) {
+            break;
+        }
+        if (!failed_) {
+            size_t offset = written_;
+            size_t write_size = (chunk.size + OTA_WRITE_ALIGNMENT - 1) & ~(OTA_WRITE_ALIGNMENT - 1);
+            memset(chunk.buffer + chunk.size, 0xFF, write_size - chunk.size);
+            size_t erase_size = (write_size + SPI_FLASH_SEC_SIZE - 1) & ~(SPI_FLASH_SEC_SIZE - 1);
+
+            esp_err_t err = esp_partition_erase_range(partition_, offset, erase_size);
+            if (err == ESP_OK) {
+                err = esp_partition_write(partition_, offset, chunk.buffer, write_size);
+            }
+            if (err != ESP_OK) {
+                ESP_LOGE(TAG, "Failed to write at %zu: %s", offset, esp_err_to_name(err));
+                failed_ = true;
+            } else {
+                mbedtls_sha256_update(&sha256_, chunk.buffer, chunk.size);
+                written_ = offset + chunk.size;
+            }
+        }
+        xQueueSend(free_queue_, &chunk.buffer, portMAX_DELAY);
+    }
+    task_ = nullptr;
+    xSemaphoreGive(done_semaphore_);
+}
+
+bool OtaFlashWriter::Finish(std::string& sha256_hex) {
+    if (current_ != nullptr) {
+        auto buffer = current_;
+        current_ = nullptr;
+        Submit(buffer, filled_);
+        filled_ = 0;
+    }
+    if (task_ != nullptr) {
+        Chunk end_marker = { nullptr, 0 };
+        xQueueSend(write_queue_, &end_marker, portMAX_DELAY);
+        xSemaphoreTake(done_semaphore_, portMAX_DELAY);
+    }
+    if (failed_) {
+        Abort();
+        return false;
+    }
+
+    uint8_t digest[32];
+    mbedtls_sha256_finish(&sha256_, digest);
+    sha256_hex.resize(64);
+    for (int i = 0; i < 32; i++) {
+        snprintf(&sha256_hex[i * 2], 3, "%02x", digest[i]);
+    }
+
+    // What esp_ota_end() would check: headers, segment checksums and the appended hash
+    const esp_partition_pos_t part_pos = {
+        .offset = partition_->address,
+        .size = partition_->size,
+    };
+    esp_image_metadata_t metadata;
+    esp_err_t err = esp_image_verify(ESP_IMAGE_VERIFY, &part_pos, &metadata);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Image validation failed, image is corrupted: %s", esp_err_to_name(err));
+        return false;
+    }
+    if (metadata.image_len > written_) {
+        ESP_LOGE(TAG, "Image is longer than what was written");
+        return false;
+    }
+    return true;
+}
+
+void OtaFlashWriter::Abort() {
+    if (task_ != nullptr) {
+        failed_ = true;
+        Chunk end_marker = { nullptr, 0 };
+        xQueueSend(write_queue_, &end_marker, portMAX_DELAY);
+        xSemaphoreTake(done_semaphore_, portMAX_DELAY);
+    }
+}
@@ -0,0 +1,67 @@
+#ifndef OTA_FLASH_WRITER_H
+#define OTA_FLASH_WRITER_H
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include <esp_partition.h>
+#include <mbedtls/sha256.h>
+
+#include <atomic>
+#include <string>
+#include <cstddef>
+#include <cstdint>
+
+// Every buffer but the last is full, so writes start on a sector boundary
+#define OTA_BUFFER_SIZE (SPI_FLASH_SEC_SIZE * 2)
+#define OTA_BUFFER_COUNT 3
+
+// Writes a firmware image on its own task, so the download keeps going
+// while flash sectors are erased and written. The image is hashed as it
+// is written. A download can resume at any buffer boundary, the hash of
+// the part already in flash is then rebuilt from the partition.
+// Writes go straight to the partition rather than through an OTA handle,
+// which would erase the whole partition or refuse offset writes.
+class OtaFlashWriter {
+public:
+    OtaFlashWriter(const esp_partition_t* partition);
+    ~OtaFlashWriter();
+
+    bool Begin(size_t offset);
+    // Copies into the current buffer and queues it once full, blocks while
+    // all buffers are waiting for flash
+    bool Write(const uint8_t* data, size_t size);
+    // Writes the last buffer and waits for it, then verifies the image
+    bool Finish(std::string& sha256_hex);
+    void Abort();
+
+    // Bytes that reached flash, always a buffer boundary until the last one
+    size_t written() const { return written_; }
+    bool failed() const { return failed_; }
+
+private:
+    struct Chunk {
+        uint8_t* buffer;
+        size_t size;
+    };
+
+    const esp_partition_t* partition_;
+    QueueHandle_t free_queue_ = nullptr;
+    QueueHandle_t write_queue_ = nullptr;
+    SemaphoreHandle_t done_semaphore_ = nullptr;
+    TaskHandle_t task_ = nullptr;
+    uint8_t* buffers_[OTA_BUFFER_COUNT] = {};
+    uint8_t* current_ = nullptr;
+    size_t filled_ = 0;
+    mbedtls_sha256_context sha256_;
+    std::atomic<size_t> written_{0};
+    std::atomic<bool> failed_{false};
+
+    bool HashExisting(size_t length);
+    // Blocks until a buffer is free, returns nullptr once the writer failed
+    uint8_t* AcquireBuffer();
+    bool Submit(uint8_t* buffer, size_t size);
+    void WriterTask();
+};
+
+#endif // OTA_FLASH_WRITER_H
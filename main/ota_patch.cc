@@ -0,0 +1,135 @@
+#include "ota_patch.h"
+
+#include <esp_log.h>
+#include <cstring>
+#include <algorithm>
+
+#define TAG "OtaPatcher"
+
+enum {
+    kPatchOpEnd = 0,
+    kPatchOpCopy = 1,
+    kPatchOpData = 2
+};
+
+static uint32_t ReadLe32(const uint8_t* data) {
+    return data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+OtaPatcher::OtaPatcher(const esp_partition_t* source) : source_(source), copy_buffer_(OTA_PATCH_COPY_CHUNK) {
+}
+
+bool OtaPatcher::Fail(const char* reason) {
+    ESP_LOGE(TAG, "Bad patch at output %zu: %s", written_, reason);
+    state_ = kStateError;
+    return false;
+}
+
+bool OtaPatcher::Feed(const uint8_t* data, size_t size, const Output& output) {
+    while (size > 0) {
+        switch (state_) {
+        case kStateHeader:
+        case kStateArgs: {
+            size_t count = std::min(size, field_size_ - field_filled_);
+            memcpy(field_ + field_filled_, data, count);
+            field_filled_ += count;
+            data += count;
+            size -= count;
+            if (field_filled_ == field_size_ && !OnField(output)) {
+                return false;
+            }
+            break;
+        }
+        case kStateOp:
+            op_ = *data++;
+            size--;
+            if (op_ == kPatchOpEnd) {
+                if (written_ != target_size_) {
+                    return Fail("size mismatch");
+                }
+                state_ = kStateDone;
+            } else if (op_ == kPatchOpCopy || op_ == kPatchOpData) {
+                state_ = kStateArgs;
+                field_size_ = op_ == kPatchOpCopy ? 8 : 4;
+                field_filled_ = 0;
+            } else {
+                return Fail("unknown op");
+            }
+            break;
+        case kStateData: {
+            size_t count = std::min(size, data_left_);
+            if (!output(data, count)) {
+                state_ = kStateError;
+                return false;
+            }
+            written_ += count;
+            data_left_ -= count;
+            data += count;
+            size -= count;
+            if (data_left_ == 0) {
+                state_ = kStateOp;
+            }
+            break;
+        }
+        case kStateDone:
+            return Fail("data after end");
+        case kStateError:
+            return false;
+        }
+    }
+    return true;
+}
+
+bool OtaPatcher::OnField(const Output& output) {
+    if (state_ == kStateHeader) {
+        if (memcmp(field_, OTA_PATCH_MAGIC, 4) != 0) {
+            return Fail("bad magic");
+        }
+        target_size_ = ReadLe32(field_ + 4);
+        source_size_ = ReadLe32(field_ + 8);
+        if (source_size_ > source_->size) {
+            return Fail("source larger than the running partition");
+        }
+        ESP_LOGI(TAG, "Patch builds %zu bytes from %zu bytes of %s", target_size_, source_size_, source_->label);
+        state_ = kStateOp;
+        return true;
+    }
+
+    size_t length = op_ == kPatchOpCopy ? ReadLe32(field_ + 4) : ReadLe32(field_);
+    if (written_ + length > target_size_) {
+        return Fail("output overflow");
+    }
+    if (op_ == kPatchOpData) {
+        data_left_ = length;
+        state_ = length > 0 ? kStateData : kStateOp;
+        return true;
+    }
+
+    size_t offset = ReadLe32(field_);
+    if (offset + length > source_size_) {
+        return Fail("copy outside source");
+    }
+    if (!Copy(offset, length, output)) {
+        state_ = kStateError;
+        return false;
+    }
+    state_ = kStateOp;
+    return true;
+}
+
+bool OtaPatcher::Copy(size_t offset, size_t length, const Output& output) {
+    while (length > 0) {
+        size_t count = std::min<size_t>(length, copy_buffer_.size());
+        if (esp_partition_read(source_, offset, copy_buffer_.data(), count) != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to read source at %zu", offset);
+            return false;
+        }
+        if (!output(copy_buffer_.data(), count)) {
+            return false;
+        }
+        written_ += count;
+        offset += count;
+        length -= count;
+    }
+    return true;
+}
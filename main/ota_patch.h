@@ -0,0 +1,60 @@
+#ifndef OTA_PATCH_H
+#define OTA_PATCH_H
+
+#include <esp_partition.h>
+
+#include <functional>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+// Delta image format, made by ota_patch.py:
+//   "XZDP", u32 target size, u32 source size
+//   then ops until END, all integers little endian
+//     COPY: u8 1, u32 source offset, u32 length
+//     DATA: u8 2, u32 length, length bytes
+//     END:  u8 0
+#define OTA_PATCH_MAGIC "XZDP"
+#define OTA_PATCH_HEADER_SIZE 12
+#define OTA_PATCH_COPY_CHUNK 1024
+
+// Rebuilds an image from a patch against the running partition. The patch
+// is fed in pieces as it arrives, the image comes out in order.
+class OtaPatcher {
+public:
+    using Output = std::function<bool(const uint8_t* data, size_t size)>;
+
+    OtaPatcher(const esp_partition_t* source);
+
+    bool Feed(const uint8_t* data, size_t size, const Output& output);
+    bool done() const { return state_ == kStateDone; }
+    size_t target_size() const { return target_size_; }
+
+private:
+    enum State {
+        kStateHeader,
+        kStateOp,
+        kStateArgs,
+        kStateData,
+        kStateDone,
+        kStateError
+    };
+
+    const esp_partition_t* source_;
+    State state_ = kStateHeader;
+    uint8_t op_ = 0;
+    uint8_t field_[OTA_PATCH_HEADER_SIZE];
+    size_t field_size_ = OTA_PATCH_HEADER_SIZE;
+    size_t field_filled_ = 0;
+    size_t data_left_ = 0;
+    size_t target_size_ = 0;
+    size_t source_size_ = 0;
+    size_t written_ = 0;
+    std::vector<uint8_t> copy_buffer_;
+
+    bool OnField(const Output& output);
+    bool Copy(size_t offset, size_t length, const Output& output);
+    bool Fail(const char* reason);
+};
+
+#endif // OTA_PATCH_H
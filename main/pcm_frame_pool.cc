@@ -0,0 +1,107 @@
+#include "pcm_frame_pool.h"
+
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <cassert>
+#include <new>
+
+#define TAG "PcmFramePool"
+
+PcmFrame::PcmFrame(const PcmFrame& other) : block_(other.block_) {
+    if (block_ != nullptr) {
+        block_->references.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+PcmFrame& PcmFrame::operator=(const PcmFrame& other) {
+    if (this != &other) {
+        if (other.block_ != nullptr) {
+            other.block_->references.fetch_add(1, std::memory_order_relaxed);
+        }
+        Release();
+        block_ = other.block_;
+    }
+    return *this;
+}
+
+PcmFrame& PcmFrame::operator=(PcmFrame&& other) noexcept {
+    if (this != &other) {
+        Release();
+        block_ = other.block_;
+        other.block_ = nullptr;
+    }
+    return *this;
+}
+
+size_t PcmFrame::capacity() const {
+    return block_ != nullptr ? block_->pool->block_samples() : 0;
+}
+
+void PcmFrame::resize(size_t samples) {
+    assert(samples <= capacity());
+    block_->size = samples;
+}
+
+void PcmFrame::Release() {
+    if (block_ != nullptr) {
+        if (block_->references.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            block_->pool->Free(block_);
+        }
+        block_ = nullptr;
+    }
+}
+
+PcmFramePool::PcmFramePool(size_t block_samples, size_t block_count)
+    : block_samples_(block_samples), block_count_(block_count) {
+    size_t slab_size = block_samples_ * block_count_ * sizeof(int16_t);
+#if CONFIG_AUDIO_FRAME_POOL_IN_PSRAM
+    slab_ = (int16_t*)heap_caps_malloc(slab_size, MALLOC_CAP_SPIRAM);
+#else
+    slab_ = (int16_t*)heap_caps_malloc(slab_size, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+#endif
+    blocks_ = (PcmFrameBlock*)heap_caps_malloc(block_count_ * sizeof(PcmFrameBlock), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    assert(slab_ != nullptr && blocks_ != nullptr);
+
+    for (size_t i = 0; i < block_count_; i++) {
+        auto block = new (&blocks_[i]) PcmFrameBlock();
+        block->pool = this;
+        block->references = 0;
+        block->size = 0;
+        block->samples = slab_ + i * block_samples_;
+        block->next_free = free_list_;
+        free_list_ = block;
+    }
+    ESP_LOGI(TAG, "%zu blocks of %zu samples", block_count_, block_samples_);
+}
+
+PcmFramePool::~PcmFramePool() {
+    assert(in_use_ == 0);
+    heap_caps_free(blocks_);
+    heap_caps_free(slab_);
+}
+
+PcmFrame PcmFramePool::Acquire() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (free_list_ == nullptr) {
+        if (exhausted_count_++ % 100 == 0) {
+            ESP_LOGW(TAG, "Pool exhausted, %zu blocks in use", in_use_);
+        }
+        return PcmFrame();
+    }
+
+    auto block = free_list_;
+    free_list_ = block->next_free;
+    block->references.store(1, std::memory_order_relaxed);
+    block->size = block_samples_;
+    if (++in_use_ > peak_in_use_) {
+        peak_in_use_ = in_use_;
+    }
+    return PcmFrame(block);
+}
+
+void PcmFramePool::Free(PcmFrameBlock* block) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    block->next_free = free_list_;
+    free_list_ = block;
+    in_use_--;
+}
@@ -0,0 +1,78 @@
+#ifndef PCM_FRAME_POOL_H
+#define PCM_FRAME_POOL_H
+
+#include <atomic>
+#include <mutex>
+#include <cstddef>
+#include <cstdint>
+
+class PcmFramePool;
+
+struct PcmFrameBlock {
+    PcmFramePool* pool;
+    std::atomic<int> references;
+    size_t size;
+    int16_t* samples;
+    PcmFrameBlock* next_free;
+};
+
+// Reference counted handle to a fixed size block of PCM samples. Copying a
+// frame shares the block, the block returns to its pool with the last handle.
+class PcmFrame {
+public:
+    PcmFrame() = default;
+    PcmFrame(const PcmFrame& other);
+    PcmFrame(PcmFrame&& other) noexcept : block_(other.block_) { other.block_ = nullptr; }
+    PcmFrame& operator=(const PcmFrame& other);
+    PcmFrame& operator=(PcmFrame&& other) noexcept;
+    ~PcmFrame() { Release(); }
+
+    explicit operator bool() const { return block_ != nullptr; }
+    int16_t* data() { return block_->samples; }
+    const int16_t* data() const { return block_->samples; }
+    size_t size() const { return block_ != nullptr ? block_->size : 0; }
+    size_t capacity() const;
+    void resize(size_t samples);
+
+private:
+    friend class PcmFramePool;
+    explicit PcmFrame(PcmFrameBlock* block) : block_(block) {}
+
+    PcmFrameBlock* block_ = nullptr;
+
+    void Release();
+};
+
+class PcmFramePool {
+public:
+    PcmFramePool(size_t block_samples, size_t block_count);
+    ~PcmFramePool();
+    PcmFramePool(const PcmFramePool&) = delete;
+    PcmFramePool& operator=(const PcmFramePool&) = delete;
+
+    // Returns an empty frame when the pool is exhausted
+    PcmFrame Acquire();
+
+    size_t block_samples() const { return block_samples_; }
+    size_t block_count() const { return block_count_; }
+    size_t in_use() const { return in_use_; }
+    size_t peak_in_use() const { return peak_in_use_; }
+    uint32_t exhausted_count() const { return exhausted_count_; }
+
+private:
+    friend class PcmFrame;
+
+    const size_t block_samples_;
+    const size_t block_count_;
+    int16_t* slab_ = nullptr;
+    PcmFrameBlock* blocks_ = nullptr;
+    PcmFrameBlock* free_list_ = nullptr;
+    std::mutex mutex_;
+    size_t in_use_ = 0;
+    size_t peak_in_use_ = 0;
+    uint32_t exhausted_count_ = 0;
+
+    void Free(PcmFrameBlock* block);
+};
+
+#endif // PCM_FRAME_POOL_H
@@ -0,0 +1,48 @@
+#include "audio_cipher.h"
+
+#include <esp_log.h>
+#include <cstring>
+
+#define TAG "AudioCipher"
+
+AesCtrCipher::AesCtrCipher() {
+    mbedtls_aes_init(&aes_ctx_);
+}
+
+AesCtrCipher::~AesCtrCipher() {
+    mbedtls_aes_free(&aes_ctx_);
+}
+
+bool AesCtrCipher::SetKey(const std::string& key) {
+    if (key.size() != 16) {
+        ESP_LOGE(TAG, "Invalid key size: %zu", key.size());
+        key_set_ = false;
+        return false;
+    }
+    // Setting a new key reuses the context, no need to free it first
+    int ret = mbedtls_aes_setkey_enc(&aes_ctx_, (const unsigned char*)key.data(), 128);
+    if (ret != 0) {
+        ESP_LOGE(TAG, "Failed to set key, ret: %d", ret);
+        key_set_ = false;
+        return false;
+    }
+    key_set_ = true;
+    return true;
+}
+
+bool AesCtrCipher::Crypt(const uint8_t* header, const uint8_t* input, uint8_t* output, size_t size) {
+    if (!key_set_) {
+        return false;
+    }
+    // mbedtls advances the counter block, work on a copy of the header
+    uint8_t counter[AUDIO_CIPHER_HEADER_SIZE];
+    memcpy(counter, header, sizeof(counter));
+    size_t nc_off = 0;
+    uint8_t stream_block[16] = {0};
+    int ret = mbedtls_aes_crypt_ctr(&aes_ctx_, size, &nc_off, counter, stream_block, input, output);
+    if (ret != 0) {
+        ESP_LOGE(TAG, "AES-CTR failed, ret: %d", ret);
+        return false;
+    }
+    return true;
+}
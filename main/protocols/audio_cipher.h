@@ -0,0 +1,42 @@
+#ifndef AUDIO_CIPHER_H
+#define AUDIO_CIPHER_H
+
+#include <mbedtls/aes.h>
+
+#include <string>
+#include <cstddef>
+#include <cstdint>
+
+#define AUDIO_CIPHER_HEADER_SIZE 16
+
+// Encrypts and decrypts audio datagrams. The 16 byte datagram header is the
+// initial counter block, it holds the payload size and sequence number.
+class AudioCipher {
+public:
+    virtual ~AudioCipher() = default;
+
+    virtual bool SetKey(const std::string& key) = 0;
+    // Encryption and decryption are the same operation, input and output may be the same buffer
+    virtual bool Crypt(const uint8_t* header, const uint8_t* input, uint8_t* output, size_t size) = 0;
+};
+
+// AES-128-CTR through mbedtls, which uses the AES peripheral when
+// CONFIG_MBEDTLS_HARDWARE_AES is enabled. The keystream is not generated
+// ahead of time: the counter block carries the payload size, which is only
+// known once the encoder has produced the packet.
+class AesCtrCipher : public AudioCipher {
+public:
+    AesCtrCipher();
+    ~AesCtrCipher();
+    AesCtrCipher(const AesCtrCipher&) = delete;
+    AesCtrCipher& operator=(const AesCtrCipher&) = delete;
+
+    bool SetKey(const std::string& key) override;
+    bool Crypt(const uint8_t* header, const uint8_t* input, uint8_t* output, size_t size) override;
+
+private:
+    mbedtls_aes_context aes_ctx_;
+    bool key_set_ = false;
+};
+
+#endif // AUDIO_CIPHER_H
@@ -4,6 +4,7 @@
 #include "settings.h"
 
 #include <esp_log.h>
+#include <esp_timer.h>
 #include <ml307_mqtt.h>
 #include <ml307_udp.h>
 #include <cstring>
@@ -13,6 +14,21 @@
 
 MqttProtocol::MqttProtocol() {
     event_group_handle_ = xEventGroupCreate();
+    cipher_ = std::make_unique<AesCtrCipher>();
+    tx_buffer_.reserve(MQTT_AUDIO_MAX_DATAGRAM_SIZE);
+    rx_buffer_.reserve(MQTT_AUDIO_MAX_DATAGRAM_SIZE);
+
+    OnIncomingJson("hello", [this](const JsonValue& root) {
+        ParseServerHello(root);
+    });
+    OnIncomingJson("goodbye", [this](const JsonValue& root) {
+        auto session_id = root["session_id"];
+        if (!session_id.IsValid() || session_id.Equals(session_id_.c_str())) {
+            Application::GetInstance().Schedule([this]() {
+                CloseAudioChannel();
+            });
+        }
+    });
 
     StartMqttClient();
 }
@@ -52,38 +68,19 @@ bool MqttProtocol::StartMqttClient() {
 
     mqtt_->OnDisconnected([this]() {
         ESP_LOGI(TAG, "Disconnected from endpoint");
+        // Control messages of the session are lost, the channel has to be opened again
+        audio_channel_ready_ = false;
     });
 
     mqtt_->OnMessage([this](const std::string& topic, const std::string& payload) {
-        cJSON* root = cJSON_Parse(payload.c_str());
-        if (root == nullptr) {
-            ESP_LOGE(TAG, "Failed to parse json message %s", payload.c_str());
-            return;
-        }
-        cJSON* type = cJSON_GetObjectItem(root, "type");
-        if (type == nullptr) {
-            ESP_LOGE(TAG, "Message type is not specified");
-            cJSON_Delete(root);
-            return;
-        }
-
-        if (strcmp(type->valuestring, "hello") == 0) {
-            ParseServerHello(root);
-        } else if (strcmp(type->valuestring, "goodbye") == 0) {
-            auto session_id = cJSON_GetObjectItem(root, "session_id");
-            if (session_id == nullptr || session_id_ == session_id->valuestring) {
-                Application::GetInstance().Schedule([this]() {
-                    CloseAudioChannel();
-                });
-            }
-        } else if (on_incoming_json_ != nullptr) {
-            on_incoming_json_(root);
-        }
-        cJSON_Delete(root);
+        DispatchJson(payload.data(), payload.size());
     });
 
     ESP_LOGI(TAG, "Connecting to endpoint %s", endpoint_.c_str());
-    if (!mqtt_->Connect(endpoint_, 8883, client_id_, username_, password_)) {
+    int64_t connect_start = esp_timer_get_time();
+    bool connected = mqtt_->Connect(endpoint_, 8883, client_id_, username_, password_);
+    Board::GetInstance().RecordConnect(kConnectionMqtt, esp_timer_get_time() - connect_start, connected);
+    if (!connected) {
         ESP_LOGE(TAG, "Failed to connect to endpoint");
         if (on_network_error_ != nullptr) {
             on_network_error_("无法连接服务");
@@ -111,25 +108,30 @@ void MqttProtocol::SendAudio(const std::vector<uint8_t>& data) {
         return;
     }
 
-    std::string nonce(aes_nonce_);
-    *(uint16_t*)&nonce[2] = htons(data.size());
-    *(uint32_t*)&nonce[12] = htonl(++local_sequence_);
+    if (MQTT_AUDIO_HEADER_SIZE + data.size() > MQTT_AUDIO_MAX_DATAGRAM_SIZE) {
+        ESP_LOGE(TAG, "Audio packet too large: %zu", data.size());
+        return;
+    }
 
-    std::string encrypted;
-    encrypted.resize(aes_nonce_.size() + data.size());
-    memcpy(encrypted.data(), nonce.data(), nonce.size());
+    // The header is the nonce with the payload size and sequence filled in
+    tx_buffer_.resize(MQTT_AUDIO_HEADER_SIZE + data.size());
+    auto header = (uint8_t*)tx_buffer_.data();
+    memcpy(header, aes_nonce_.data(), MQTT_AUDIO_HEADER_SIZE);
+    *(uint16_t*)&header[2] = htons(data.size());
+    *(uint32_t*)&header[12] = htonl(++local_sequence_);
 
-    size_t nc_off = 0;
-    uint8_t stream_block[16] = {0};
-    if (mbedtls_aes_crypt_ctr(&aes_ctx_, data.size(), &nc_off, (uint8_t*)nonce.c_str(), stream_block,
-        (uint8_t*)data.data(), (uint8_t*)&encrypted[nonce.size()]) != 0) {
-        ESP_LOGE(TAG, "Failed to encrypt audio data");
-        return;
+    {
+        std::lock_guard<std::mutex> cipher_lock(cipher_mutex_);
+        if (!cipher_->Crypt(header, data.data(), header + MQTT_AUDIO_HEADER_SIZE, data.size())) {
+            ESP_LOGE(TAG, "Failed to encrypt audio data");
+            return;
+        }
     }
-    udp_->Send(encrypted);
+    udp_->Send(tx_buffer_);
 }
 
 void MqttProtocol::CloseAudioChannel() {
+    audio_channel_ready_ = false;
     {
         std::lock_guard<std::mutex> lock(channel_mutex_);
         if (udp_ != nullptr) {
@@ -138,11 +140,12 @@ void MqttProtocol::CloseAudioChannel() {
         }
     }
 
-    std::string message = "{";
-    message += "\"session_id\":\"" + session_id_ + "\",";
-    message += "\"type\":\"goodbye\"";
-    message += "}";
-    SendText(message);
+    JsonWriter writer(PROTOCOL_MESSAGE_CAPACITY);
+    writer.BeginObject();
+    writer.Key("session_id").String(session_id_);
+    writer.Key("type").String("goodbye");
+    writer.EndObject();
+    SendText(writer.str());
 
     if (on_audio_channel_closed_ != nullptr) {
         on_audio_channel_closed_();
@@ -150,24 +153,34 @@ void MqttProtocol::CloseAudioChannel() {
 }
 
 bool MqttProtocol::OpenAudioChannel() {
+    audio_channel_ready_ = false;
+    channel_timings_ = AudioChannelTimings();
+    int64_t connect_start = esp_timer_get_time();
     if (mqtt_ == nullptr || !mqtt_->IsConnected()) {
         ESP_LOGI(TAG, "MQTT is not connected, try to connect now");
         if (!StartMqttClient()) {
             return false;
         }
     }
+    int64_t hello_start = esp_timer_get_time();
+    channel_timings_.connect_us = hello_start - connect_start;
 
     session_id_ = "";
 
     // 发送 hello 消息申请 UDP 通道
-    std::string message = "{";
-    message += "\"type\":\"hello\",";
-    message += "\"version\": 3,";
-    message += "\"transport\":\"udp\",";
-    message += "\"audio_params\":{";
-    message += "\"format\":\"opus\", \"sample_rate\":16000, \"channels\":1, \"frame_duration\":" + std::to_string(OPUS_FRAME_DURATION_MS);
-    message += "}}";
-    SendText(message);
+    JsonWriter writer(PROTOCOL_MESSAGE_CAPACITY);
+    writer.BeginObject();
+    writer.Key("type").String("hello");
+    writer.Key("version").Number(3);
+    writer.Key("transport").String("udp");
+    writer.Key("audio_params").BeginObject();
+    writer.Key("format").String("opus");
+    writer.Key("sample_rate").Number(sample_rate_);
+    writer.Key("channels").Number(1);
+    writer.Key("frame_duration").Number(OPUS_FRAME_DURATION_MS);
+    writer.EndObject();
+    writer.EndObject();
+    SendText(writer.str());
 
     // 等待服务器响应
     EventBits_t bits = xEventGroupWaitBits(event_group_handle_, MQTT_PROTOCOL_SERVER_HELLO_EVENT, pdTRUE, pdFALSE, pdMS_TO_TICKS(10000));
@@ -178,6 +191,7 @@ bool MqttProtocol::OpenAudioChannel() {
         }
         return false;
     }
+    channel_timings_.hello_us = esp_timer_get_time() - hello_start;
 
     std::lock_guard<std::mutex> lock(channel_mutex_);
     if (udp_ != nullptr) {
@@ -185,7 +199,7 @@ bool MqttProtocol::OpenAudioChannel() {
     }
     udp_ = Board::GetInstance().CreateUdp();
     udp_->OnMessage([this](const std::string& data) {
-        if (data.size() < sizeof(aes_nonce_)) {
+        if (data.size() < MQTT_AUDIO_HEADER_SIZE || data.size() > MQTT_AUDIO_MAX_DATAGRAM_SIZE) {
             ESP_LOGE(TAG, "Invalid audio packet size: %zu", data.size());
             return;
         }
@@ -193,34 +207,39 @@ bool MqttProtocol::OpenAudioChannel() {
             ESP_LOGE(TAG, "Invalid audio packet type: %x", data[0]);
             return;
         }
+        // Out of order packets are passed on, the jitter buffer reorders them
         uint32_t sequence = ntohl(*(uint32_t*)&data[12]);
-        if (sequence < remote_sequence_) {
-            ESP_LOGW(TAG, "Received audio packet with old sequence: %lu, expected: %lu", sequence, remote_sequence_);
-            return;
-        }
-        if (sequence != remote_sequence_ + 1) {
-            ESP_LOGW(TAG, "Received audio packet with wrong sequence: %lu, expected: %lu", sequence, remote_sequence_ + 1);
-        }
+        {
+            std::lock_guard<std::mutex> cipher_lock(cipher_mutex_);
+            if (sequence <= remote_sequence_) {
+                ESP_LOGW(TAG, "Received audio packet with old sequence: %lu, expected: %lu", sequence, remote_sequence_ + 1);
+            } else if (sequence != remote_sequence_ + 1) {
+                ESP_LOGW(TAG, "Received audio packet with wrong sequence: %lu, expected: %lu", sequence, remote_sequence_ + 1);
+            }
 
-        std::vector<uint8_t> decrypted;
-        size_t decrypted_size = data.size() - aes_nonce_.size();
-        size_t nc_off = 0;
-        uint8_t stream_block[16] = {0};
-        decrypted.resize(decrypted_size);
-        auto nonce = (uint8_t*)data.data();
-        auto encrypted = (uint8_t*)data.data() + aes_nonce_.size();
-        int ret = mbedtls_aes_crypt_ctr(&aes_ctx_, decrypted_size, &nc_off, nonce, stream_block, encrypted, (uint8_t*)decrypted.data());
-        if (ret != 0) {
-            ESP_LOGE(TAG, "Failed to decrypt audio data, ret: %d", ret);
-            return;
-        }
-        if (on_incoming_audio_ != nullptr) {
-            on_incoming_audio_(std::move(decrypted));
+            // Decrypt into the reused receive buffer, ReceiveAudio() copies it
+            size_t decrypted_size = data.size() - MQTT_AUDIO_HEADER_SIZE;
+            rx_buffer_.resize(decrypted_size);
+            auto header = (const uint8_t*)data.data();
+            if (!cipher_->Crypt(header, header + MQTT_AUDIO_HEADER_SIZE, rx_buffer_.data(), decrypted_size)) {
+                ESP_LOGE(TAG, "Failed to decrypt audio data");
+                return;
+            }
+            if (sequence > remote_sequence_) {
+                remote_sequence_ = sequence;
+            }
         }
-        remote_sequence_ = sequence;
+        ReceiveAudio(sequence, rx_buffer_.data(), rx_buffer_.size());
     });
 
-    udp_->Connect(udp_server_, udp_port_);
+    if (!udp_->Connect(udp_server_, udp_port_)) {
+        ESP_LOGE(TAG, "Failed to connect to UDP server");
+        if (on_network_error_ != nullptr) {
+            on_network_error_("无法连接服务");
+        }
+        return false;
+    }
+    audio_channel_ready_ = true;
 
     if (on_audio_channel_opened_ != nullptr) {
         on_audio_channel_opened_();
@@ -228,44 +247,55 @@ bool MqttProtocol::OpenAudioChannel() {
     return true;
 }
 
-void MqttProtocol::ParseServerHello(const cJSON* root) {
-    auto transport = cJSON_GetObjectItem(root, "transport");
-    if (transport == nullptr || strcmp(transport->valuestring, "udp") != 0) {
-        ESP_LOGE(TAG, "Unsupported transport: %s", transport->valuestring);
+void MqttProtocol::ParseServerHello(const JsonValue& root) {
+    auto transport = root["transport"];
+    if (!transport.Equals("udp")) {
+        ESP_LOGE(TAG, "Unsupported transport: %.*s", (int)transport.length(), transport.data());
         return;
     }
 
-    auto session_id = cJSON_GetObjectItem(root, "session_id");
-    if (session_id != nullptr) {
-        session_id_ = session_id->valuestring;
+    auto session_id = root["session_id"];
+    if (session_id.IsString()) {
+        session_id_ = session_id.ToString();
     }
 
     // Get sample rate from hello message
-    auto audio_params = cJSON_GetObjectItem(root, "audio_params");
-    if (audio_params != NULL) {
-        auto sample_rate = cJSON_GetObjectItem(audio_params, "sample_rate");
-        if (sample_rate != NULL) {
-            server_sample_rate_ = sample_rate->valueint;
-        }
+    auto sample_rate = root["audio_params"]["sample_rate"];
+    if (sample_rate.IsNumber()) {
+        server_sample_rate_ = sample_rate.ToInt();
     }
 
-    auto udp = cJSON_GetObjectItem(root, "udp");
-    if (udp == nullptr) {
+    auto udp = root["udp"];
+    if (!udp.IsObject()) {
         ESP_LOGE(TAG, "UDP is not specified");
         return;
     }
-    udp_server_ = cJSON_GetObjectItem(udp, "server")->valuestring;
-    udp_port_ = cJSON_GetObjectItem(udp, "port")->valueint;
-    auto key = cJSON_GetObjectItem(udp, "key")->valuestring;
-    auto nonce = cJSON_GetObjectItem(udp, "nonce")->valuestring;
-
-    // auto encryption = cJSON_GetObjectItem(udp, "encryption")->valuestring;
-    // ESP_LOGI(TAG, "UDP server: %s, port: %d, encryption: %s", udp_server_.c_str(), udp_port_, encryption);
-    aes_nonce_ = DecodeHexString(nonce);
-    mbedtls_aes_init(&aes_ctx_);
-    mbedtls_aes_setkey_enc(&aes_ctx_, (const unsigned char*)DecodeHexString(key).c_str(), 128);
+    auto server = udp["server"];
+    auto port = udp["port"];
+    auto key = udp["key"];
+    auto nonce = udp["nonce"];
+    if (!server.IsString() || !port.IsNumber() || !key.IsString() || !nonce.IsString()) {
+        ESP_LOGE(TAG, "Incomplete UDP parameters");
+        return;
+    }
+    udp_server_ = server.ToString();
+    udp_port_ = port.ToInt();
+
+    // auto encryption = udp["encryption"].ToString();
+    // ESP_LOGI(TAG, "UDP server: %s, port: %d, encryption: %s", udp_server_.c_str(), udp_port_, encryption.c_str());
+    // The sender task may be encrypting with the previous session key
+    std::lock_guard<std::mutex> lock(channel_mutex_);
+    aes_nonce_ = DecodeHexString(nonce.ToString());
+    if (aes_nonce_.size() != MQTT_AUDIO_HEADER_SIZE) {
+        ESP_LOGE(TAG, "Invalid nonce size: %zu", aes_nonce_.size());
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> cipher_lock(cipher_mutex_);
+        cipher_->SetKey(DecodeHexString(key.ToString()));
+        remote_sequence_ = 0;
+    }
     local_sequence_ = 0;
-    remote_sequence_ = 0;
     xEventGroupSetBits(event_group_handle_, MQTT_PROTOCOL_SERVER_HELLO_EVENT);
 }
 
@@ -288,6 +318,3 @@ std::string MqttProtocol::DecodeHexString(const std::string& hex_string) {
     return decoded;
 }
 
-bool MqttProtocol::IsAudioChannelOpened() const {
-    return udp_ != nullptr;
-}
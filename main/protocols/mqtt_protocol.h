@@ -3,16 +3,16 @@
 
 
 #include "protocol.h"
+#include "audio_cipher.h"
 #include <mqtt.h>
 #include <udp.h>
-#include <cJSON.h>
-#include <mbedtls/aes.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/event_groups.h>
 
 #include <functional>
 #include <string>
 #include <map>
+#include <memory>
 #include <mutex>
 
 #define MQTT_PING_INTERVAL_SECONDS 90
@@ -20,6 +20,10 @@
 
 #define MQTT_PROTOCOL_SERVER_HELLO_EVENT (1 << 0)
 
+// Audio datagrams carry the 16 byte nonce in front of the payload
+#define MQTT_AUDIO_HEADER_SIZE AUDIO_CIPHER_HEADER_SIZE
+#define MQTT_AUDIO_MAX_DATAGRAM_SIZE 1500
+
 class MqttProtocol : public Protocol {
 public:
     MqttProtocol();
@@ -28,7 +32,6 @@ public:
     void SendAudio(const std::vector<uint8_t>& data) override;
     bool OpenAudioChannel() override;
     void CloseAudioChannel() override;
-    bool IsAudioChannelOpened() const override;
 
 private:
     EventGroupHandle_t event_group_handle_;
@@ -43,15 +46,22 @@ private:
     std::mutex channel_mutex_;
     Mqtt* mqtt_ = nullptr;
     Udp* udp_ = nullptr;
-    mbedtls_aes_context aes_ctx_;
+    // Guards the cipher and remote_sequence_, which the UDP task uses to
+    // decrypt while a new hello may install the next session key. It is
+    // never held while the UDP client is deleted.
+    std::mutex cipher_mutex_;
+    std::unique_ptr<AudioCipher> cipher_;
     std::string aes_nonce_;
     std::string udp_server_;
     int udp_port_;
     uint32_t local_sequence_;
     uint32_t remote_sequence_;
+    // Reused for every datagram, the capacity is reserved up front
+    std::string tx_buffer_;
+    std::vector<uint8_t> rx_buffer_;
 
     bool StartMqttClient();
-    void ParseServerHello(const cJSON* root);
+    void ParseServerHello(const JsonValue& root);
     std::string DecodeHexString(const std::string& hex_string);
 
     void SendText(const std::string& text) override;
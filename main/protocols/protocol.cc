@@ -1,14 +1,159 @@
 #include "protocol.h"
 
 #include <esp_log.h>
+#include <esp_timer.h>
+#include <cstring>
+#include <cassert>
 
 #define TAG "Protocol"
 
-void Protocol::OnIncomingJson(std::function<void(const cJSON* root)> callback) {
-    on_incoming_json_ = callback;
+// Report the uplink latency every 100 packets
+#define LATENCY_REPORT_PACKETS 100
+
+Protocol::Protocol()
+    : outbound_audio_(PROTOCOL_OUTBOUND_QUEUE_CAPACITY, PROTOCOL_OUTBOUND_MAX_PACKET_SIZE, kPacketQueueDropOldest),
+      inbound_audio_(PROTOCOL_INBOUND_QUEUE_CAPACITY, PROTOCOL_INBOUND_MAX_PACKET_SIZE, kPacketQueueDropNewest) {
+}
+
+Protocol::~Protocol() {
+    if (sender_task_ != nullptr) {
+        vTaskDelete(sender_task_);
+    }
+    if (receiver_task_ != nullptr) {
+        vTaskDelete(receiver_task_);
+    }
+}
+
+// Not in the constructor, the task calls SendAudio() of the derived class
+void Protocol::Start() {
+    assert(sender_task_ == nullptr);
+    xTaskCreate([](void* arg) {
+        auto protocol = (Protocol*)arg;
+        protocol->SenderTask();
+        vTaskDelete(NULL);
+    }, "protocol_sender", 4096 * 2, this, 3, &sender_task_);
+    xTaskCreate([](void* arg) {
+        auto protocol = (Protocol*)arg;
+        protocol->ReceiverTask();
+        vTaskDelete(NULL);
+    }, "protocol_receiver", 4096, this, 3, &receiver_task_);
+}
+
+void Protocol::SetAudioEpoch(uint32_t epoch) {
+    audio_epoch_.store(epoch, std::memory_order_relaxed);
+}
+
+bool Protocol::QueueAudio(const uint8_t* data, size_t size, uint32_t capture_time_ms, uint32_t epoch) {
+    if (sender_task_ == nullptr || epoch != audio_epoch_.load(std::memory_order_relaxed)) {
+        return false;
+    }
+    OpusPacketInfo info;
+    info.timestamp = capture_time_ms;
+    info.epoch = epoch;
+    {
+        std::lock_guard<std::mutex> lock(outbound_producer_mutex_);
+        if (!outbound_audio_.Push(data, size, info)) {
+            return false;
+        }
+    }
+    xTaskNotifyGive(sender_task_);
+    return true;
+}
+
+void Protocol::SenderTask() {
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        OpusPacketInfo info;
+        while (outbound_audio_.Pop(outbound_packet_, &info)) {
+            // Queued before the channel or the chat state changed
+            if (info.epoch != audio_epoch_.load(std::memory_order_relaxed)) {
+                stale_count_++;
+                continue;
+            }
+            SendAudio(outbound_packet_);
+
+            uint32_t latency = (uint32_t)(esp_timer_get_time() / 1000) - info.timestamp;
+            total_latency_ms_ += latency;
+            if (latency > max_latency_ms_) {
+                max_latency_ms_ = latency;
+            }
+            if (++sent_count_ == LATENCY_REPORT_PACKETS) {
+                ESP_LOGI(TAG, "Mic to socket latency: avg %lu ms, max %lu ms, dropped %lu, stale %lu",
+                    (unsigned long)(total_latency_ms_ / sent_count_), (unsigned long)max_latency_ms_,
+                    (unsigned long)outbound_audio_.dropped_count(), (unsigned long)stale_count_);
+                sent_count_ = 0;
+                total_latency_ms_ = 0;
+                max_latency_ms_ = 0;
+            }
+        }
+    }
+}
+
+void Protocol::ReceiveAudio(uint32_t sequence, const uint8_t* data, size_t size) {
+    if (receiver_task_ == nullptr) {
+        return;
+    }
+    OpusPacketInfo info;
+    info.sequence = sequence;
+    info.timestamp = esp_timer_get_time() / 1000;
+    if (!inbound_audio_.Push(data, size, info)) {
+        ESP_LOGW(TAG, "Inbound audio queue full, dropping packet %lu", (unsigned long)sequence);
+        return;
+    }
+    xTaskNotifyGive(receiver_task_);
+}
+
+void Protocol::ReceiverTask() {
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        OpusPacketInfo info;
+        while (inbound_audio_.Pop(inbound_packet_, &info)) {
+            if (on_incoming_audio_ != nullptr) {
+                on_incoming_audio_(info.sequence, inbound_packet_.data(), inbound_packet_.size());
+            }
+        }
+    }
+}
+
+void Protocol::OnIncomingJson(const char* type, std::function<void(const JsonValue& root)> handler) {
+    for (size_t i = 0; i < json_handler_count_; i++) {
+        if (strcmp(json_handlers_[i].type, type) == 0) {
+            json_handlers_[i].handler = handler;
+            return;
+        }
+    }
+    if (json_handler_count_ == PROTOCOL_MAX_JSON_HANDLERS) {
+        ESP_LOGE(TAG, "Too many json handlers, %s is ignored", type);
+        return;
+    }
+    json_handlers_[json_handler_count_].type = type;
+    json_handlers_[json_handler_count_].handler = handler;
+    json_handler_count_++;
+}
+
+void Protocol::DispatchJson(const char* data, size_t length) {
+    if (!json_reader_.Parse(data, length)) {
+        ESP_LOGE(TAG, "Failed to parse json message: %s", json_reader_.error());
+        return;
+    }
+    auto root = json_reader_.root();
+    auto type = root["type"];
+    if (!type.IsString()) {
+        ESP_LOGE(TAG, "Missing message type, data: %.*s", (int)length, data);
+        return;
+    }
+    for (size_t i = 0; i < json_handler_count_; i++) {
+        if (type.Equals(json_handlers_[i].type)) {
+            json_handlers_[i].handler(root);
+            return;
+        }
+    }
+    ESP_LOGW(TAG, "Unhandled message type: %.*s", (int)type.length(), type.data());
 }
 
-void Protocol::OnIncomingAudio(std::function<void(std::vector<uint8_t>&& data)> callback) {
+void Protocol::OnIncomingAudio(std::function<void(uint32_t sequence, const uint8_t* data, size_t size)> callback) {
     on_incoming_audio_ = callback;
 }
 
@@ -25,46 +170,72 @@ void Protocol::OnNetworkError(std::function<void(const std::string& message)> ca
 }
 
 void Protocol::SendAbortSpeaking(AbortReason reason) {
-    std::string message = "{\"session_id\":\"" + session_id_ + "\",\"type\":\"abort\"";
+    JsonWriter writer(PROTOCOL_MESSAGE_CAPACITY);
+    writer.BeginObject();
+    writer.Key("session_id").String(session_id_);
+    writer.Key("type").String("abort");
     if (reason == kAbortReasonWakeWordDetected) {
-        message += ",\"reason\":\"wake_word_detected\"";
+        writer.Key("reason").String("wake_word_detected");
     }
-    message += "}";
-    SendText(message);
+    writer.EndObject();
+    SendText(writer.str());
 }
 
 void Protocol::SendWakeWordDetected(const std::string& wake_word) {
-    std::string json = "{\"session_id\":\"" + session_id_ + 
-                      "\",\"type\":\"listen\",\"state\":\"detect\",\"text\":\"" + wake_word + "\"}";
-    SendText(json);
+    JsonWriter writer(PROTOCOL_MESSAGE_CAPACITY);
+    writer.BeginObject();
+    writer.Key("session_id").String(session_id_);
+    writer.Key("type").String("listen");
+    writer.Key("state").String("detect");
+    writer.Key("text").String(wake_word);
+    writer.EndObject();
+    SendText(writer.str());
 }
 
 void Protocol::SendStartListening(ListeningMode mode) {
-    std::string message = "{\"session_id\":\"" + session_id_ + "\"";
-    message += ",\"type\":\"listen\",\"state\":\"start\"";
+    JsonWriter writer(PROTOCOL_MESSAGE_CAPACITY);
+    writer.BeginObject();
+    writer.Key("session_id").String(session_id_);
+    writer.Key("type").String("listen");
+    writer.Key("state").String("start");
     if (mode == kListeningModeAlwaysOn) {
-        message += ",\"mode\":\"realtime\"";
+        writer.Key("mode").String("realtime");
     } else if (mode == kListeningModeAutoStop) {
-        message += ",\"mode\":\"auto\"";
+        writer.Key("mode").String("auto");
     } else {
-        message += ",\"mode\":\"manual\"";
+        writer.Key("mode").String("manual");
     }
-    message += "}";
-    SendText(message);
+    writer.EndObject();
+    SendText(writer.str());
 }
 
 void Protocol::SendStopListening() {
-    std::string message = "{\"session_id\":\"" + session_id_ + "\",\"type\":\"listen\",\"state\":\"stop\"}";
-    SendText(message);
+    JsonWriter writer(PROTOCOL_MESSAGE_CAPACITY);
+    writer.BeginObject();
+    writer.Key("session_id").String(session_id_);
+    writer.Key("type").String("listen");
+    writer.Key("state").String("stop");
+    writer.EndObject();
+    SendText(writer.str());
 }
 
 void Protocol::SendIotDescriptors(const std::string& descriptors) {
-    std::string message = "{\"session_id\":\"" + session_id_ + "\",\"type\":\"iot\",\"descriptors\":" + descriptors + "}";
-    SendText(message);
+    JsonWriter writer(PROTOCOL_MESSAGE_CAPACITY + descriptors.size());
+    writer.BeginObject();
+    writer.Key("session_id").String(session_id_);
+    writer.Key("type").String("iot");
+    writer.Key("descriptors").Raw(descriptors);
+    writer.EndObject();
+    SendText(writer.str());
 }
 
 void Protocol::SendIotStates(const std::string& states) {
-    std::string message = "{\"session_id\":\"" + session_id_ + "\",\"type\":\"iot\",\"states\":" + states + "}";
-    SendText(message);
+    JsonWriter writer(PROTOCOL_MESSAGE_CAPACITY + states.size());
+    writer.BeginObject();
+    writer.Key("session_id").String(session_id_);
+    writer.Key("type").String("iot");
+    writer.Key("states").Raw(states);
+    writer.EndObject();
+    SendText(writer.str());
 }
 
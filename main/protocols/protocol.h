@@ -1,10 +1,41 @@
 #ifndef PROTOCOL_H
 #define PROTOCOL_H
 
-#include <cJSON.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
 #include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
 #include <functional>
 
+#include "opus_packet_queue.h"
+#include "json_writer.h"
+#include "json_reader.h"
+
+// Message types with a handler: hello, goodbye, tts, stt, llm and iot
+#define PROTOCOL_MAX_JSON_HANDLERS 8
+
+// Buffer reserved for a control message, without embedded IoT payloads
+#define PROTOCOL_MESSAGE_CAPACITY 128
+
+// Encoded uplink audio waiting for the sender task, about one second
+#define PROTOCOL_OUTBOUND_QUEUE_CAPACITY 16
+#if CONFIG_IDF_TARGET_ESP32S3
+#define PROTOCOL_OUTBOUND_MAX_PACKET_SIZE 1024
+#else
+#define PROTOCOL_OUTBOUND_MAX_PACKET_SIZE 512
+#endif
+
+// Downlink audio waiting for the receiver task. The network task never
+// waits for the speaker, so control messages behind the audio keep flowing.
+#if CONFIG_IDF_TARGET_ESP32S3
+#define PROTOCOL_INBOUND_QUEUE_CAPACITY 256
+#else
+#define PROTOCOL_INBOUND_QUEUE_CAPACITY 24
+#endif
+#define PROTOCOL_INBOUND_MAX_PACKET_SIZE PROTOCOL_OUTBOUND_MAX_PACKET_SIZE
+
 struct BinaryProtocol3 {
     uint8_t type;
     uint8_t reserved;
@@ -12,6 +43,23 @@ struct BinaryProtocol3 {
     uint8_t payload[];
 } __attribute__((packed));
 
+enum BinaryProtocol4Type {
+    kBinaryProtocol4Audio = 0,  // Opus packet
+    kBinaryProtocol4Json = 1    // Control message, same content as a text frame
+};
+
+// Multi-byte fields are in network byte order. Only audio frames are
+// numbered, from 1 on every new channel and in each direction separately.
+// JSON frames carry sequence 0, so a gap always means lost audio.
+struct BinaryProtocol4 {
+    uint8_t type;
+    uint8_t reserved;
+    uint16_t payload_size;
+    uint32_t sequence;      // Audio frames only, 0 for JSON
+    uint32_t timestamp;     // Milliseconds since the audio channel was opened
+    uint8_t payload[];
+} __attribute__((packed));
+
 enum AbortReason {
     kAbortReasonNone,
     kAbortReasonWakeWordDetected
@@ -23,24 +71,52 @@ enum ListeningMode {
     kListeningModeAlwaysOn // 需要 AEC 支持
 };
 
+// How long the last OpenAudioChannel() spent in each step
+struct AudioChannelTimings {
+    int64_t connect_us = 0;     // TCP and TLS handshake, or the MQTT reconnect
+    int64_t hello_us = 0;       // Hello sent until the server hello arrived
+};
+
 class Protocol {
 public:
-    virtual ~Protocol() = default;
+    Protocol();
+    virtual ~Protocol();
+
+    // Starts the sender and receiver tasks, call it once the protocol is fully constructed
+    void Start();
 
     inline int server_sample_rate() const {
         return server_sample_rate_;
     }
+    // Rate of the audio sent to the server, announced in the hello message
+    inline void SetSampleRate(int sample_rate) {
+        sample_rate_ = sample_rate;
+    }
+    inline const AudioChannelTimings& channel_timings() const {
+        return channel_timings_;
+    }
 
-    void OnIncomingAudio(std::function<void(std::vector<uint8_t>&& data)> callback);
-    void OnIncomingJson(std::function<void(const cJSON* root)> callback);
+    // Called on the receiver task, which may block in it to hold back the
+    // audio. The packet is only valid during the callback.
+    void OnIncomingAudio(std::function<void(uint32_t sequence, const uint8_t* data, size_t size)> callback);
+    // Routes control messages to a handler by their "type" field. The
+    // message is only valid during the call.
+    void OnIncomingJson(const char* type, std::function<void(const JsonValue& root)> handler);
     void OnAudioChannelOpened(std::function<void()> callback);
     void OnAudioChannelClosed(std::function<void()> callback);
     void OnNetworkError(std::function<void(const std::string& message)> callback);
 
     virtual bool OpenAudioChannel() = 0;
     virtual void CloseAudioChannel() = 0;
-    virtual bool IsAudioChannelOpened() const = 0;
+    // True once the server answered the hello, until the channel closes,
+    // disconnects or fails to open
+    bool IsAudioChannelOpened() const { return audio_channel_ready_; }
     virtual void SendAudio(const std::vector<uint8_t>& data) = 0;
+    // Thread safe, the packet is sent by the sender task. capture_time_ms is
+    // when the microphone audio was read, it is only used for latency stats.
+    // Packets of an epoch other than the current one are dropped unsent.
+    bool QueueAudio(const uint8_t* data, size_t size, uint32_t capture_time_ms, uint32_t epoch);
+    void SetAudioEpoch(uint32_t epoch);
     virtual void SendWakeWordDetected(const std::string& wake_word);
     virtual void SendStartListening(ListeningMode mode);
     virtual void SendStopListening();
@@ -49,16 +125,50 @@ public:
     virtual void SendIotStates(const std::string& states);
 
 protected:
-    std::function<void(const cJSON* root)> on_incoming_json_;
-    std::function<void(std::vector<uint8_t>&& data)> on_incoming_audio_;
+    std::function<void(uint32_t sequence, const uint8_t* data, size_t size)> on_incoming_audio_;
     std::function<void()> on_audio_channel_opened_;
     std::function<void()> on_audio_channel_closed_;
     std::function<void(const std::string& message)> on_network_error_;
 
     int server_sample_rate_ = 16000;
+    int sample_rate_ = 16000;
     std::string session_id_;
+    AudioChannelTimings channel_timings_;
+    std::atomic<bool> audio_channel_ready_{false};
 
     virtual void SendText(const std::string& text) = 0;
+    // Called from the network task that receives control messages
+    void DispatchJson(const char* data, size_t length);
+    // Called from the network task that receives audio, copies the packet
+    // for the receiver task and never blocks
+    void ReceiveAudio(uint32_t sequence, const uint8_t* data, size_t size);
+
+private:
+    struct JsonHandler {
+        const char* type = nullptr;
+        std::function<void(const JsonValue& root)> handler;
+    };
+
+    JsonHandler json_handlers_[PROTOCOL_MAX_JSON_HANDLERS];
+    size_t json_handler_count_ = 0;
+    JsonReader json_reader_;
+    OpusPacketQueue outbound_audio_;
+    std::atomic<uint32_t> audio_epoch_{0};
+    std::mutex outbound_producer_mutex_;
+    TaskHandle_t sender_task_ = nullptr;
+    std::vector<uint8_t> outbound_packet_;
+    OpusPacketQueue inbound_audio_;
+    TaskHandle_t receiver_task_ = nullptr;
+    std::vector<uint8_t> inbound_packet_;
+
+    // Mic to socket latency, reset after every report
+    uint32_t sent_count_ = 0;
+    uint32_t total_latency_ms_ = 0;
+    uint32_t max_latency_ms_ = 0;
+    uint32_t stale_count_ = 0;
+
+    void SenderTask();
+    void ReceiverTask();
 };
 
 #endif // PROTOCOL_H
@@ -4,16 +4,25 @@
 #include "application.h"
 
 #include <cstring>
-#include <cJSON.h>
 #include <esp_log.h>
+#include <esp_timer.h>
 #include <arpa/inet.h>
 
 #define TAG "WS"
 
+#ifdef CONFIG_WEBSOCKET_BINARY_PROTOCOL_V4
+#define WEBSOCKET_PROTOCOL_VERSION 4
+#else
+#define WEBSOCKET_PROTOCOL_VERSION 1
+#endif
+
 #ifdef CONFIG_CONNECTION_TYPE_WEBSOCKET
 
 WebsocketProtocol::WebsocketProtocol() {
     event_group_handle_ = xEventGroupCreate();
+    OnIncomingJson("hello", [this](const JsonValue& root) {
+        ParseServerHello(root);
+    });
 }
 
 WebsocketProtocol::~WebsocketProtocol() {
@@ -24,26 +33,85 @@ WebsocketProtocol::~WebsocketProtocol() {
 }
 
 void WebsocketProtocol::SendAudio(const std::vector<uint8_t>& data) {
+    std::lock_guard<std::mutex> lock(channel_mutex_);
     if (websocket_ == nullptr) {
         return;
     }
 
-    websocket_->Send(data.data(), data.size(), true);
+    if (version_ == 4) {
+        SendFrame(kBinaryProtocol4Audio, data.data(), data.size());
+    } else {
+        websocket_->Send(data.data(), data.size(), true);
+    }
 }
 
 void WebsocketProtocol::SendText(const std::string& text) {
+    std::lock_guard<std::mutex> lock(channel_mutex_);
     if (websocket_ == nullptr) {
         return;
     }
 
-    websocket_->Send(text);
+    if (version_ == 4) {
+        SendFrame(kBinaryProtocol4Json, (const uint8_t*)text.data(), text.size());
+    } else {
+        websocket_->Send(text);
+    }
+}
+
+// Called with channel_mutex_ held
+bool WebsocketProtocol::SendFrame(BinaryProtocol4Type type, const uint8_t* payload, size_t size) {
+    if (size > UINT16_MAX) {
+        ESP_LOGE(TAG, "Payload too large: %zu", size);
+        return false;
+    }
+    tx_buffer_.resize(sizeof(BinaryProtocol4) + size);
+    auto frame = (BinaryProtocol4*)tx_buffer_.data();
+    frame->type = type;
+    frame->reserved = 0;
+    frame->payload_size = htons(size);
+    frame->sequence = htonl(type == kBinaryProtocol4Audio ? ++local_sequence_ : 0);
+    frame->timestamp = htonl((uint32_t)((esp_timer_get_time() - channel_open_time_) / 1000));
+    memcpy(frame->payload, payload, size);
+    return websocket_->Send(tx_buffer_.data(), tx_buffer_.size(), true);
+}
+
+void WebsocketProtocol::OnBinaryData(const uint8_t* data, size_t len) {
+    if (version_ != 4) {
+        // Websocket frames arrive in order, number them as they come
+        ReceiveAudio(++remote_sequence_, data, len);
+        return;
+    }
+
+    auto frame = (const BinaryProtocol4*)data;
+    if (len < sizeof(BinaryProtocol4) || len - sizeof(BinaryProtocol4) < ntohs(frame->payload_size)) {
+        ESP_LOGE(TAG, "Invalid frame size: %zu", len);
+        return;
+    }
+    size_t payload_size = ntohs(frame->payload_size);
+    uint32_t sequence = ntohl(frame->sequence);
+    if (frame->type == kBinaryProtocol4Audio) {
+        if (sequence != remote_sequence_ + 1) {
+            ESP_LOGW(TAG, "Received audio frame with sequence %lu, expected %lu",
+                (unsigned long)sequence, (unsigned long)remote_sequence_ + 1);
+        }
+        if (sequence > remote_sequence_) {
+            remote_sequence_ = sequence;
+        }
+        ReceiveAudio(sequence, frame->payload, payload_size);
+    } else if (frame->type == kBinaryProtocol4Json) {
+        OnJsonData((const char*)frame->payload, payload_size);
+    } else {
+        ESP_LOGW(TAG, "Unknown frame type: %u", frame->type);
+    }
 }
 
-bool WebsocketProtocol::IsAudioChannelOpened() const {
-    return websocket_ != nullptr;
+void WebsocketProtocol::OnJsonData(const char* data, size_t len) {
+    DispatchJson(data, len);
 }
 
 void WebsocketProtocol::CloseAudioChannel() {
+    audio_channel_ready_ = false;
+    std::lock_guard<std::mutex> lock(channel_mutex_);
     if (websocket_ != nullptr) {
         delete websocket_;
         websocket_ = nullptr;
@@ -51,49 +119,45 @@ void WebsocketProtocol::CloseAudioChannel() {
 }
 
 bool WebsocketProtocol::OpenAudioChannel() {
+    audio_channel_ready_ = false;
+    std::unique_lock<std::mutex> lock(channel_mutex_);
     if (websocket_ != nullptr) {
         delete websocket_;
     }
 
     std::string url = CONFIG_WEBSOCKET_URL;
     std::string token = "Bearer " + std::string(CONFIG_WEBSOCKET_ACCESS_TOKEN);
+    remote_sequence_ = 0;
+    local_sequence_ = 0;
+    version_ = 1;
+    channel_open_time_ = esp_timer_get_time();
     websocket_ = Board::GetInstance().CreateWebSocket();
+    lock.unlock();
     websocket_->SetHeader("Authorization", token.c_str());
-    websocket_->SetHeader("Protocol-Version", "1");
+    websocket_->SetHeader("Protocol-Version", std::to_string(WEBSOCKET_PROTOCOL_VERSION).c_str());
     websocket_->SetHeader("Device-Id", SystemInfo::GetMacAddress().c_str());
 
     websocket_->OnData([this](const char* data, size_t len, bool binary) {
         if (binary) {
-            if (on_incoming_audio_ != nullptr) {
-                on_incoming_audio_(std::vector<uint8_t>((uint8_t*)data, (uint8_t*)data + len));
-            }
+            OnBinaryData((const uint8_t*)data, len);
         } else {
-            // Parse JSON data
-            auto root = cJSON_Parse(data);
-            auto type = cJSON_GetObjectItem(root, "type");
-            if (type != NULL) {
-                if (strcmp(type->valuestring, "hello") == 0) {
-                    ParseServerHello(root);
-                } else {
-                    if (on_incoming_json_ != nullptr) {
-                        on_incoming_json_(root);
-                    }
-                }
-            } else {
-                ESP_LOGE(TAG, "Missing message type, data: %s", data);
-            }
-            cJSON_Delete(root);
+            OnJsonData(data, len);
         }
     });
 
     websocket_->OnDisconnected([this]() {
         ESP_LOGI(TAG, "Websocket disconnected");
+        audio_channel_ready_ = false;
         if (on_audio_channel_closed_ != nullptr) {
             on_audio_channel_closed_();
         }
     });
 
-    if (!websocket_->Connect(url.c_str())) {
+    channel_timings_ = AudioChannelTimings();
+    int64_t connect_start = esp_timer_get_time();
+    bool connected = websocket_->Connect(url.c_str());
+    Board::GetInstance().RecordConnect(kConnectionWebSocket, esp_timer_get_time() - connect_start, connected);
+    if (!connected) {
         ESP_LOGE(TAG, "Failed to connect to websocket server");
         if (on_network_error_ != nullptr) {
             on_network_error_("无法连接服务");
@@ -103,14 +167,21 @@ bool WebsocketProtocol::OpenAudioChannel() {
 
     // Send hello message to describe the client
     // keys: message type, version, audio_params (format, sample_rate, channels)
-    std::string message = "{";
-    message += "\"type\":\"hello\",";
-    message += "\"version\": 1,";
-    message += "\"transport\":\"websocket\",";
-    message += "\"audio_params\":{";
-    message += "\"format\":\"opus\", \"sample_rate\":16000, \"channels\":1, \"frame_duration\":" + std::to_string(OPUS_FRAME_DURATION_MS);
-    message += "}}";
-    websocket_->Send(message);
+    JsonWriter writer(PROTOCOL_MESSAGE_CAPACITY);
+    writer.BeginObject();
+    writer.Key("type").String("hello");
+    writer.Key("version").Number(WEBSOCKET_PROTOCOL_VERSION);
+    writer.Key("transport").String("websocket");
+    writer.Key("audio_params").BeginObject();
+    writer.Key("format").String("opus");
+    writer.Key("sample_rate").Number(sample_rate_);
+    writer.Key("channels").Number(1);
+    writer.Key("frame_duration").Number(OPUS_FRAME_DURATION_MS);
+    writer.EndObject();
+    writer.EndObject();
+    int64_t hello_start = esp_timer_get_time();
+    channel_timings_.connect_us = hello_start - connect_start;
+    websocket_->Send(writer.str());
 
     // Wait for server hello
     EventBits_t bits = xEventGroupWaitBits(event_group_handle_, WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT, pdTRUE, pdFALSE, pdMS_TO_TICKS(10000));
@@ -121,6 +192,8 @@ bool WebsocketProtocol::OpenAudioChannel() {
         }
         return false;
     }
+    channel_timings_.hello_us = esp_timer_get_time() - hello_start;
+    audio_channel_ready_ = true;
 
     if (on_audio_channel_opened_ != nullptr) {
         on_audio_channel_opened_();
@@ -129,19 +202,22 @@ bool WebsocketProtocol::OpenAudioChannel() {
     return true;
 }
 
-void WebsocketProtocol::ParseServerHello(const cJSON* root) {
-    auto transport = cJSON_GetObjectItem(root, "transport");
-    if (transport == nullptr || strcmp(transport->valuestring, "websocket") != 0) {
-        ESP_LOGE(TAG, "Unsupported transport: %s", transport->valuestring);
+void WebsocketProtocol::ParseServerHello(const JsonValue& root) {
+    auto transport = root["transport"];
+    if (!transport.Equals("websocket")) {
+        ESP_LOGE(TAG, "Unsupported transport: %.*s", (int)transport.length(), transport.data());
         return;
     }
 
-    auto audio_params = cJSON_GetObjectItem(root, "audio_params");
-    if (audio_params != NULL) {
-        auto sample_rate = cJSON_GetObjectItem(audio_params, "sample_rate");
-        if (sample_rate != NULL) {
-            server_sample_rate_ = sample_rate->valueint;
-        }
+    auto sample_rate = root["audio_params"]["sample_rate"];
+    if (sample_rate.IsNumber()) {
+        server_sample_rate_ = sample_rate.ToInt();
+    }
+
+    // Framing is only switched on when the server answers with the same version
+    if (WEBSOCKET_PROTOCOL_VERSION == 4 && root["version"].ToInt() == 4) {
+        version_ = 4;
+        ESP_LOGI(TAG, "Using binary protocol version 4");
     }
 
     xEventGroupSetBits(event_group_handle_, WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT);
@@ -7,6 +7,8 @@
 #include <web_socket.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/event_groups.h>
+#include <mutex>
+#include <atomic>
 
 #define WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT (1 << 0)
 
@@ -18,13 +20,24 @@ public:
     void SendAudio(const std::vector<uint8_t>& data) override;
     bool OpenAudioChannel() override;
     void CloseAudioChannel() override;
-    bool IsAudioChannelOpened() const override;
 
 private:
     EventGroupHandle_t event_group_handle_;
+    // Guards websocket_, audio is sent from the protocol sender task
+    std::mutex channel_mutex_;
     WebSocket* websocket_ = nullptr;
-
-    void ParseServerHello(const cJSON* root);
+    uint32_t remote_sequence_ = 0;
+    // Binary protocol version 4 state, only used after the server agreed to it
+    std::atomic<int> version_{1};
+    uint32_t local_sequence_ = 0;  // Of audio frames, JSON frames are not numbered
+    int64_t channel_open_time_ = 0;
+    std::vector<uint8_t> tx_buffer_;
+
+    void OnBinaryData(const uint8_t* data, size_t len);
+    void OnJsonData(const char* data, size_t len);
+    bool SendFrame(BinaryProtocol4Type type, const uint8_t* payload, size_t size);
+
+    void ParseServerHello(const JsonValue& root);
     void SendText(const std::string& text) override;
 };
 
@@ -0,0 +1,141 @@
+#! /usr/bin/env python3
+# Make and apply delta images for OTA, see main/ota_patch.h for the format
+import sys
+import struct
+import hashlib
+
+MAGIC = b"XZDP"
+OP_END = 0
+OP_COPY = 1
+OP_DATA = 2
+
+BLOCK_SIZE = 16     # Source is indexed at this stride
+MIN_COPY = 32       # Shorter matches cost more than they save
+
+
+def match_length(source, source_pos, target, target_pos):
+    length = 0
+    limit = min(len(source) - source_pos, len(target) - target_pos)
+    # Compare in large steps first, then byte by byte
+    step = 256
+    while length + step <= limit and source[source_pos + length:source_pos + length + step] == target[target_pos + length:target_pos + length + step]:
+        length += step
+    while length < limit and source[source_pos + length] == target[target_pos + length]:
+        length += 1
+    return length
+
+
+def make_patch(source, target):
+    index = {}
+    for i in range(0, len(source) - BLOCK_SIZE + 1, BLOCK_SIZE):
+        index.setdefault(source[i:i + BLOCK_SIZE], i)
+
+    ops = []
+    pending = bytearray()
+    expected = 0    # Where the last copy ended, small edits keep the rest aligned
+    pos = 0
+    while pos < len(target):
+        best_source, best_length = 0, 0
+        candidates = [expected]
+        found = index.get(target[pos:pos + BLOCK_SIZE])
+        if found is not None:
+            candidates.append(found)
+        for candidate in candidates:
+            if candidate < len(source):
+                length = match_length(source, candidate, target, pos)
+                if length > best_length:
+                    best_source, best_length = candidate, length
+        if best_length >= MIN_COPY:
+            if pending:
+                ops.append((OP_DATA, bytes(pending)))
+                pending = bytearray()
+            ops.append((OP_COPY, best_source, best_length))
+            pos += best_length
+            expected = best_source + best_length
+        else:
+            pending.append(target[pos])
+            pos += 1
+            expected += 1
+    if pending:
+        ops.append((OP_DATA, bytes(pending)))
+
+    out = bytearray(MAGIC + struct.pack("<II", len(target), len(source)))
+    for op in ops:
+        if op[0] == OP_COPY:
+            out += struct.pack("<BII", OP_COPY, op[1], op[2])
+        else:
+            out += struct.pack("<BI", OP_DATA, len(op[1])) + op[1]
+    out += struct.pack("<B", OP_END)
+    return bytes(out)
+
+
+def apply_patch(source, patch):
+    if patch[:4] != MAGIC:
+        raise Exception("Invalid patch magic")
+    target_size, source_size = struct.unpack("<II", patch[4:12])
+    if source_size > len(source):
+        raise Exception("Source image is too small")
+    out = bytearray()
+    pos = 12
+    while True:
+        op = patch[pos]
+        pos += 1
+        if op == OP_END:
+            break
+        if op == OP_COPY:
+            offset, length = struct.unpack("<II", patch[pos:pos + 8])
+            pos += 8
+            if offset + length > source_size:
+                raise Exception("Copy outside source")
+            out += source[offset:offset + length]
+        elif op == OP_DATA:
+            length = struct.unpack("<I", patch[pos:pos + 4])[0]
+            pos += 4
+            out += patch[pos:pos + length]
+            pos += length
+        else:
+            raise Exception(f"Unknown op {op}")
+    if len(out) != target_size or pos != len(patch):
+        raise Exception("Patch size mismatch")
+    return bytes(out)
+
+
+def read_file(path):
+    with open(path, "rb") as f:
+        return f.read()
+
+
+def write_file(path, data):
+    with open(path, "wb") as f:
+        f.write(data)
+
+
+def usage():
+    print("usage: ota_patch.py diff <old.bin> <new.bin> <out.patch>")
+    print("       ota_patch.py apply <old.bin> <in.patch> <out.bin>")
+    print("       ota_patch.py verify <old.bin> <new.bin> <in.patch>")
+    sys.exit(1)
+
+
+if __name__ == "__main__":
+    if len(sys.argv) != 5:
+        usage()
+    command = sys.argv[1]
+    if command == "diff":
+        source, target = read_file(sys.argv[2]), read_file(sys.argv[3])
+        patch = make_patch(source, target)
+        if apply_patch(source, patch) != target:
+            print("round trip failed")
+            sys.exit(1)
+        write_file(sys.argv[4], patch)
+        print(f"patch {len(patch)} bytes, {len(patch) * 100 // len(target)}% of {len(target)}")
+        print("sha256:", hashlib.sha256(target).hexdigest())
+    elif command == "apply":
+        write_file(sys.argv[4], apply_patch(read_file(sys.argv[2]), read_file(sys.argv[3])))
+    elif command == "verify":
+        if apply_patch(read_file(sys.argv[2]), read_file(sys.argv[4])) != read_file(sys.argv[3]):
+            print("verify failed")
+            sys.exit(1)
+        print("verify ok")
+    else:
+        usage()
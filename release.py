@@ -1,6 +1,7 @@
 import sys
 import os
 import json
+import struct
 
 
 def get_board_type():
@@ -22,6 +23,59 @@ def get_project_version():
                 return line.split("\"")[1].split("\"")[0].strip()
     return None
 
+OTA_COMPRESSED_MAGIC = b"XZLZ"
+OTA_WINDOW_BITS = 12    # 4 KB on the device, see main/ota_decompressor.h
+OTA_MIN_MATCH = 4
+
+def write_length(out, length):
+    while length >= 255:
+        out.append(255)
+        length -= 255
+    out.append(length)
+
+def write_sequence(out, literals, match_length, offset):
+    literal_nibble = min(len(literals), 15)
+    match_nibble = min(match_length - OTA_MIN_MATCH, 15) if offset else 0
+    out.append(literal_nibble << 4 | match_nibble)
+    if literal_nibble == 15:
+        write_length(out, len(literals) - 15)
+    out += literals
+    if offset:
+        out += struct.pack("<H", offset)
+        if match_nibble == 15:
+            write_length(out, match_length - OTA_MIN_MATCH - 15)
+
+def compress_image(data, window_bits=OTA_WINDOW_BITS):
+    window = 1 << window_bits
+    out = bytearray(OTA_COMPRESSED_MAGIC + struct.pack("<B3xI", window_bits, len(data)))
+    table = {}
+    literal_start = 0
+    pos = 0
+    while pos + OTA_MIN_MATCH <= len(data):
+        key = data[pos:pos + OTA_MIN_MATCH]
+        candidate = table.get(key)
+        table[key] = pos
+        if candidate is None or pos - candidate > window:
+            pos += 1
+            continue
+        length = OTA_MIN_MATCH
+        while pos + length < len(data) and data[candidate + length] == data[pos + length]:
+            length += 1
+        write_sequence(out, data[literal_start:pos], length, pos - candidate)
+        pos += length
+        literal_start = pos
+    write_sequence(out, data[literal_start:], 0, 0)
+    return bytes(out)
+
+def pack_ota_image(board_type, project_version):
+    with open("build/xiaozhi.bin", "rb") as f:
+        data = f.read()
+    packed = compress_image(data)
+    output_path = f"releases/v{project_version}_{board_type}.xzlz"
+    with open(output_path, "wb") as f:
+        f.write(packed)
+    print(f"pack ota image to {output_path} done, {len(packed)}/{len(data)} bytes")
+
 def merge_bin():
     if os.system("idf.py merge-bin") != 0:
         print("merge bin failed")
@@ -46,3 +100,4 @@ if __name__ == "__main__":
     project_version = get_project_version()
     print("project version:", project_version)
     zip_bin(board_type, project_version)
+    pack_ota_image(board_type, project_version)
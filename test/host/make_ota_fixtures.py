@@ -0,0 +1,65 @@
+#! /usr/bin/env python3
+# Writes OTA images, patches and compressed streams for the OTA host tests,
+# made by the same code that makes them for a release
+import os
+import sys
+import random
+
+ROOT = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "..")
+sys.path.insert(0, ROOT)
+# Keep __pycache__ out of the source tree
+sys.dont_write_bytecode = True
+
+from ota_patch import make_patch, apply_patch
+from release import compress_image
+
+
+def make_images(rng):
+    # Firmware like data: random code with repeated tables and zero padding
+    table = bytes(rng.getrandbits(8) for _ in range(512))
+    source = bytearray()
+    while len(source) < 192 * 1024:
+        source += bytes(rng.getrandbits(8) for _ in range(rng.randint(64, 4096)))
+        source += table * rng.randint(1, 4)
+        source += bytes(rng.randint(0, 2048))
+
+    # The next version moves, edits, inserts and drops pieces
+    target = bytearray(source)
+    for _ in range(40):
+        pos = rng.randrange(len(target))
+        action = rng.randrange(3)
+        if action == 0:
+            target[pos:pos + 16] = bytes(rng.getrandbits(8) for _ in range(16))
+        elif action == 1:
+            target[pos:pos] = bytes(rng.getrandbits(8) for _ in range(rng.randint(1, 300)))
+        else:
+            del target[pos:pos + rng.randint(1, 300)]
+    target += bytes(rng.getrandbits(8) for _ in range(3000))
+    return bytes(source), bytes(target)
+
+
+def write_file(path, data):
+    with open(path, "wb") as f:
+        f.write(data)
+
+
+if __name__ == "__main__":
+    if len(sys.argv) != 2:
+        print("usage: make_ota_fixtures.py <output dir>")
+        sys.exit(1)
+    out = sys.argv[1]
+    os.makedirs(out, exist_ok=True)
+
+    source, target = make_images(random.Random(20240601))
+    patch = make_patch(source, target)
+    assert apply_patch(source, patch) == target
+    write_file(os.path.join(out, "source.bin"), source)
+    write_file(os.path.join(out, "target.bin"), target)
+    write_file(os.path.join(out, "target.patch"), patch)
+
+    # Long runs exercise the length extensions, small windows the wrap around
+    write_file(os.path.join(out, "target.xzlz"), compress_image(target))
+    write_file(os.path.join(out, "target_w8.xzlz"), compress_image(target, 8))
+    runs = bytes(70000) + b"abc" * 3000 + bytes(range(256)) * 64
+    write_file(os.path.join(out, "runs.bin"), runs)
+    write_file(os.path.join(out, "runs.xzlz"), compress_image(runs, 15))
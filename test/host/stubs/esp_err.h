@@ -0,0 +1,13 @@
+#ifndef ESP_ERR_H
+#define ESP_ERR_H
+
+#include <cassert>
+
+typedef int esp_err_t;
+
+#define ESP_OK 0
+#define ESP_FAIL -1
+
+#define ESP_ERROR_CHECK(x) do { esp_err_t err_ = (x); assert(err_ == ESP_OK); (void)err_; } while (0)
+
+#endif // ESP_ERR_H
@@ -0,0 +1,25 @@
+#ifndef ESP_HEAP_CAPS_H
+#define ESP_HEAP_CAPS_H
+
+#include <cstdlib>
+#include <cstdint>
+
+// The host has one heap, the capabilities are ignored
+#define MALLOC_CAP_8BIT     (1 << 2)
+#define MALLOC_CAP_DMA      (1 << 3)
+#define MALLOC_CAP_SPIRAM   (1 << 10)
+#define MALLOC_CAP_INTERNAL (1 << 11)
+
+inline void* heap_caps_malloc(size_t size, uint32_t caps) {
+    return malloc(size);
+}
+
+inline void* heap_caps_calloc(size_t n, size_t size, uint32_t caps) {
+    return calloc(n, size);
+}
+
+inline void heap_caps_free(void* ptr) {
+    free(ptr);
+}
+
+#endif // ESP_HEAP_CAPS_H
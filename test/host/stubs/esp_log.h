@@ -0,0 +1,14 @@
+#ifndef ESP_LOG_H
+#define ESP_LOG_H
+
+#include <cstdio>
+
+#define ESP_LOG_HOST(level, tag, format, ...) fprintf(stderr, level " (%s) " format "\n", tag, ##__VA_ARGS__)
+
+#define ESP_LOGE(tag, format, ...) ESP_LOG_HOST("E", tag, format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) ESP_LOG_HOST("W", tag, format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) ESP_LOG_HOST("I", tag, format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) do {} while (0)
+#define ESP_LOGV(tag, format, ...) do {} while (0)
+
+#endif // ESP_LOG_H
@@ -0,0 +1,22 @@
+#ifndef ESP_PARTITION_H
+#define ESP_PARTITION_H
+
+#include "esp_err.h"
+
+#include <cstddef>
+#include <cstdint>
+
+#define SPI_FLASH_SEC_SIZE 4096
+
+typedef struct {
+    uint32_t address;
+    uint32_t size;
+    uint32_t erase_size;
+    char label[17];
+    bool encrypted;
+} esp_partition_t;
+
+// Defined by the tests that read partitions, backed by host memory
+esp_err_t esp_partition_read(const esp_partition_t* partition, size_t src_offset, void* dst, size_t size);
+
+#endif // ESP_PARTITION_H
@@ -0,0 +1,15 @@
+#ifndef FREERTOS_H
+#define FREERTOS_H
+
+#include <cstdint>
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+
+// One tick per millisecond
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+#define portMAX_DELAY ((TickType_t)0xffffffff)
+#define pdTRUE 1
+#define pdFALSE 0
+
+#endif // FREERTOS_H
@@ -0,0 +1,49 @@
+#ifndef FREERTOS_SEMPHR_H
+#define FREERTOS_SEMPHR_H
+
+#include "FreeRTOS.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+
+// Binary semaphores only, that is all the code under test uses
+struct HostSemaphore {
+    std::mutex mutex;
+    std::condition_variable condition;
+    bool given = false;
+};
+
+typedef HostSemaphore* SemaphoreHandle_t;
+
+inline SemaphoreHandle_t xSemaphoreCreateBinary() {
+    return new HostSemaphore();
+}
+
+inline void vSemaphoreDelete(SemaphoreHandle_t semaphore) {
+    delete semaphore;
+}
+
+inline BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore) {
+    std::lock_guard<std::mutex> lock(semaphore->mutex);
+    if (semaphore->given) {
+        return pdFALSE;
+    }
+    semaphore->given = true;
+    semaphore->condition.notify_one();
+    return pdTRUE;
+}
+
+inline BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks) {
+    std::unique_lock<std::mutex> lock(semaphore->mutex);
+    auto given = [semaphore] { return semaphore->given; };
+    if (ticks == portMAX_DELAY) {
+        semaphore->condition.wait(lock, given);
+    } else if (!semaphore->condition.wait_for(lock, std::chrono::milliseconds(ticks), given)) {
+        return pdFALSE;
+    }
+    semaphore->given = false;
+    return pdTRUE;
+}
+
+#endif // FREERTOS_SEMPHR_H
@@ -0,0 +1,18 @@
+#ifndef FREERTOS_TASK_H
+#define FREERTOS_TASK_H
+
+#include "FreeRTOS.h"
+
+#include <chrono>
+#include <thread>
+
+inline TickType_t xTaskGetTickCount() {
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return (TickType_t)std::chrono::duration_cast<std::chrono::milliseconds>(now).count();
+}
+
+inline void vTaskDelay(TickType_t ticks) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(ticks));
+}
+
+#endif // FREERTOS_TASK_H
@@ -0,0 +1,57 @@
+#ifndef MBEDTLS_AES_H
+#define MBEDTLS_AES_H
+
+#include <openssl/evp.h>
+
+#include <cstddef>
+#include <cstring>
+
+// The block cipher comes from OpenSSL, the CTR mode on top is written out
+// the way mbedtls does it, including the partial block state
+#define MBEDTLS_ERR_AES_INVALID_KEY_LENGTH -0x0020
+
+typedef struct {
+    EVP_CIPHER_CTX* ctx;
+} mbedtls_aes_context;
+
+inline void mbedtls_aes_init(mbedtls_aes_context* aes) {
+    aes->ctx = EVP_CIPHER_CTX_new();
+}
+
+inline void mbedtls_aes_free(mbedtls_aes_context* aes) {
+    EVP_CIPHER_CTX_free(aes->ctx);
+    aes->ctx = nullptr;
+}
+
+inline int mbedtls_aes_setkey_enc(mbedtls_aes_context* aes, const unsigned char* key, unsigned int keybits) {
+    if (keybits != 128) {
+        return MBEDTLS_ERR_AES_INVALID_KEY_LENGTH;
+    }
+    if (EVP_EncryptInit_ex(aes->ctx, EVP_aes_128_ecb(), nullptr, key, nullptr) != 1) {
+        return MBEDTLS_ERR_AES_INVALID_KEY_LENGTH;
+    }
+    EVP_CIPHER_CTX_set_padding(aes->ctx, 0);
+    return 0;
+}
+
+inline int mbedtls_aes_crypt_ctr(mbedtls_aes_context* aes, size_t length, size_t* nc_off,
+    unsigned char nonce_counter[16], unsigned char stream_block[16], const unsigned char* input, unsigned char* output) {
+    size_t n = *nc_off;
+    for (size_t i = 0; i < length; i++) {
+        if (n == 0) {
+            int out_length = 0;
+            EVP_EncryptUpdate(aes->ctx, stream_block, &out_length, nonce_counter, 16);
+            for (int c = 15; c >= 0; c--) {
+                if (++nonce_counter[c] != 0) {
+                    break;
+                }
+            }
+        }
+        output[i] = input[i] ^ stream_block[n];
+        n = (n + 1) & 0x0F;
+    }
+    *nc_off = n;
+    return 0;
+}
+
+#endif // MBEDTLS_AES_H
@@ -0,0 +1,6 @@
+#ifndef SDKCONFIG_H
+#define SDKCONFIG_H
+
+// No target is defined, the code under test takes its generic paths
+
+#endif // SDKCONFIG_H
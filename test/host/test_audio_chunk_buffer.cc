@@ -0,0 +1,81 @@
+#include "audio_chunk_buffer.h"
+
+#include <cassert>
+#include <cstdio>
+#include <vector>
+
+static std::vector<int16_t> Ramp(int16_t start, size_t samples) {
+    std::vector<int16_t> data(samples);
+    for (size_t i = 0; i < samples; i++) {
+        data[i] = start + i;
+    }
+    return data;
+}
+
+static void TestChunking() {
+    AudioChunkBuffer buffer;
+    buffer.Initialize(4, 3);
+    assert(buffer.ReadChunk() == nullptr);
+
+    auto input = Ramp(0, 6);
+    assert(buffer.Write(input.data(), 3) == 3);
+    assert(buffer.ReadChunk() == nullptr);
+    assert(buffer.Write(input.data() + 3, 3) == 3);
+    assert(buffer.available() == 6);
+
+    auto chunk = buffer.ReadChunk();
+    assert(chunk != nullptr);
+    for (int i = 0; i < 4; i++) {
+        assert(chunk[i] == i);
+    }
+    assert(buffer.ReadChunk() == nullptr);
+    assert(buffer.available() == 2);
+}
+
+// Frames that do not divide the chunk size wrap around the end of the
+// buffer, chunks still come out whole and in order
+static void TestWrapAround() {
+    AudioChunkBuffer buffer;
+    buffer.Initialize(4, 3);
+    int16_t next_in = 0;
+    int16_t next_out = 0;
+    for (int round = 0; round < 50; round++) {
+        auto input = Ramp(next_in, 5);
+        size_t accepted = buffer.Write(input.data(), input.size());
+        next_in += accepted;
+        while (auto chunk = buffer.ReadChunk()) {
+            for (size_t i = 0; i < buffer.chunk_samples(); i++) {
+                assert(chunk[i] == next_out++);
+            }
+        }
+    }
+    assert(next_out > 200);
+}
+
+static void TestFull() {
+    AudioChunkBuffer buffer;
+    buffer.Initialize(4, 2);
+    auto input = Ramp(0, 10);
+    // Only the capacity is accepted, the caller writes the rest later
+    assert(buffer.Write(input.data(), input.size()) == 8);
+    assert(buffer.Write(input.data() + 8, 2) == 0);
+    assert(buffer.ReadChunk()[0] == 0);
+    assert(buffer.Write(input.data() + 8, 2) == 2);
+    assert(buffer.ReadChunk()[0] == 4);
+    auto chunk = buffer.ReadChunk();
+    assert(chunk == nullptr);
+    assert(buffer.available() == 2);
+
+    buffer.Reset();
+    assert(buffer.available() == 0);
+    assert(buffer.Write(input.data(), 4) == 4);
+    assert(buffer.ReadChunk()[3] == 3);
+}
+
+int main() {
+    TestChunking();
+    TestWrapAround();
+    TestFull();
+    printf("test_audio_chunk_buffer passed\n");
+    return 0;
+}
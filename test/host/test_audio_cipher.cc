@@ -0,0 +1,95 @@
+#include "audio_cipher.h"
+
+#include <arpa/inet.h>
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+static std::vector<uint8_t> FromHex(const char* hex) {
+    std::vector<uint8_t> bytes;
+    for (size_t i = 0; hex[i] != '\0' && hex[i + 1] != '\0'; i += 2) {
+        bytes.push_back(std::stoi(std::string(hex + i, 2), nullptr, 16));
+    }
+    return bytes;
+}
+
+static std::string KeyFromHex(const char* hex) {
+    auto bytes = FromHex(hex);
+    return std::string(bytes.begin(), bytes.end());
+}
+
+// NIST SP 800-38A F.5.1, CTR-AES128.Encrypt
+static void TestNistVector() {
+    AesCtrCipher cipher;
+    assert(cipher.SetKey(KeyFromHex("2b7e151628aed2a6abf7158809cf4f3c")));
+    auto counter = FromHex("f0f1f2f3f4f5f6f7f8f9fafbfcfdfeff");
+    auto plaintext = FromHex(
+        "6bc1bee22e409f96e93d7e117393172a" "ae2d8a571e03ac9c9eb76fac45af8e51"
+        "30c81c46a35ce411e5fbc1191a0a52ef" "f69f2445df4f9b17ad2b417be66c3710");
+    auto ciphertext = FromHex(
+        "874d6191b620e3261bef6864990db6ce" "9806f66b7970fdff8617187bb9fffdff"
+        "5ae4df3edbd5d35e5b4f09020db03eab" "1e031dda2fbe03d1792170a0f3009cee");
+
+    std::vector<uint8_t> output(plaintext.size());
+    assert(cipher.Crypt(counter.data(), plaintext.data(), output.data(), plaintext.size()));
+    assert(output == ciphertext);
+    // The header is not advanced, the same call decrypts
+    assert(counter == FromHex("f0f1f2f3f4f5f6f7f8f9fafbfcfdfeff"));
+    assert(cipher.Crypt(counter.data(), output.data(), output.data(), output.size()));
+    assert(output == plaintext);
+}
+
+// A datagram as MqttProtocol builds it: the server nonce with the payload
+// size in bytes 2-3 and the sequence in bytes 12-15, big endian. The
+// expected bytes come from openssl enc -aes-128-ctr with the header as IV.
+static std::vector<uint8_t> Header(uint16_t size, uint32_t sequence) {
+    auto header = FromHex("0100ffff00000000a1b2c3d4e5f60718");
+    *(uint16_t*)&header[2] = htons(size);
+    *(uint32_t*)&header[12] = htonl(sequence);
+    return header;
+}
+
+static void TestWireFormat() {
+    AesCtrCipher cipher;
+    assert(cipher.SetKey(KeyFromHex("00112233445566778899aabbccddeeff")));
+    std::vector<uint8_t> payload(40);
+    for (size_t i = 0; i < payload.size(); i++) {
+        payload[i] = i;
+    }
+
+    auto header = Header(payload.size(), 7);
+    assert(header == FromHex("0100002800000000a1b2c3d400000007"));
+    std::vector<uint8_t> datagram(payload);
+    assert(cipher.Crypt(header.data(), datagram.data(), datagram.data(), datagram.size()));
+    assert(datagram == FromHex("25231c15b3d5c9bd5b4ea43deaecc5e72da2287570b211b3c10fcd8bffbef2530d29163ae9358f13"));
+
+    // The counter carries out of the sequence field into the nonce
+    header = Header(payload.size(), 0xffffffff);
+    datagram = payload;
+    assert(cipher.Crypt(header.data(), datagram.data(), datagram.data(), datagram.size()));
+    assert(datagram == FromHex("f82c7b27eec512b24cc7fcdad3d014492c1e172ca4b4939b679985bdc31868c475d434ac153b1466"));
+}
+
+static void TestKeyHandling() {
+    AesCtrCipher cipher;
+    uint8_t header[AUDIO_CIPHER_HEADER_SIZE] = {};
+    uint8_t data[4] = {};
+    assert(!cipher.Crypt(header, data, data, sizeof(data)));
+    assert(!cipher.SetKey("short"));
+    assert(!cipher.Crypt(header, data, data, sizeof(data)));
+    assert(cipher.SetKey(std::string(16, 'k')));
+    assert(cipher.Crypt(header, data, data, sizeof(data)));
+    // A bad key drops the old one
+    assert(!cipher.SetKey(std::string(32, 'k')));
+    assert(!cipher.Crypt(header, data, data, sizeof(data)));
+}
+
+int main() {
+    TestNistVector();
+    TestWireFormat();
+    TestKeyHandling();
+    printf("test_audio_cipher passed\n");
+    return 0;
+}
@@ -0,0 +1,167 @@
+#include "jitter_buffer.h"
+
+#include <cassert>
+#include <cstdio>
+#include <vector>
+
+#define FRAME_MS 60
+
+// Voice packets are larger than JITTER_BUFFER_SILENCE_PACKET_SIZE, the first
+// byte tells which one came out
+static bool PutPacket(JitterBuffer& buffer, uint32_t sequence, uint32_t arrival_ms, size_t size = 40) {
+    std::vector<uint8_t> packet(size, (uint8_t)sequence);
+    return buffer.Put(sequence, arrival_ms, packet.data(), packet.size());
+}
+
+static uint8_t GetPacket(JitterBuffer& buffer, uint32_t now_ms) {
+    std::vector<uint8_t> packet;
+    assert(buffer.Get(now_ms, packet) == kJitterBufferPacket);
+    assert(!packet.empty());
+    return packet[0];
+}
+
+static void TestReorder() {
+    JitterBuffer buffer(16, 64, FRAME_MS);
+    assert(PutPacket(buffer, 1, 0));
+    assert(PutPacket(buffer, 3, 10));
+    assert(PutPacket(buffer, 2, 20));
+    assert(GetPacket(buffer, 20) == 1);
+    assert(GetPacket(buffer, 80) == 2);
+    assert(GetPacket(buffer, 140) == 3);
+    assert(buffer.empty());
+    assert(buffer.stats().played == 3);
+}
+
+static void TestLossAndLate() {
+    JitterBuffer buffer(16, 64, FRAME_MS);
+    assert(PutPacket(buffer, 1, 0));
+    assert(PutPacket(buffer, 3, 0));
+    assert(GetPacket(buffer, 0) == 1);
+
+    std::vector<uint8_t> packet;
+    assert(buffer.Get(60, packet) == kJitterBufferLost);
+    assert(packet.empty());
+    assert(buffer.stats().concealed == 1);
+
+    // Sequence 2 was concealed already, it is too late to play
+    assert(!PutPacket(buffer, 2, 70));
+    assert(buffer.stats().late == 1);
+    assert(GetPacket(buffer, 120) == 3);
+
+    assert(PutPacket(buffer, 5, 130));
+    assert(!PutPacket(buffer, 5, 131));
+    assert(buffer.stats().duplicated == 1);
+}
+
+static void TestUnderrun() {
+    JitterBuffer buffer(16, 64, FRAME_MS);
+    assert(PutPacket(buffer, 1, 0));
+    assert(GetPacket(buffer, 0) == 1);
+
+    std::vector<uint8_t> packet;
+    assert(buffer.Get(60, packet) == kJitterBufferWait);
+    assert(buffer.stats().underruns == 0);
+    assert(PutPacket(buffer, 2, 200));
+    assert(buffer.stats().underruns == 1);
+}
+
+static void TestTargetFollowsJitter() {
+    JitterBuffer buffer(16, 64, FRAME_MS);
+    assert(buffer.stats().target_depth == 1);
+
+    // A burst faster than real time sets the baseline, then a packet 340ms
+    // behind it raises the target to cover that lateness
+    assert(PutPacket(buffer, 1, 0));
+    assert(PutPacket(buffer, 2, 0));
+    assert(PutPacket(buffer, 3, 0));
+    assert(PutPacket(buffer, 4, 400));
+    assert(buffer.stats().jitter_ms == 340);
+    assert(buffer.stats().target_depth == 7);
+    assert(buffer.latency_ms() == 7 * FRAME_MS);
+
+    // The target is capped at half the capacity
+    assert(PutPacket(buffer, 5, 2000));
+    assert(buffer.stats().target_depth == 8);
+}
+
+static void TestPrebufferTimeout() {
+    JitterBuffer buffer(16, 64, FRAME_MS);
+    assert(PutPacket(buffer, 1, 0));
+    assert(PutPacket(buffer, 2, 0));
+    assert(PutPacket(buffer, 3, 0));
+    assert(PutPacket(buffer, 4, 400));
+    // Four packets are short of the target depth of seven, the first one
+    // has waited long enough at 420ms
+    std::vector<uint8_t> packet;
+    assert(buffer.Get(419, packet) == kJitterBufferWait);
+    for (int i = 0; i < 4; i++) {
+        assert(GetPacket(buffer, 420 + i * FRAME_MS) == i + 1);
+    }
+
+    // The next talk spurt waits for the target depth, or until its first
+    // packet has waited as long as that
+    assert(buffer.Get(700, packet) == kJitterBufferWait);
+    assert(PutPacket(buffer, 5, 1000));
+    int target = buffer.stats().target_depth;
+    assert(target > 1);
+    assert(buffer.Get(1000, packet) == kJitterBufferWait);
+    assert(buffer.Get(1000 + target * FRAME_MS - 1, packet) == kJitterBufferWait);
+    assert(GetPacket(buffer, 1000 + target * FRAME_MS) == 5);
+}
+
+static void TestOverflow() {
+    JitterBuffer buffer(4, 64, FRAME_MS);
+    assert(PutPacket(buffer, 1, 0));
+    // Too far ahead, the window moves and sequence 1 falls out of it
+    assert(PutPacket(buffer, 10, 0));
+    assert(buffer.stats().overflowed == 1);
+    assert(buffer.depth() == 1);
+
+    std::vector<uint8_t> packet;
+    for (int i = 7; i < 10; i++) {
+        assert(buffer.Get(0, packet) == kJitterBufferLost);
+    }
+    assert(GetPacket(buffer, 0) == 10);
+}
+
+static void TestSilenceDropped() {
+    JitterBuffer buffer(16, 64, FRAME_MS);
+    for (uint32_t sequence = 1; sequence <= 6; sequence++) {
+        assert(PutPacket(buffer, sequence, 0, JITTER_BUFFER_SILENCE_PACKET_SIZE));
+    }
+    // Silence is skipped while more than target + 2 packets are buffered
+    assert(GetPacket(buffer, 0) == 4);
+    assert(buffer.stats().silence_dropped == 3);
+}
+
+static void TestArrivalOrder() {
+    JitterBuffer buffer(16, 64, FRAME_MS);
+    std::vector<uint8_t> packet(40);
+    for (uint8_t i = 1; i <= 3; i++) {
+        packet[0] = 100 + i;
+        assert(buffer.Put(0, 0, packet.data(), packet.size()));
+    }
+    for (uint8_t i = 1; i <= 3; i++) {
+        assert(GetPacket(buffer, 0) == 100 + i);
+    }
+}
+
+static void TestOversized() {
+    JitterBuffer buffer(16, 64, FRAME_MS);
+    assert(!PutPacket(buffer, 1, 0, 65));
+    assert(buffer.empty());
+}
+
+int main() {
+    TestReorder();
+    TestLossAndLate();
+    TestUnderrun();
+    TestTargetFollowsJitter();
+    TestPrebufferTimeout();
+    TestOverflow();
+    TestSilenceDropped();
+    TestArrivalOrder();
+    TestOversized();
+    printf("test_jitter_buffer passed\n");
+    return 0;
+}
@@ -0,0 +1,166 @@
+#include "json_reader.h"
+#include "json_writer.h"
+
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+// Values point into the text, literals outlive the reader
+static bool ParseText(JsonReader& reader, const char* text) {
+    return reader.Parse(text, strlen(text));
+}
+
+static void TestServerHello() {
+    const char* text = "{\"type\":\"hello\",\"transport\":\"udp\",\"session_id\":\"s1\","
+        " \"udp\": {\"server\": \"1.2.3.4\", \"port\": 8884, \"key\": \"00ff\", \"nonce\": \"0100\"},"
+        " \"audio_params\": {\"sample_rate\": 24000, \"frame_duration\": 60.0, \"stereo\": false},"
+        " \"list\": [1, \"two\", [3], {\"four\": 4}, null, true]}";
+    JsonReader reader;
+    assert(ParseText(reader, text));
+    auto root = reader.root();
+    assert(root.IsObject() && root.size() == 6);
+    assert(root["type"].Equals("hello"));
+    assert(!root["type"].Equals("hell"));
+    assert(root["session_id"].ToString() == "s1");
+
+    auto udp = root["udp"];
+    assert(udp.IsObject() && udp.size() == 4);
+    assert(udp["server"].ToString() == "1.2.3.4");
+    assert(udp["port"].IsNumber() && udp["port"].ToInt() == 8884);
+    assert(udp["nonce"].Equals("0100"));
+
+    auto params = root["audio_params"];
+    assert(params["sample_rate"].ToInt() == 24000);
+    assert(params["frame_duration"].ToInt() == 60);
+    assert(params["stereo"].IsBool() && !params["stereo"].ToBool(true));
+
+    // Members are found past nested containers
+    auto list = root["list"];
+    assert(list.IsArray() && list.size() == 6);
+    assert(list[0].ToInt() == 1);
+    assert(list[1].Equals("two"));
+    assert(list[2].IsArray() && list[2][0].ToInt() == 3);
+    assert(list[3]["four"].ToInt() == 4);
+    assert(list[4].IsNull());
+    assert(list[5].ToBool());
+    assert(!list[6].IsValid());
+}
+
+// A missing member gives an invalid value all the way down
+static void TestMissing() {
+    JsonReader reader;
+    assert(ParseText(reader, "{\"a\":{\"b\":1}}"));
+    auto root = reader.root();
+    assert(!root["x"].IsValid());
+    assert(!root["x"]["y"][0].IsValid());
+    assert(root["x"]["y"].ToInt(-1) == -1);
+    assert(root["x"].ToString().empty());
+    assert(!root["a"]["b"]["c"].IsValid());
+    assert(root["a"]["b"].ToString().empty());
+    assert(root["a"].ToInt(7) == 7);
+    assert(root["x"].length() == 0);
+}
+
+static void TestNumbers() {
+    JsonReader reader;
+    assert(ParseText(reader, "[0, -12, 3.75, 1e3, -2.5E-1, 1]"));
+    auto root = reader.root();
+    assert(root[0].ToInt() == 0);
+    assert(root[1].ToInt() == -12);
+    assert(root[2].ToInt() == 3);
+    assert(root[3].ToInt() == 1000);
+    assert(root[4].ToInt() == 0);
+    assert(root[5].ToBool());
+
+    const char* invalid[] = { "[01]", "[1.]", "[.5]", "[1e]", "[-]", "[+1]", "[0x10]", "[tru]", "[nul]" };
+    for (auto text : invalid) {
+        assert(!ParseText(reader, text));
+        assert(reader.error() != nullptr);
+        assert(!reader.root().IsValid());
+    }
+}
+
+static void TestStrings() {
+    JsonReader reader;
+    const char* text = "[\"a\\\"b\\\\c\\/d\\b\\f\\n\\r\\t\", \"\\u00e4\\u4f60\", \"\\ud83d\\ude00\", \"\\ud83d!\", \"\\ude00\"]";
+    assert(ParseText(reader, text));
+    auto root = reader.root();
+    assert(root[0].ToString() == "a\"b\\c/d\b\f\n\r\t");
+    // Equals() compares the raw, still escaped text
+    assert(root[0].Equals("a\\\"b\\\\c\\/d\\b\\f\\n\\r\\t"));
+    assert(root[1].ToString() == "\xc3\xa4\xe4\xbd\xa0");
+    assert(root[2].ToString() == "\xf0\x9f\x98\x80");
+    assert(root[3].ToString() == "\xef\xbf\xbd!");
+    assert(root[4].ToString() == "\xef\xbf\xbd");
+
+    const char* invalid[] = { "\"abc", "\"\\x\"", "\"\\u12\"", "\"\\u12g4\"", "\"a\nb\"" };
+    for (auto text : invalid) {
+        assert(!ParseText(reader, text));
+    }
+}
+
+static void TestSyntaxErrors() {
+    const char* invalid[] = {
+        "", "   ", "{", "}", "[1,]", "{\"a\":1,}", "{\"a\" 1}", "{\"a\":}", "{1:2}", "[1 2]",
+        "[1]]", "{\"a\":1}x", "[1],", "{\"a\"::1}", "[}", "{]", ",", ":",
+    };
+    JsonReader reader;
+    for (auto text : invalid) {
+        assert(!ParseText(reader, text));
+        assert(reader.error() != nullptr);
+    }
+
+    assert(ParseText(reader, " {} "));
+    assert(reader.root().IsObject() && reader.root().size() == 0);
+    assert(ParseText(reader, "[[],{}]"));
+    assert(reader.root().size() == 2);
+    assert(ParseText(reader, "42"));
+    assert(reader.root().ToInt() == 42);
+}
+
+static void TestTokenLimit() {
+    std::string text = "[";
+    for (int i = 0; i < JSON_READER_MAX_TOKENS - 1; i++) {
+        text += i == 0 ? "0" : ",0";
+    }
+    text += "]";
+    JsonReader reader;
+    assert(reader.Parse(text));
+    assert(reader.token_count() == JSON_READER_MAX_TOKENS);
+
+    text.insert(text.size() - 1, ",0");
+    assert(!reader.Parse(text));
+    assert(strcmp(reader.error(), "too many tokens") == 0);
+}
+
+// What JsonWriter escapes, JsonReader decodes back
+static void TestWriterRoundTrip() {
+    std::string value("quote\" slash\\ \n\t\x01 \xe4\xbd\xa0\xe5\xa5\xbd");
+    JsonWriter writer;
+    writer.BeginObject();
+    writer.Key("text").String(value);
+    writer.Key("numbers").BeginArray().Number(-5).Number(123456).EndArray();
+    writer.Key("flag").Bool(true);
+    writer.EndObject();
+
+    JsonReader reader;
+    assert(reader.Parse(writer.str()));
+    auto root = reader.root();
+    assert(root["text"].ToString() == value);
+    assert(root["numbers"][0].ToInt() == -5);
+    assert(root["numbers"][1].ToInt() == 123456);
+    assert(root["flag"].ToBool());
+}
+
+int main() {
+    TestServerHello();
+    TestMissing();
+    TestNumbers();
+    TestStrings();
+    TestSyntaxErrors();
+    TestTokenLimit();
+    TestWriterRoundTrip();
+    printf("test_json_reader passed\n");
+    return 0;
+}
@@ -0,0 +1,87 @@
+#include "json_writer.h"
+
+#include <cassert>
+#include <cstdio>
+#include <string>
+
+static void TestStructure() {
+    JsonWriter writer;
+    writer.BeginObject();
+    writer.Key("session_id").String("abc");
+    writer.Key("type").String("listen");
+    writer.Key("empty").BeginObject().EndObject();
+    writer.Key("list").BeginArray();
+    writer.Number(1).Number(-2).BeginArray().EndArray().BeginObject().Key("a").Null().EndObject();
+    writer.EndArray();
+    writer.Key("on").Bool(true);
+    writer.Key("off").Bool(false);
+    writer.Key("big").Number(INT64_MIN);
+    writer.EndObject();
+    assert(writer.str() == "{\"session_id\":\"abc\",\"type\":\"listen\",\"empty\":{},"
+        "\"list\":[1,-2,[],{\"a\":null}],\"on\":true,\"off\":false,\"big\":-9223372036854775808}");
+}
+
+static void TestEscaping() {
+    JsonWriter writer;
+    std::string text("quote\" slash\\ \b\f\n\r\t \x01\x1f \xe4\xbd\xa0\xe5\xa5\xbd");
+    writer.BeginArray().String(text).String(nullptr).EndArray();
+    assert(writer.str() == "[\"quote\\\" slash\\\\ \\b\\f\\n\\r\\t \\u0001\\u001f \xe4\xbd\xa0\xe5\xa5\xbd\",null]");
+
+    // Embedded zeros are written when the length is given
+    writer.Clear();
+    writer.String("a\0b", 3);
+    assert(writer.str() == "\"a\\u0000b\"");
+
+    writer.Clear();
+    writer.BeginObject().Key("k\"ey").Raw("{\"x\":1}").Key("n").Number(0).EndObject();
+    assert(writer.str() == "{\"k\\\"ey\":{\"x\":1},\"n\":0}");
+}
+
+static void TestDepth() {
+    JsonWriter writer;
+    for (int i = 0; i < JSON_WRITER_MAX_DEPTH; i++) {
+        writer.BeginArray().Number(i);
+    }
+    for (int i = 0; i < JSON_WRITER_MAX_DEPTH; i++) {
+        writer.EndArray();
+    }
+    std::string expected;
+    for (int i = 0; i < JSON_WRITER_MAX_DEPTH; i++) {
+        expected += i == 0 ? "[" : ",[";
+        expected += std::to_string(i);
+    }
+    expected += std::string(JSON_WRITER_MAX_DEPTH, ']');
+    assert(writer.str() == expected);
+}
+
+static void TestCapacity() {
+    JsonWriter writer(64);
+    writer.BeginObject().Key("type").String("hello").EndObject();
+    assert(writer.grow_count() == 0);
+
+    writer.Clear();
+    assert(writer.size() == 0);
+    writer.BeginArray();
+    for (int i = 0; i < 100; i++) {
+        writer.String("0123456789");
+    }
+    writer.EndArray();
+    assert(writer.grow_count() > 0);
+    // Quoted strings and the commas between them
+    assert(writer.size() == 2 + 100 * 13 - 1);
+
+    std::string taken = writer.TakeString();
+    assert(taken.size() == 2 + 100 * 13 - 1);
+    writer.Clear();
+    writer.Null();
+    assert(writer.str() == "null");
+}
+
+int main() {
+    TestStructure();
+    TestEscaping();
+    TestDepth();
+    TestCapacity();
+    printf("test_json_writer passed\n");
+    return 0;
+}
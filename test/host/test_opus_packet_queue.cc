@@ -0,0 +1,140 @@
+#include "opus_packet_queue.h"
+
+#include <cassert>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+static bool PushPacket(OpusPacketQueue& queue, uint32_t sequence, size_t size = 20) {
+    std::vector<uint8_t> packet(size, (uint8_t)sequence);
+    OpusPacketInfo info;
+    info.sequence = sequence;
+    info.timestamp = sequence * 60;
+    return queue.Push(packet, info);
+}
+
+static uint32_t PopPacket(OpusPacketQueue& queue) {
+    std::vector<uint8_t> packet;
+    OpusPacketInfo info;
+    assert(queue.Pop(packet, &info));
+    assert(!packet.empty() && packet[0] == (uint8_t)info.sequence);
+    assert(info.timestamp == info.sequence * 60);
+    return info.sequence;
+}
+
+static void TestFifo() {
+    OpusPacketQueue queue(4, 64);
+    assert(queue.empty());
+    for (uint32_t i = 1; i <= 3; i++) {
+        assert(PushPacket(queue, i, 10 + i));
+    }
+    assert(queue.size() == 3);
+
+    std::vector<uint8_t> packet;
+    assert(queue.Pop(packet));
+    assert(packet.size() == 11 && packet[0] == 1);
+    assert(PopPacket(queue) == 2);
+    assert(PopPacket(queue) == 3);
+    assert(!queue.Pop(packet));
+    assert(queue.pushed_count() == 3 && queue.popped_count() == 3);
+    assert(queue.high_watermark() == 3);
+}
+
+static void TestDropOldest() {
+    OpusPacketQueue queue(3, 64, kPacketQueueDropOldest);
+    for (uint32_t i = 1; i <= 5; i++) {
+        assert(PushPacket(queue, i));
+    }
+    assert(queue.size() == 3);
+    assert(queue.dropped_count() == 2);
+    assert(PopPacket(queue) == 3);
+    assert(PopPacket(queue) == 4);
+    assert(PopPacket(queue) == 5);
+}
+
+static void TestDropNewest() {
+    OpusPacketQueue queue(3, 64, kPacketQueueDropNewest);
+    for (uint32_t i = 1; i <= 3; i++) {
+        assert(PushPacket(queue, i));
+    }
+    assert(!PushPacket(queue, 4));
+    assert(queue.dropped_count() == 1);
+    assert(PopPacket(queue) == 1);
+    assert(PushPacket(queue, 5));
+    assert(PopPacket(queue) == 2);
+    assert(PopPacket(queue) == 3);
+    assert(PopPacket(queue) == 5);
+}
+
+static void TestOversizedAndClear() {
+    OpusPacketQueue queue(4, 64);
+    assert(!PushPacket(queue, 1, 65));
+    assert(queue.oversized_count() == 1);
+    assert(queue.empty());
+
+    assert(PushPacket(queue, 2));
+    assert(PushPacket(queue, 3));
+    queue.Clear();
+    assert(queue.empty());
+    assert(PushPacket(queue, 4));
+    assert(PopPacket(queue) == 4);
+}
+
+static void TestWaitForSpace() {
+    OpusPacketQueue queue(2, 64, kPacketQueueDropNewest);
+    assert(queue.WaitForSpace(0));
+    assert(PushPacket(queue, 1));
+    assert(PushPacket(queue, 2));
+    assert(!queue.WaitForSpace(pdMS_TO_TICKS(20)));
+
+    // A pop on the consumer side wakes the producer up
+    std::thread consumer([&queue] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        assert(PopPacket(queue) == 1);
+    });
+    assert(queue.WaitForSpace(pdMS_TO_TICKS(5000)));
+    consumer.join();
+    assert(PushPacket(queue, 3));
+}
+
+// A producer that waits for space loses nothing, whatever the pace of the consumer
+static void TestProducerConsumer() {
+    const uint32_t count = 20000;
+    OpusPacketQueue queue(8, 64, kPacketQueueDropNewest);
+    std::thread producer([&queue, count] {
+        for (uint32_t i = 1; i <= count; i++) {
+            assert(queue.WaitForSpace(portMAX_DELAY));
+            assert(PushPacket(queue, i, 1 + i % 64));
+        }
+    });
+
+    std::vector<uint8_t> packet;
+    OpusPacketInfo info;
+    uint32_t expected = 1;
+    while (expected <= count) {
+        if (!queue.Pop(packet, &info)) {
+            std::this_thread::yield();
+            continue;
+        }
+        assert(info.sequence == expected);
+        assert(packet.size() == 1 + expected % 64);
+        for (auto byte : packet) {
+            assert(byte == (uint8_t)expected);
+        }
+        expected++;
+    }
+    producer.join();
+    assert(queue.dropped_count() == 0);
+    assert(queue.empty());
+}
+
+int main() {
+    TestFifo();
+    TestDropOldest();
+    TestDropNewest();
+    TestOversizedAndClear();
+    TestWaitForSpace();
+    TestProducerConsumer();
+    printf("test_opus_packet_queue passed\n");
+    return 0;
+}
@@ -0,0 +1,93 @@
+#include "ota_decompressor.h"
+
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+static std::vector<uint8_t> ReadFixture(const char* name) {
+    std::ifstream file(std::string(OTA_FIXTURES_DIR) + "/" + name, std::ios::binary);
+    assert(file.good());
+    return std::vector<uint8_t>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+// Feeds the stream in pieces of the given size, as the download delivers it
+static bool Decompress(const std::vector<uint8_t>& stream, size_t piece, std::vector<uint8_t>& image) {
+    OtaDecompressor decompressor;
+    image.clear();
+    auto output = [&image](const uint8_t* data, size_t size) {
+        image.insert(image.end(), data, data + size);
+        return true;
+    };
+    for (size_t offset = 0; offset < stream.size(); offset += piece) {
+        if (!decompressor.Feed(stream.data() + offset, std::min(piece, stream.size() - offset), output)) {
+            return false;
+        }
+    }
+    return decompressor.done() && decompressor.image_size() == image.size();
+}
+
+static void TestRoundTrip() {
+    const char* fixtures[][2] = {
+        { "target.xzlz", "target.bin" },
+        { "target_w8.xzlz", "target.bin" },
+        { "runs.xzlz", "runs.bin" },
+    };
+    for (auto& fixture : fixtures) {
+        auto stream = ReadFixture(fixture[0]);
+        auto expected = ReadFixture(fixture[1]);
+        for (size_t piece : { (size_t)1, (size_t)3, (size_t)1000, (size_t)4096, stream.size() }) {
+            std::vector<uint8_t> image;
+            assert(Decompress(stream, piece, image));
+            assert(image == expected);
+        }
+    }
+}
+
+static void TestRejected() {
+    auto stream = ReadFixture("target.xzlz");
+    std::vector<uint8_t> image;
+
+    auto bad_magic = stream;
+    bad_magic[3] = 'X';
+    assert(!Decompress(bad_magic, 4096, image));
+
+    auto bad_window = stream;
+    bad_window[4] = OTA_COMPRESSED_MAX_WINDOW_BITS + 1;
+    assert(!Decompress(bad_window, 4096, image));
+
+    auto truncated = stream;
+    truncated.resize(truncated.size() - 1);
+    assert(!Decompress(truncated, 4096, image));
+
+    auto extra = stream;
+    extra.push_back(0);
+    assert(!Decompress(extra, 4096, image));
+
+    // Claims a smaller image than the sequences produce
+    auto short_size = stream;
+    short_size[8]--;
+    assert(!Decompress(short_size, 4096, image));
+
+    // A match before anything was written reaches outside the window
+    const uint8_t bad_offset[] = { 'X', 'Z', 'L', 'Z', 12, 0, 0, 0, 8, 0, 0, 0, 0x04, 0x01, 0x00 };
+    assert(!Decompress(std::vector<uint8_t>(bad_offset, bad_offset + sizeof(bad_offset)), 1, image));
+
+    // The output can stop the decompressor, it stays stopped
+    OtaDecompressor decompressor;
+    size_t calls = 0;
+    auto refuse = [&calls](const uint8_t*, size_t) { calls++; return false; };
+    assert(!decompressor.Feed(stream.data(), stream.size(), refuse));
+    assert(!decompressor.Feed(stream.data(), stream.size(), refuse));
+    assert(calls == 1);
+}
+
+int main() {
+    TestRoundTrip();
+    TestRejected();
+    printf("test_ota_decompressor passed\n");
+    return 0;
+}
@@ -0,0 +1,121 @@
+#include "ota_patch.h"
+
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+// The running image, read through esp_partition_read()
+static std::vector<uint8_t> running_image;
+static bool fail_reads = false;
+
+esp_err_t esp_partition_read(const esp_partition_t* partition, size_t src_offset, void* dst, size_t size) {
+    if (fail_reads || src_offset + size > partition->size || src_offset + size > running_image.size()) {
+        return ESP_FAIL;
+    }
+    memcpy(dst, running_image.data() + src_offset, size);
+    return ESP_OK;
+}
+
+static std::vector<uint8_t> ReadFixture(const char* name) {
+    std::ifstream file(std::string(OTA_FIXTURES_DIR) + "/" + name, std::ios::binary);
+    assert(file.good());
+    return std::vector<uint8_t>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+static esp_partition_t RunningPartition(size_t size) {
+    esp_partition_t partition = {};
+    partition.size = size;
+    strcpy(partition.label, "ota_0");
+    return partition;
+}
+
+// Feeds the patch in pieces of the given size, as the download delivers it
+static bool Apply(const esp_partition_t& source, const std::vector<uint8_t>& patch, size_t piece,
+    std::vector<uint8_t>& image) {
+    OtaPatcher patcher(&source);
+    image.clear();
+    auto output = [&image](const uint8_t* data, size_t size) {
+        image.insert(image.end(), data, data + size);
+        return true;
+    };
+    for (size_t offset = 0; offset < patch.size(); offset += piece) {
+        if (!patcher.Feed(patch.data() + offset, std::min(piece, patch.size() - offset), output)) {
+            return false;
+        }
+    }
+    return patcher.done();
+}
+
+static void TestRoundTrip() {
+    running_image = ReadFixture("source.bin");
+    auto target = ReadFixture("target.bin");
+    auto patch = ReadFixture("target.patch");
+    auto source = RunningPartition(running_image.size());
+
+    for (size_t piece : { (size_t)1, (size_t)7, (size_t)1000, (size_t)4096, patch.size() }) {
+        std::vector<uint8_t> image;
+        assert(Apply(source, patch, piece, image));
+        assert(image == target);
+    }
+
+    OtaPatcher patcher(&source);
+    auto discard = [](const uint8_t*, size_t) { return true; };
+    assert(patcher.Feed(patch.data(), patch.size(), discard));
+    assert(patcher.done() && patcher.target_size() == target.size());
+    // Nothing may follow the end op
+    uint8_t extra = 0;
+    assert(!patcher.Feed(&extra, 1, discard));
+}
+
+static void TestTruncated() {
+    running_image = ReadFixture("source.bin");
+    auto patch = ReadFixture("target.patch");
+    auto source = RunningPartition(running_image.size());
+    patch.resize(patch.size() - 1);
+    std::vector<uint8_t> image;
+    assert(!Apply(source, patch, 4096, image));
+}
+
+static void TestRejected() {
+    running_image = ReadFixture("source.bin");
+    auto patch = ReadFixture("target.patch");
+    std::vector<uint8_t> image;
+
+    auto bad_magic = patch;
+    bad_magic[0] = 'Y';
+    auto source = RunningPartition(running_image.size());
+    assert(!Apply(source, bad_magic, 4096, image));
+    assert(image.empty());
+
+    // Made against a larger image than the one running
+    auto small = RunningPartition(running_image.size() - 1);
+    assert(!Apply(small, patch, 4096, image));
+
+    auto bad_op = patch;
+    bad_op[OTA_PATCH_HEADER_SIZE] = 7;
+    assert(!Apply(source, bad_op, 4096, image));
+
+    fail_reads = true;
+    assert(!Apply(source, patch, 4096, image));
+    fail_reads = false;
+
+    // The output can stop the patcher, it stays stopped
+    OtaPatcher patcher(&source);
+    size_t calls = 0;
+    auto refuse = [&calls](const uint8_t*, size_t) { calls++; return false; };
+    assert(!patcher.Feed(patch.data(), patch.size(), refuse));
+    assert(!patcher.Feed(patch.data(), patch.size(), refuse));
+    assert(calls == 1);
+}
+
+int main() {
+    TestRoundTrip();
+    TestTruncated();
+    TestRejected();
+    printf("test_ota_patch passed\n");
+    return 0;
+}
@@ -0,0 +1,89 @@
+#include "pcm_frame_pool.h"
+
+#include <cassert>
+#include <cstdio>
+#include <thread>
+#include <utility>
+#include <vector>
+
+static void TestAcquireAndRelease() {
+    PcmFramePool pool(480, 2);
+    {
+        PcmFrame first = pool.Acquire();
+        PcmFrame second = pool.Acquire();
+        assert(first && second);
+        assert(first.data() != second.data());
+        assert(first.size() == 480 && first.capacity() == 480);
+        assert(pool.in_use() == 2);
+
+        // Exhausted, the caller gets an empty frame
+        PcmFrame third = pool.Acquire();
+        assert(!third && third.size() == 0 && third.capacity() == 0);
+        assert(pool.exhausted_count() == 1);
+    }
+    assert(pool.in_use() == 0);
+    assert(pool.peak_in_use() == 2);
+
+    // A returned block comes out whole again
+    PcmFrame frame = pool.Acquire();
+    frame.resize(100);
+    assert(frame.size() == 100);
+    frame = PcmFrame();
+    frame = pool.Acquire();
+    assert(frame.size() == 480);
+}
+
+// Copies share the block, it goes back to the pool with the last one
+static void TestSharing() {
+    PcmFramePool pool(16, 1);
+    PcmFrame frame = pool.Acquire();
+    frame.data()[0] = 1234;
+
+    PcmFrame copy = frame;
+    PcmFrame assigned;
+    assigned = copy;
+    assert(assigned.data() == frame.data() && assigned.data()[0] == 1234);
+    assigned = assigned;
+
+    PcmFrame moved = std::move(frame);
+    assert(!frame && moved);
+    frame = std::move(moved);
+    assert(!moved && frame.data()[0] == 1234);
+
+    copy = PcmFrame();
+    frame = PcmFrame();
+    assert(pool.in_use() == 1);
+    assigned = PcmFrame();
+    assert(pool.in_use() == 0);
+    assert(pool.Acquire());
+}
+
+// Frames are captured on one task and released on others
+static void TestThreads() {
+    PcmFramePool pool(64, 8);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++) {
+        threads.emplace_back([&pool] {
+            for (int i = 0; i < 20000; i++) {
+                PcmFrame frame = pool.Acquire();
+                if (frame) {
+                    PcmFrame copy = frame;
+                    frame.data()[0] = i;
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    assert(pool.in_use() == 0);
+    assert(pool.peak_in_use() <= 8);
+}
+
+int main() {
+    TestAcquireAndRelease();
+    TestSharing();
+    TestThreads();
+    printf("test_pcm_frame_pool passed\n");
+    return 0;
+}